@@ -0,0 +1,280 @@
+#pragma once
+
+// The exports declared in CWTDGenApi.h, compiled into the DLL only. Each one catches everything
+// and keeps the message for cwtd_last_error.
+
+static thread_local std::string s_apiError;
+
+template<typename F>
+cwtd_result ApiCall(F&& f) noexcept
+{
+	try
+	{
+		f();
+		s_apiError.clear();
+		return S_OK;
+	}
+	catch (const wil::ResultException& e)
+	{
+		s_apiError = e.what();
+		return e.GetErrorCode();
+	}
+	catch (const std::exception& e)
+	{
+		s_apiError = e.what();
+		return wil::ResultFromCaughtException();
+	}
+	catch (...)
+	{
+		const auto hr = wil::ResultFromCaughtException();
+		s_apiError = std::format("error 0x{:08X}", static_cast<uint32_t>(hr));
+		return hr;
+	}
+}
+
+// What wWinMain sets up for the exe, the factories and GDI+, kept while any context is
+class ApiRuntime
+{
+public:
+	static void AddRef()
+	{
+		std::lock_guard lock(s_lock);
+		if (s_refs != 0)
+		{
+			++s_refs;
+			return;
+		}
+
+		// A failed start leaves nothing behind for the next attempt to trip over
+		auto resetFactories = wil::scope_exit([] {
+			g_dwriteFactory.reset();
+			g_d2dFactory.reset();
+		});
+		THROW_IF_FAILED(D2D1CreateFactory(D2D1_FACTORY_TYPE_MULTI_THREADED, &g_d2dFactory));
+		THROW_IF_FAILED(DWriteCreateFactory(DWRITE_FACTORY_TYPE_SHARED, __uuidof(g_dwriteFactory), g_dwriteFactory.put_unknown()));
+		Gp::GdiplusStartupInput input;
+		THROW_IF_FAILED(HRESULT_FROM_GPSTATUS(Gp::GdiplusStartup(&s_gdiplusToken, &input, nullptr)));
+		resetFactories.release();
+		s_refs = 1;
+	}
+
+	static void Release()
+	{
+		std::lock_guard lock(s_lock);
+		if (--s_refs != 0)
+			return;
+
+		// The caches hold objects of the factories
+		{
+			auto& cache = GetTextFormatCache();
+			std::lock_guard cacheLock(cache.lock);
+			cache.formats.clear();
+		}
+		{
+			auto& cache = GetFontCoverageCache();
+			std::lock_guard cacheLock(cache.lock);
+			cache.coverage.clear();
+		}
+		Gp::GdiplusShutdown(s_gdiplusToken);
+		g_dwriteFactory.reset();
+		g_d2dFactory.reset();
+	}
+
+private:
+	static inline std::mutex s_lock;
+	static inline size_t s_refs = 0;
+	static inline ULONG_PTR s_gdiplusToken = 0;
+};
+
+struct cwtd_context
+{
+	std::map<std::wstring, std::wstring> options;
+	GeneratorCaches caches;
+
+	GenerateOptions Options() const
+	{
+		return ParseGenerateOptions(L"options", [this](const wchar_t* key) -> std::optional<std::wstring> {
+			if (auto it = options.find(key); it != options.end())
+				return it->second;
+			return std::nullopt;
+		});
+	}
+};
+
+struct cwtd_source
+{
+	std::shared_ptr<const SourceResource> resource;
+};
+
+struct cwtd_bitmap
+{
+	CharsBitmap bitmap;
+};
+
+struct cwtd_atlas
+{
+	std::shared_ptr<const DirectX::ScratchImage> image;
+};
+
+// Rejects sources that can't be patched when they are loaded rather than written
+inline void CheckSource(const SourceResource& source)
+{
+	const RageUtil::TextureDictionaryView view(source.data.get(), source.header);
+	THROW_HR_IF_MSG(HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT), view.Textures().empty(), "the dictionary has no texture to base font_chs on");
+}
+
+uint32_t cwtd_api_version(void)
+{
+	return CWTD_API_VERSION;
+}
+
+const char* cwtd_last_error(void)
+{
+	return s_apiError.c_str();
+}
+
+cwtd_result cwtd_context_create(cwtd_context** context)
+{
+	return ApiCall([&] {
+		THROW_HR_IF(E_POINTER, !context);
+		ApiRuntime::AddRef();
+		auto releaseRuntime = wil::scope_exit([] { ApiRuntime::Release(); });
+		*context = new cwtd_context();
+		releaseRuntime.release();
+	});
+}
+
+void cwtd_context_destroy(cwtd_context* context)
+{
+	if (!context)
+		return;
+	delete context;
+	ApiRuntime::Release();
+}
+
+cwtd_result cwtd_context_set_option(cwtd_context* context, const wchar_t* key, const wchar_t* value)
+{
+	return ApiCall([&] {
+		THROW_HR_IF(E_POINTER, !context || !key);
+		if (value)
+			context->options.insert_or_assign(key, value);
+		else
+			context->options.erase(key);
+	});
+}
+
+cwtd_result cwtd_source_load(cwtd_context* context, const wchar_t* path, cwtd_source** source)
+{
+	return ApiCall([&] {
+		THROW_HR_IF(E_POINTER, !context || !path || !source);
+		auto resource = context->caches.GetSource(fs::path(path));
+		CheckSource(*resource);
+		*source = new cwtd_source{ std::move(resource) };
+	});
+}
+
+cwtd_result cwtd_source_load_memory(cwtd_context* context, const void* data, size_t size, cwtd_source** source)
+{
+	return ApiCall([&] {
+		THROW_HR_IF(E_POINTER, !context || !data || !source);
+		auto resource = std::make_shared<const SourceResource>(ReadWTD(std::span<const uint8_t>(static_cast<const uint8_t*>(data), size)));
+		CheckSource(*resource);
+		*source = new cwtd_source{ std::move(resource) };
+	});
+}
+
+void cwtd_source_destroy(cwtd_source* source)
+{
+	delete source;
+}
+
+cwtd_result cwtd_render(cwtd_context* context, const uint32_t* chars, size_t count, cwtd_bitmap** bitmap)
+{
+	return ApiCall([&] {
+		THROW_HR_IF(E_POINTER, !context || (!chars && count != 0) || !bitmap);
+		const std::u32string text(chars, chars + count);
+		*bitmap = new cwtd_bitmap{ RenderCharsBitmap(context->Options(), text) };
+	});
+}
+
+cwtd_result cwtd_bitmap_pixels(const cwtd_bitmap* bitmap, const uint8_t** pixels, size_t* rowPitch, uint32_t* width, uint32_t* height)
+{
+	return ApiCall([&] {
+		THROW_HR_IF(E_POINTER, !bitmap || !pixels || !rowPitch || !width || !height);
+		const auto img = bitmap->bitmap.Image();
+		*pixels = img.pixels;
+		*rowPitch = img.rowPitch;
+		*width = bitmap->bitmap.width;
+		*height = bitmap->bitmap.height;
+	});
+}
+
+void cwtd_bitmap_destroy(cwtd_bitmap* bitmap)
+{
+	delete bitmap;
+}
+
+cwtd_result cwtd_encode(cwtd_context* context, const cwtd_bitmap* bitmap, cwtd_atlas** atlas)
+{
+	return ApiCall([&] {
+		THROW_HR_IF(E_POINTER, !context || !bitmap || !atlas);
+		const auto options = context->Options();
+		auto image = std::make_shared<const DirectX::ScratchImage>(EncodeCharsImage(bitmap->bitmap.Image(), options.format, options.quality));
+		*atlas = new cwtd_atlas{ std::move(image) };
+	});
+}
+
+cwtd_result cwtd_generate(cwtd_context* context, const wchar_t* charTablePath, cwtd_atlas** atlas)
+{
+	return ApiCall([&] {
+		THROW_HR_IF(E_POINTER, !context || !charTablePath || !atlas);
+		*atlas = new cwtd_atlas{ context->caches.GetImage(context->Options(), fs::path(charTablePath)) };
+	});
+}
+
+cwtd_result cwtd_atlas_blocks(const cwtd_atlas* atlas, const uint8_t** blocks, size_t* size, size_t* rowPitch, uint32_t* width, uint32_t* height)
+{
+	return ApiCall([&] {
+		THROW_HR_IF(E_POINTER, !atlas || !blocks || !size || !rowPitch || !width || !height);
+		const auto img = atlas->image->GetImage(0, 0, 0);
+		*blocks = img->pixels;
+		*size = img->slicePitch;
+		*rowPitch = img->rowPitch;
+		*width = static_cast<uint32_t>(img->width);
+		*height = static_cast<uint32_t>(img->height);
+	});
+}
+
+void cwtd_atlas_destroy(cwtd_atlas* atlas)
+{
+	delete atlas;
+}
+
+cwtd_result cwtd_write_file(const cwtd_source* source, const cwtd_atlas* atlas, const wchar_t* path)
+{
+	return ApiCall([&] {
+		THROW_HR_IF(E_POINTER, !source || !atlas || !path);
+		WtdPatch patch(*source->resource, *atlas->image);
+		patch.Write(fs::path(path));
+	});
+}
+
+// CoTaskMemAlloc, so callers without cwtd_free can use CoTaskMemFree
+cwtd_result cwtd_write_memory(const cwtd_source* source, const cwtd_atlas* atlas, uint8_t** data, size_t* size)
+{
+	return ApiCall([&] {
+		THROW_HR_IF(E_POINTER, !source || !atlas || !data || !size);
+		WtdPatch patch(*source->resource, *atlas->image);
+		const auto serialized = patch.Serialize();
+		wil::unique_cotaskmem_ptr<uint8_t> buffer(static_cast<uint8_t*>(CoTaskMemAlloc(serialized.size())));
+		THROW_IF_NULL_ALLOC(buffer);
+		std::copy(serialized.begin(), serialized.end(), buffer.get());
+		*data = buffer.release();
+		*size = serialized.size();
+	});
+}
+
+void cwtd_free(void* data)
+{
+	CoTaskMemFree(data);
+}
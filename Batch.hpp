@@ -0,0 +1,760 @@
+#pragma once
+
+// Headless generation of font variants listed in an INI job file. Every section
+// except [defaults] is a variant, keys missing from a variant come from [defaults]:
+//
+// [defaults]
+// gamePath=D:\Games\GTAIV   ; source fonts.wtd files, relative paths are relative to the job file
+// charTable=...             ; optional, the game's char_table.dat by default
+// backend=dwrite            ; dwrite or gdip
+// size=58                   ; em size in pixels, the sweep command compares sizes
+// quote=cn                  ; cn or en
+// format=dxt5               ; font_chs format: dxt5, or a8 or l8 for uncompressed coverage without outline or shadow
+// experimentalFormats=false ; a8 and l8 have not been seen to draw in the games and need this set to true
+// quality=default           ; BC3 effort: fast, default or high
+// metrics=false             ; measure the BC3 error against the rendered atlas, dxt5 only
+// outline=0                 ; glyph effects, all optional: outline radius in pixels,
+// outlineColor=000000       ;   outline color as RRGGBB,
+// shadow=2,2                ;   shadow offset, no shadow by default,
+// shadowBlur=0              ;   shadow blur radius in pixels,
+// shadowColor=000000        ;   shadow color as RRGGBB,
+// shadowOpacity=60          ;   shadow opacity in percent,
+// gamma=1.0                 ;   fill coverage gamma,
+// contrast=1.0              ;   fill coverage contrast
+// games=IV,TLAD,TBoGT
+// weight=700
+//
+// [SimHei]
+// font=SimHei
+// symbolFont=Microsoft YaHei ; optional, same as font by default
+// fallbackFonts=Segoe UI Symbol,SimSun-ExtB ; optional, tried in order for characters font and symbolFont lack
+// output=out\SimHei          ; optional, out\<variant> by default
+
+struct BatchJob
+{
+	std::wstring name;
+	GenerateOptions options;
+	fs::path gamePath;
+	fs::path charTablePath;
+	fs::path outputRoot;
+	std::vector<const GameInfo*> games;
+	bool metrics = false;
+	bool manifest = true; // Write ManifestFileName to outputRoot
+};
+
+LOGFONTW MakeLogFont(std::wstring_view faceName, LONG weight, LONG height = DefaultFontHeight)
+{
+	THROW_HR_IF(E_INVALIDARG, faceName.empty() || faceName.size() >= LF_FACESIZE);
+	LOGFONTW lf = {
+		.lfHeight = height,
+		.lfWeight = weight,
+		.lfCharSet = GB2312_CHARSET,
+		.lfQuality = DEFAULT_QUALITY
+	};
+	faceName.copy(lf.lfFaceName, LF_FACESIZE - 1);
+	return lf;
+}
+
+bool EqualsIgnoreCase(std::wstring_view l, std::wstring_view r)
+{
+	return CompareStringOrdinal(l.data(), static_cast<int>(l.size()), r.data(), static_cast<int>(r.size()), TRUE) == CSTR_EQUAL;
+}
+
+// Returns the value of a job key, nullopt if it is not set
+using JobKeyLookup = std::function<std::optional<std::wstring>(const wchar_t* key)>;
+
+std::optional<Bc3Quality> ParseBc3Quality(std::wstring_view name)
+{
+	for (uint32_t i = 0; i < std::size(Bc3QualityNames); ++i)
+	{
+		if (EqualsIgnoreCase(name, Bc3QualityNames[i]))
+			return static_cast<Bc3Quality>(i);
+	}
+	return std::nullopt;
+}
+
+std::optional<AtlasFormat> ParseAtlasFormat(std::wstring_view name)
+{
+	for (uint32_t i = 0; i < std::size(AtlasFormatNames); ++i)
+	{
+		if (EqualsIgnoreCase(name, AtlasFormatNames[i]))
+			return static_cast<AtlasFormat>(i);
+	}
+	return std::nullopt;
+}
+
+// RRGGBB
+COLORREF ParseColor(const std::wstring& name, const std::wstring& value)
+{
+	THROW_HR_IF_MSG(E_INVALIDARG, value.size() != 6 || value.find_first_not_of(L"0123456789abcdefABCDEF") != value.npos, "[%ls] bad color %ls", name.c_str(), value.c_str());
+	const auto rgb = std::stoul(value, nullptr, 16);
+	return RGB((rgb >> 16) & 0xff, (rgb >> 8) & 0xff, rgb & 0xff);
+}
+
+// outline, outlineColor, shadow, shadowBlur, shadowColor, shadowOpacity, gamma and contrast
+GlyphEffects ParseGlyphEffects(const std::wstring& name, const JobKeyLookup& get)
+{
+	GlyphEffects effects;
+	effects.outline = std::stoul(get(L"outline").value_or(L"0"));
+	effects.outlineColor = ParseColor(name, get(L"outlineColor").value_or(L"000000"));
+	if (auto shadow = get(L"shadow"))
+	{
+		const auto offset = SplitList(*shadow);
+		THROW_HR_IF_MSG(E_INVALIDARG, offset.size() != 2, "[%ls] shadow must be x,y", name.c_str());
+		effects.shadowX = std::stol(offset[0]);
+		effects.shadowY = std::stol(offset[1]);
+		effects.shadowOpacity = static_cast<uint8_t>(std::lround(std::clamp(std::stof(get(L"shadowOpacity").value_or(L"60")), 0.0f, 100.0f) * 2.55f));
+	}
+	effects.shadowBlur = std::stoul(get(L"shadowBlur").value_or(L"0"));
+	effects.shadowColor = ParseColor(name, get(L"shadowColor").value_or(L"000000"));
+	effects.gamma = std::stof(get(L"gamma").value_or(L"1.0"));
+	effects.contrast = std::stof(get(L"contrast").value_or(L"1.0"));
+
+	THROW_HR_IF_MSG(E_INVALIDARG, effects.outline > GlyphEffects::MaxRadius || effects.shadowBlur > GlyphEffects::MaxRadius,
+		"[%ls] outline and shadowBlur are at most %u pixels", name.c_str(), GlyphEffects::MaxRadius);
+	THROW_HR_IF_MSG(E_INVALIDARG, std::abs(effects.shadowX) >= static_cast<int32_t>(CharWidth) || std::abs(effects.shadowY) >= static_cast<int32_t>(CharHeight), "[%ls] shadow is outside the cell", name.c_str());
+	THROW_HR_IF_MSG(E_INVALIDARG, !(effects.gamma > 0) || !(effects.contrast >= 0), "[%ls] bad gamma or contrast", name.c_str());
+	return effects;
+}
+
+// font, symbolFont, fallbackFonts, weight, size, backend, quote, format, experimentalFormats, quality and the glyph effects
+GenerateOptions ParseGenerateOptions(const std::wstring& name, const JobKeyLookup& get)
+{
+	GenerateOptions options;
+
+	auto font = get(L"font");
+	THROW_HR_IF_MSG(E_INVALIDARG, !font, "[%ls] font is required", name.c_str());
+	const auto weight = static_cast<LONG>(std::stol(get(L"weight").value_or(L"700")));
+	const auto size = static_cast<LONG>(std::stol(get(L"size").value_or(std::to_wstring(-DefaultFontHeight))));
+	THROW_HR_IF_MSG(E_INVALIDARG, size < 8 || size > 2 * static_cast<LONG>(CharHeight), "[%ls] size must be 8 to %u", name.c_str(), 2 * CharHeight);
+	options.fonts.font = MakeLogFont(*font, weight, -size);
+	options.fonts.symbolFont = MakeLogFont(get(L"symbolFont").value_or(*font), weight, -size);
+	for (const auto& fallback : SplitList(get(L"fallbackFonts").value_or(L"")))
+		options.fonts.fallbacks.push_back(MakeLogFont(fallback, weight, -size));
+
+	const auto backend = get(L"backend").value_or(L"dwrite");
+	THROW_HR_IF_MSG(E_INVALIDARG, !EqualsIgnoreCase(backend, L"dwrite") && !EqualsIgnoreCase(backend, L"gdip"), "[%ls] unknown backend %ls", name.c_str(), backend.c_str());
+	options.useGDIP = EqualsIgnoreCase(backend, L"gdip");
+
+	const auto quote = get(L"quote").value_or(L"cn");
+	THROW_HR_IF_MSG(E_INVALIDARG, !EqualsIgnoreCase(quote, L"cn") && !EqualsIgnoreCase(quote, L"en"), "[%ls] unknown quote mode %ls", name.c_str(), quote.c_str());
+	options.replaceChars = EqualsIgnoreCase(quote, L"en");
+
+	const auto quality = get(L"quality").value_or(L"default");
+	const auto parsedQuality = ParseBc3Quality(quality);
+	THROW_HR_IF_MSG(E_INVALIDARG, !parsedQuality, "[%ls] unknown quality %ls", name.c_str(), quality.c_str());
+	options.quality = *parsedQuality;
+	options.effects = ParseGlyphEffects(name, get);
+
+	const auto format = get(L"format").value_or(L"dxt5");
+	const auto parsedFormat = ParseAtlasFormat(format);
+	THROW_HR_IF_MSG(E_INVALIDARG, !parsedFormat, "[%ls] unknown format %ls", name.c_str(), format.c_str());
+	options.format = *parsedFormat;
+	const auto experimental = get(L"experimentalFormats").value_or(L"false");
+	THROW_HR_IF_MSG(E_INVALIDARG, options.format != AtlasFormat::Dxt5 && !EqualsIgnoreCase(experimental, L"true") && experimental != L"1",
+		"[%ls] format=%ls is experimental, the game's font shader isn't known to draw it; set experimentalFormats=true to write it anyway", name.c_str(), format.c_str());
+	// The 8-bit formats keep only coverage, an outline or shadow would draw as more glyph
+	THROW_HR_IF_MSG(E_INVALIDARG, options.format != AtlasFormat::Dxt5 && (options.effects.outline != 0 || options.effects.shadowOpacity != 0),
+		"[%ls] outline and shadow need format=dxt5", name.c_str());
+
+	return options;
+}
+
+// Relative paths are relative to baseDir
+BatchJob ParseBatchJob(const std::wstring& name, const JobKeyLookup& get, const fs::path& baseDir)
+{
+	BatchJob job;
+	job.name = name;
+	job.options = ParseGenerateOptions(name, get);
+
+	auto gamePath = get(L"gamePath");
+	THROW_HR_IF_MSG(E_INVALIDARG, !gamePath, "[%ls] gamePath is required", name.c_str());
+	job.gamePath = baseDir / *gamePath; // Absolute values replace the base
+	auto charTable = get(L"charTable");
+	job.charTablePath = charTable ? baseDir / *charTable : job.gamePath / CharTableDatPath;
+	auto output = get(L"output");
+	job.outputRoot = output ? baseDir / *output : baseDir / L"out" / name;
+
+	for (const auto& gameName : SplitList(get(L"games").value_or(L"IV,TLAD,TBoGT")))
+	{
+		auto game = std::find_if(std::begin(Games), std::end(Games), [&](const GameInfo& g) { return EqualsIgnoreCase(g.name, gameName); });
+		THROW_HR_IF_MSG(E_INVALIDARG, game == std::end(Games), "[%ls] unknown game %ls", name.c_str(), gameName.c_str());
+		job.games.push_back(game);
+	}
+	THROW_HR_IF_MSG(E_INVALIDARG, job.games.empty(), "[%ls] no games selected", name.c_str());
+
+	const auto metrics = get(L"metrics").value_or(L"false");
+	// A8 and L8 hold the rendered coverage exactly
+	job.metrics = (EqualsIgnoreCase(metrics, L"true") || metrics == L"1") && job.options.format == AtlasFormat::Dxt5;
+
+	return job;
+}
+
+// nullopt for missing or empty values
+std::optional<std::wstring> GetIniString(const fs::path& path, const wchar_t* section, const wchar_t* key)
+{
+	std::wstring value(1024, L'\0');
+	DWORD length;
+	while ((length = GetPrivateProfileStringW(section, key, L"", value.data(), static_cast<DWORD>(value.size()), path.c_str())) == value.size() - 1)
+		value.resize(value.size() * 2);
+	value.resize(length);
+	if (value.empty())
+		return std::nullopt;
+	return value;
+}
+
+void WriteIniString(const fs::path& path, const std::wstring& section, const std::wstring& key, const std::wstring& value)
+{
+	THROW_IF_WIN32_BOOL_FALSE(WritePrivateProfileStringW(section.c_str(), key.c_str(), value.c_str(), path.c_str()));
+}
+
+class JobFile
+{
+public:
+	explicit JobFile(const fs::path& path) : m_path(fs::absolute(path)) {}
+
+	std::vector<std::wstring> Sections() const
+	{
+		std::wstring buf(4096, L'\0');
+		DWORD length;
+		while ((length = GetPrivateProfileSectionNamesW(buf.data(), static_cast<DWORD>(buf.size()), m_path.c_str())) == buf.size() - 2)
+			buf.resize(buf.size() * 2);
+		buf.resize(length);
+		return SplitList(buf, L'\0');
+	}
+
+	// Variant value, then [defaults] value
+	std::optional<std::wstring> Get(const std::wstring& section, const wchar_t* key) const
+	{
+		if (auto value = GetIniString(m_path, section.c_str(), key))
+			return value;
+		return GetIniString(m_path, L"defaults", key);
+	}
+
+	BatchJob ReadJob(const std::wstring& section) const
+	{
+		return ParseBatchJob(section, [&](const wchar_t* key) { return Get(section, key); }, m_path.parent_path());
+	}
+
+private:
+	fs::path m_path;
+};
+
+std::vector<BatchJob> ReadJobFile(const fs::path& path)
+{
+	THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND), !fs::is_regular_file(path));
+
+	JobFile jobFile(path);
+	std::vector<BatchJob> jobs;
+	for (const auto& section : jobFile.Sections())
+	{
+		if (!EqualsIgnoreCase(section, L"defaults"))
+			jobs.emplace_back(jobFile.ReadJob(section));
+	}
+	return jobs;
+}
+
+enum struct GeneratePhase : uint32_t
+{
+	Queued,
+	Load, // Char table and source fonts.wtd files
+	Render,
+	Compress,
+	Write,
+	Done
+};
+
+const char* GeneratePhaseName(GeneratePhase phase)
+{
+	constexpr const char* Names[] = { "queued", "load", "render", "compress", "write", "done" };
+	return Names[static_cast<uint32_t>(phase)];
+}
+
+// Written to the output root once a job's games have finished, for the verify and deploy
+// commands. One section per game written: path (relative to the install), format, width,
+// height and crc32c of the font_chs top level data. The file is replaced as a whole, so games
+// that failed or were dropped from the job leave no stale section behind.
+constexpr auto ManifestFileName = L"CWTDGen.manifest.ini";
+
+void WriteManifest(const fs::path& outputRoot, std::span<const GameInfo* const> games, uint32_t width, uint32_t height, AtlasFormat format, uint32_t crc)
+{
+	const auto path = outputRoot / ManifestFileName;
+	if (games.empty())
+	{
+		DeleteFileW(path.c_str());
+		return;
+	}
+
+	const auto temp = TempPathFor(path);
+	auto removeTemp = wil::scope_exit([&] { DeleteFileW(temp.c_str()); });
+	for (const auto game : games)
+	{
+		WriteIniString(temp, game->name, L"path", game->newFontsPath);
+		WriteIniString(temp, game->name, L"format", AtlasFormatName(format));
+		WriteIniString(temp, game->name, L"width", std::to_wstring(width));
+		WriteIniString(temp, game->name, L"height", std::to_wstring(height));
+		WriteIniString(temp, game->name, L"crc32c", std::format(L"{:08x}", crc));
+	}
+	THROW_IF_WIN32_BOOL_FALSE(MoveFileExW(temp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING));
+	removeTemp.release();
+}
+
+// The large buffers a job holds: decoded sources, the rendered DIB, the encoded image and the
+// patched dictionaries. Charged with their real sizes as the job allocates and drops them.
+class MemoryAccount
+{
+public:
+	void Charge(uint64_t bytes)
+	{
+		const uint64_t current = m_current.fetch_add(bytes) + bytes;
+		for (uint64_t peak = m_peak.load(); current > peak && !m_peak.compare_exchange_weak(peak, current);)
+			;
+	}
+
+	void Release(uint64_t bytes) { m_current.fetch_sub(bytes); }
+	uint64_t Peak() const { return m_peak.load(); }
+
+private:
+	std::atomic<uint64_t> m_current = 0;
+	std::atomic<uint64_t> m_peak = 0;
+};
+
+// One variant being generated on a TaskScheduler, started by StartGenerate. Progress and
+// Cancel may be used from any thread. Cancellation is checked between rows while rendering,
+// between bands while compressing and between deflate chunks while writing; a cancelled job
+// ends with HRESULT_FROM_WIN32(ERROR_CANCELLED) and leaves the outputs it had not finished
+// untouched. Render and Compress are skipped when the image is already cached.
+class GenerateJob : public std::enable_shared_from_this<GenerateJob>
+{
+public:
+	// Runs on a worker once the job ends, before Wait returns
+	using Callback = std::function<void(GenerateJob&)>;
+
+	GenerateJob(BatchJob request, Callback onDone) : m_request(std::move(request)), m_onDone(std::move(onDone)), m_progress(m_stop.get_token()) {}
+
+	GenerateJob(const GenerateJob&) = delete;
+	GenerateJob& operator=(const GenerateJob&) = delete;
+
+	const BatchJob& Request() const { return m_request; }
+	GeneratePhase Phase() const { return m_phase.load(); }
+
+	// Done and total of the current phase: items while loading, rows, bands, then uncompressed bytes
+	std::pair<uint64_t, uint64_t> PhaseProgress() const { return { m_progress.Done(), m_progress.Total() }; }
+
+	// 0 to 1 over the whole job, phases weighted by their usual share of the time
+	double Fraction() const
+	{
+		constexpr double Start[] = { 0.0, 0.0, 0.05, 0.5, 0.75, 1.0 };
+		const auto phase = static_cast<uint32_t>(Phase());
+		if (phase >= static_cast<uint32_t>(GeneratePhase::Done))
+			return 1.0;
+		const auto [done, total] = PhaseProgress();
+		const double inPhase = total != 0 ? std::min(static_cast<double>(done) / static_cast<double>(total), 1.0) : 0.0;
+		return Start[phase] + (Start[phase + 1] - Start[phase]) * inPhase;
+	}
+
+	void Cancel() { m_stop.request_stop(); }
+	bool IsCancelled() const { return m_stop.stop_requested(); }
+	bool IsDone() const { return Phase() == GeneratePhase::Done; }
+
+	void Wait() const
+	{
+		for (auto phase = m_phase.load(); phase != GeneratePhase::Done; phase = m_phase.load())
+			m_phase.wait(phase);
+	}
+
+	// The rest are valid once the job is done
+	HRESULT Result() const { return m_hr; }
+	const std::vector<fs::path>& Outputs() const { return m_outputs; }
+	std::chrono::milliseconds Elapsed() const { return m_elapsed; }
+	const std::optional<AtlasError>& Error() const { return m_error; } // Set if metrics were requested
+	const std::vector<char32_t>& Uncovered() const { return m_uncovered; } // Characters no font has
+	uint64_t MemoryPeak() const { return m_memory.Peak(); } // High-water mark of the large buffers, in bytes
+
+private:
+	friend std::shared_ptr<GenerateJob> StartGenerate(TaskScheduler& scheduler, GeneratorCaches& caches, BatchJob request, GenerateJob::Callback onDone);
+
+	void SetPhase(GeneratePhase phase)
+	{
+		m_phase = phase;
+		m_phase.notify_all();
+	}
+
+	// Loads the inputs and makes the image, then patches the games as separate tasks so they
+	// spread over idle workers. The last game to finish ends the job.
+	void Run(TaskScheduler& scheduler, GeneratorCaches& caches)
+	{
+		TRACE_SCOPE("job");
+		m_start = std::chrono::steady_clock::now();
+		std::vector<std::shared_ptr<const SourceResource>> sources;
+		std::shared_ptr<const DirectX::ScratchImage> image;
+		std::optional<CharsBitmap> bitmap; // Kept for the metrics
+		try
+		{
+			SetPhase(GeneratePhase::Load);
+			m_progress.Begin(1 + m_request.games.size());
+			const auto charTable = caches.GetCharTable(m_request.charTablePath);
+			m_uncovered = ResolveFonts(m_request.options.fonts, charTable->Chars(), m_request.options.replaceChars).uncovered;
+			m_progress.Advance();
+			for (const auto game : m_request.games)
+			{
+				sources.push_back(caches.GetSource(m_request.gamePath / game->fontsPath));
+				m_memory.Charge(sources.back()->size);
+				m_progress.Advance();
+			}
+
+			while (!image)
+			{
+				try
+				{
+					image = caches.GetImage(m_request.options, m_request.charTablePath, [this, &bitmap](const CharTable& charTable) {
+						SetPhase(GeneratePhase::Render);
+						auto rendered = RenderCharsBitmap(m_request.options, charTable.Chars(), TextureWidth, TextureHeight, &m_progress);
+						m_memory.Charge(rendered.Image().slicePitch);
+						SetPhase(GeneratePhase::Compress);
+						auto compressed = EncodeCharsImage(rendered.Image(), m_request.options.format, m_request.options.quality, &m_progress);
+						m_memory.Charge(compressed.GetPixelsSize());
+						if (m_request.metrics)
+							bitmap = std::move(rendered);
+						else
+							m_memory.Release(rendered.Image().slicePitch);
+						return compressed;
+					});
+				}
+				catch (...)
+				{
+					// The image may have been loading for another job that was cancelled, load it again
+					if (wil::ResultFromCaughtException() != HRESULT_FROM_WIN32(ERROR_CANCELLED) || IsCancelled())
+						throw;
+				}
+			}
+
+			if (m_request.metrics)
+			{
+				if (!bitmap) // The image came from the cache
+				{
+					bitmap = RenderCharsBitmap(m_request.options, caches.GetCharTable(m_request.charTablePath)->Chars());
+					m_memory.Charge(bitmap->Image().slicePitch);
+				}
+				m_error = MeasureBc3Error(bitmap->Image(), *image);
+				m_memory.Release(bitmap->Image().slicePitch);
+				bitmap.reset();
+			}
+
+			const auto top = image->GetImage(0, 0, 0);
+			m_pixelsCrc = Crc32c({ top->pixels, top->slicePitch });
+			m_atlasWidth = static_cast<uint32_t>(top->width);
+			m_atlasHeight = static_cast<uint32_t>(top->height);
+
+			SetPhase(GeneratePhase::Write);
+			uint64_t total = 0;
+			for (const auto& source : sources)
+				total += source->size + image->GetPixelsSize();
+			m_progress.Begin(total);
+		}
+		catch (...)
+		{
+			Finish(wil::ResultFromCaughtException());
+			return;
+		}
+
+		if (m_request.games.empty())
+		{
+			Finish(S_OK);
+			return;
+		}
+
+		m_remaining = m_request.games.size();
+		m_gamesStarted = true;
+		for (size_t i = 0; i < m_request.games.size(); ++i)
+		{
+			scheduler.Submit([self = shared_from_this(), image, source = sources[i], game = m_request.games[i]] {
+				TRACE_SCOPE("game");
+				HRESULT hr = S_OK;
+				try
+				{
+					self->m_progress.Check();
+					auto out = self->m_request.outputRoot / game->newFontsPath;
+					fs::create_directories(out.parent_path());
+					// The patch copies the source
+					self->m_memory.Charge(source->size);
+					auto release = wil::scope_exit([&] { self->m_memory.Release(source->size); });
+					WtdPatch patch(*source, *image);
+					patch.Write(out, &self->m_progress);
+
+					std::lock_guard lock(self->m_lock);
+					self->m_outputs.emplace_back(std::move(out));
+					self->m_written.push_back(game);
+				}
+				catch (...)
+				{
+					hr = wil::ResultFromCaughtException();
+				}
+				self->Finish(hr);
+			});
+		}
+	}
+
+	// Called once by Run on failure, otherwise once per game
+	void Finish(HRESULT hr)
+	{
+		{
+			std::lock_guard lock(m_lock);
+			if (SUCCEEDED(m_hr))
+				m_hr = hr;
+			if (m_remaining > 1)
+			{
+				--m_remaining;
+				return;
+			}
+			m_remaining = 0;
+		}
+
+		if (m_gamesStarted && m_request.manifest)
+		{
+			try
+			{
+				// In the job's game order, whichever order they finished in
+				std::vector<const GameInfo*> written;
+				for (const auto game : m_request.games)
+				{
+					if (std::find(m_written.begin(), m_written.end(), game) != m_written.end())
+						written.push_back(game);
+				}
+				WriteManifest(m_request.outputRoot, written, m_atlasWidth, m_atlasHeight, m_request.options.format, m_pixelsCrc);
+			}
+			catch (...)
+			{
+				const auto manifestHr = wil::ResultFromCaughtException();
+				std::lock_guard lock(m_lock);
+				if (SUCCEEDED(m_hr))
+					m_hr = manifestHr;
+			}
+		}
+
+		m_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_start);
+		if (m_onDone)
+		{
+			try
+			{
+				m_onDone(*this);
+			}
+			CATCH_LOG();
+		}
+		SetPhase(GeneratePhase::Done);
+	}
+
+	const BatchJob m_request;
+	const Callback m_onDone;
+	std::stop_source m_stop;
+	JobProgress m_progress;
+	std::atomic<GeneratePhase> m_phase = GeneratePhase::Queued;
+
+	std::mutex m_lock;
+	HRESULT m_hr = S_OK;
+	std::vector<fs::path> m_outputs;
+	uint32_t m_pixelsCrc = 0; // Set before the game tasks start
+	uint32_t m_atlasWidth = 0;
+	uint32_t m_atlasHeight = 0;
+	bool m_gamesStarted = false;
+	std::vector<const GameInfo*> m_written; // Games whose output was written
+	std::optional<AtlasError> m_error;
+	std::vector<char32_t> m_uncovered;
+	MemoryAccount m_memory;
+	size_t m_remaining = 0; // Game tasks still running
+	std::chrono::steady_clock::time_point m_start;
+	std::chrono::milliseconds m_elapsed{};
+};
+
+// Queues request on scheduler and returns at once. caches must outlive the job.
+std::shared_ptr<GenerateJob> StartGenerate(TaskScheduler& scheduler, GeneratorCaches& caches, BatchJob request, GenerateJob::Callback onDone = nullptr)
+{
+	auto job = std::make_shared<GenerateJob>(std::move(request), std::move(onDone));
+	scheduler.Submit([job, &scheduler, &caches] { job->Run(scheduler, caches); });
+	return job;
+}
+
+// Peak bytes of the buffers a job charges to its MemoryAccount, from its parameters: the BGRA
+// DIB and the encoded image of each atlas page, a second DIB for metrics, and each source both
+// decoded and copied into its patch. Sources that can't be read count as nothing, the job
+// fails on them anyway.
+uint64_t EstimateJobMemory(const BatchJob& job)
+{
+	constexpr uint64_t Pages = 1;
+	constexpr uint64_t RenderBytesPerPixel = 4, EncodedBytesPerPixel = 1; // DXT5, A8 and L8 alike
+	const uint64_t pixels = Pages * TextureWidth * TextureHeight;
+	uint64_t bytes = pixels * (RenderBytesPerPixel + EncodedBytesPerPixel);
+	if (job.metrics)
+		bytes += pixels * RenderBytesPerPixel;
+	for (const auto game : job.games)
+	{
+		try
+		{
+			bytes += 2 * ReadWTDDecodedSize(job.gamePath / game->fontsPath);
+		}
+		CATCH_LOG();
+	}
+	return bytes;
+}
+
+// Admits jobs while the sum of their estimated peaks fits budget bytes, and keeps the caches
+// within what the admitted jobs leave. A job larger than the whole budget runs alone rather
+// than never. Every finished job's measured peak corrects the
+// estimates after it: the factor follows the measured / estimated ratio down slowly and up at
+// once, so a bad estimate costs parallelism rather than swapping.
+class MemoryAdmission
+{
+public:
+	explicit MemoryAdmission(uint64_t budget) : m_budget(budget) {}
+
+	// The budget when none is given: three quarters of the physical memory available now
+	static uint64_t DefaultBudget()
+	{
+		MEMORYSTATUSEX status = { .dwLength = sizeof(status) };
+		THROW_IF_WIN32_BOOL_FALSE(GlobalMemoryStatusEx(&status));
+		return status.ullAvailPhys / 4 * 3;
+	}
+
+	uint64_t Budget() const { return m_budget; }
+
+	// base as corrected by the peaks measured so far
+	uint64_t Estimate(uint64_t base) const
+	{
+		std::lock_guard lock(m_lock);
+		return static_cast<uint64_t>(static_cast<double>(base) * m_correction);
+	}
+
+	// Blocks until bytes fit in what the running jobs leave of the budget, then evicts cached
+	// entries until they fit in what is left after that
+	void Acquire(uint64_t bytes, GeneratorCaches& caches)
+	{
+		std::unique_lock lock(m_lock);
+		m_released.wait(lock, [&] { return m_inUse == 0 || m_inUse + bytes <= m_budget; });
+		m_inUse += bytes;
+		caches.Trim(m_budget - std::min(m_budget, m_inUse));
+	}
+
+	void Release(uint64_t bytes, uint64_t estimated, uint64_t measured)
+	{
+		{
+			std::lock_guard lock(m_lock);
+			m_inUse -= bytes;
+			if (estimated != 0 && measured != 0)
+			{
+				const double ratio = static_cast<double>(measured) / static_cast<double>(estimated);
+				m_correction = std::max(ratio, m_correction * 0.9 + ratio * 0.1);
+			}
+		}
+		m_released.notify_all();
+	}
+
+private:
+	const uint64_t m_budget;
+	mutable std::mutex m_lock;
+	std::condition_variable m_released;
+	uint64_t m_inUse = 0;
+	double m_correction = 1.0;
+};
+
+// Starts every job and waits for all of them. Identical jobs share their image through the caches.
+// With admission, each job starts only once its estimated peak fits the budget, and estimated
+// receives the bytes each job was admitted with.
+std::vector<std::shared_ptr<GenerateJob>> RunBatch(std::span<const BatchJob> jobs, TaskScheduler& scheduler, GeneratorCaches& caches,
+	MemoryAdmission* admission = nullptr, std::vector<uint64_t>* estimated = nullptr)
+{
+	std::vector<std::shared_ptr<GenerateJob>> results;
+	for (const auto& job : jobs)
+	{
+		if (!admission)
+		{
+			results.push_back(StartGenerate(scheduler, caches, job));
+			continue;
+		}
+
+		const uint64_t base = EstimateJobMemory(job);
+		const uint64_t bytes = admission->Estimate(base);
+		if (estimated)
+			estimated->push_back(bytes);
+		admission->Acquire(bytes, caches);
+		results.push_back(StartGenerate(scheduler, caches, job, [admission, base, bytes](GenerateJob& done) {
+			admission->Release(bytes, base, done.MemoryPeak());
+		}));
+	}
+	for (const auto& result : results)
+		result->Wait();
+	return results;
+}
+
+// batch <job file> [--json=results.json|-] [--threads=N] [--memory=MiB]
+int CliBatch(const CliArgs& args)
+{
+	if (args.positional.empty())
+		return ExitUsage;
+
+	const auto jobs = ReadJobFile(fs::path(args.positional[0]));
+	TaskScheduler scheduler(args.GetCount(L"threads").value_or(std::max(std::thread::hardware_concurrency(), 1u)));
+	GeneratorCaches caches;
+	const auto memory = args.GetCount(L"memory");
+	THROW_HR_IF_MSG(E_INVALIDARG, memory && *memory > UINT64_MAX / (1024 * 1024), "--memory is too large");
+	MemoryAdmission admission(memory ? *memory * 1024 * 1024 : MemoryAdmission::DefaultBudget());
+	std::vector<uint64_t> estimated;
+
+	auto start = std::chrono::steady_clock::now();
+	auto results = RunBatch(jobs, scheduler, caches, &admission, &estimated);
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+	size_t failed = 0;
+	JsonWriter json;
+	json.BeginObject();
+	json.Member("elapsedMs", elapsed.count());
+	json.Member("threads", scheduler.WorkerCount());
+	json.Member("memoryBudget", admission.Budget());
+	json.Key("jobs").BeginArray();
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		const auto& result = *results[i];
+		const bool ok = SUCCEEDED(result.Result());
+		failed += ok ? 0 : 1;
+
+		PrintError(L"{} {} ({} ms){}\n", ok ? L"ok    " : L"failed", jobs[i].name, result.Elapsed().count(), ok ? L"" : L": " + HResultMessage(result.Result()));
+		if (const auto& uncovered = result.Uncovered(); !uncovered.empty())
+			PrintError(L"       {} characters have no glyph in any font: {}\n", uncovered.size(), FormatCodePoints(uncovered, 16));
+		if (const auto& error = result.Error())
+			PrintError(L"       {} quality, PSNR {:.2f} dB, max error {}\n", Bc3QualityName(jobs[i].options.quality), error->atlas.Psnr(), error->atlas.maxError);
+
+		json.BeginObject();
+		json.Member("name", jobs[i].name);
+		json.Member("ok", ok);
+		json.Member("hresult", static_cast<uint32_t>(result.Result()));
+		if (!ok)
+			json.Member("message", HResultMessage(result.Result()));
+		json.Member("elapsedMs", result.Elapsed().count());
+		json.Member("memoryEstimate", estimated[i]);
+		json.Member("memoryPeak", result.MemoryPeak());
+		json.Key("outputs").BeginArray();
+		for (const auto& out : result.Outputs())
+			json.Value(out.wstring());
+		json.EndArray();
+		json.Member("format", AtlasFormatName(jobs[i].options.format));
+		json.Member("quality", Bc3QualityName(jobs[i].options.quality));
+		json.Key("uncovered").BeginArray();
+		for (const auto ch : result.Uncovered())
+			json.Value(static_cast<uint32_t>(ch));
+		json.EndArray();
+		if (const auto& error = result.Error())
+		{
+			json.Key("bc3Error");
+			WriteAtlasError(json, *error, caches.GetCharTable(jobs[i].charTablePath)->Chars(), 10);
+		}
+		json.EndObject();
+	}
+	json.EndArray();
+	json.Member("failed", failed);
+	json.EndObject();
+
+	if (auto jsonPath = args.Get(L"json"))
+		WriteJsonOutput(*jsonPath, json);
+	PrintError(L"{} of {} variants generated in {} ms\n", jobs.size() - failed, jobs.size(), elapsed.count());
+
+	return failed == 0 ? ExitSuccess : ExitFailure;
+}
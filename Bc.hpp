@@ -0,0 +1,672 @@
+#pragma once
+
+// BC1-3 decoding, and the BC3 encoder behind the quality tiers with its error metrics
+
+// Expands a 565 color to r, g, b, 0 in the low four 16 bit lanes
+inline __m128i ExpandColor565(uint32_t c)
+{
+	const uint32_t r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+	return _mm_setr_epi16(static_cast<short>((r << 3) | (r >> 2)), static_cast<short>((g << 2) | (g >> 4)), static_cast<short>((b << 3) | (b >> 2)), 0, 0, 0, 0, 0);
+}
+
+// The four RGBA colors of a BC1 color block. BC2 and BC3 always use the four color mode.
+inline void DecodeColorPalette(const uint8_t* block, bool threeColorMode, uint32_t (&palette)[4])
+{
+	const uint32_t c0 = block[0] | (block[1] << 8), c1 = block[2] | (block[3] << 8);
+	const __m128i a = ExpandColor565(c0), b = ExpandColor565(c1);
+	const __m128i one = _mm_set1_epi16(1);
+	const bool fourColors = c0 > c1 || !threeColorMode;
+
+	__m128i p2, p3;
+	if (fourColors)
+	{
+		// (2a + b + 1) / 3 and (a + 2b + 1) / 3, x / 3 == (x * 0xAAAB) >> 17 for x < 98304
+		const __m128i third = _mm_set1_epi16(static_cast<short>(0xAAAB));
+		p2 = _mm_srli_epi16(_mm_mulhi_epu16(_mm_add_epi16(_mm_add_epi16(_mm_add_epi16(a, a), b), one), third), 1);
+		p3 = _mm_srli_epi16(_mm_mulhi_epu16(_mm_add_epi16(_mm_add_epi16(_mm_add_epi16(b, b), a), one), third), 1);
+	}
+	else
+	{
+		p2 = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(a, b), one), 1);
+		p3 = _mm_setzero_si128();
+	}
+
+	// Bytes 0-3 a, 4-7 b, 8-11 p2, 12-15 p3, each r g b 0
+	const __m128i packed = _mm_packus_epi16(_mm_unpacklo_epi64(a, b), _mm_unpacklo_epi64(p2, p3));
+	const __m128i alpha = _mm_setr_epi32(static_cast<int>(0xFF000000), static_cast<int>(0xFF000000), static_cast<int>(0xFF000000), fourColors ? static_cast<int>(0xFF000000) : 0);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(palette), _mm_or_si128(packed, alpha));
+}
+
+// The eight values of a BC3 alpha block with endpoints a0 and a1
+inline void DecodeAlphaPalette(uint32_t a0, uint32_t a1, uint32_t (&alphas)[8])
+{
+	alphas[0] = a0;
+	alphas[1] = a1;
+	if (a0 > a1)
+	{
+		for (uint32_t i = 1; i < 7; ++i)
+			alphas[i + 1] = ((7 - i) * a0 + i * a1 + 3) / 7;
+	}
+	else
+	{
+		for (uint32_t i = 1; i < 5; ++i)
+			alphas[i + 1] = ((5 - i) * a0 + i * a1 + 2) / 5;
+		alphas[6] = 0;
+		alphas[7] = 255;
+	}
+}
+
+// Decodes BC1, BC2 or BC3 blocks to RGBA8 rows of rowPitch bytes
+void DecodeBc(DXGI_FORMAT format, const uint8_t* blocks, uint32_t width, uint32_t height, uint8_t* rgba, size_t rowPitch)
+{
+	const size_t blockSize = format == DXGI_FORMAT_BC1_UNORM ? 8 : 16;
+	const uint32_t xBlocks = std::max((width + 3) / 4, 1u), yBlocks = std::max((height + 3) / 4, 1u);
+
+	for (uint32_t by = 0; by < yBlocks; ++by)
+	{
+		for (uint32_t bx = 0; bx < xBlocks; ++bx, blocks += blockSize)
+		{
+			alignas(16) uint32_t pixels[16];
+			const uint8_t* colorBlock = format == DXGI_FORMAT_BC1_UNORM ? blocks : blocks + 8;
+
+			uint32_t palette[4];
+			DecodeColorPalette(colorBlock, format == DXGI_FORMAT_BC1_UNORM, palette);
+			const uint32_t indices = colorBlock[4] | (colorBlock[5] << 8) | (colorBlock[6] << 16) | (static_cast<uint32_t>(colorBlock[7]) << 24);
+			for (uint32_t i = 0; i < 16; ++i)
+				pixels[i] = palette[(indices >> (2 * i)) & 3];
+
+			if (format == DXGI_FORMAT_BC2_UNORM)
+			{
+				for (uint32_t i = 0; i < 16; ++i)
+					pixels[i] = (pixels[i] & 0x00FFFFFF) | (((blocks[i / 2] >> (4 * (i & 1))) & 0xF) * 17u << 24);
+			}
+			else if (format == DXGI_FORMAT_BC3_UNORM)
+			{
+				uint32_t alphas[8];
+				DecodeAlphaPalette(blocks[0], blocks[1], alphas);
+
+				uint64_t alphaIndices = 0;
+				for (uint32_t i = 0; i < 6; ++i)
+					alphaIndices |= static_cast<uint64_t>(blocks[2 + i]) << (8 * i);
+				for (uint32_t i = 0; i < 16; ++i)
+					pixels[i] = (pixels[i] & 0x00FFFFFF) | (alphas[(alphaIndices >> (3 * i)) & 7] << 24);
+			}
+
+			// Blocks on the right and bottom edges may be partly outside the image
+			const uint32_t columns = std::min(width - bx * 4, 4u), rows = std::min(height - by * 4, 4u);
+			for (uint32_t y = 0; y < rows; ++y)
+			{
+				auto dst = rgba + (static_cast<size_t>(by) * 4 + y) * rowPitch + static_cast<size_t>(bx) * 16;
+				if (columns == 4)
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_load_si128(reinterpret_cast<const __m128i*>(pixels + y * 4)));
+				else
+					std::copy_n(reinterpret_cast<const uint8_t*>(pixels + y * 4), columns * 4, dst);
+			}
+		}
+	}
+}
+
+// Swaps bytes 0 and 2 of every pixel: BGRA to RGBA and back
+inline __m128i SwapRedBlue(__m128i px)
+{
+	const __m128i greenAlpha = _mm_set1_epi32(static_cast<int>(0xFF00FF00));
+	const __m128i redBlue = _mm_andnot_si128(greenAlpha, px);
+	return _mm_or_si128(_mm_and_si128(px, greenAlpha), _mm_or_si128(_mm_slli_epi32(redBlue, 16), _mm_srli_epi32(redBlue, 16)));
+}
+
+void BgraToRgba(const uint8_t* src, size_t count, uint8_t* dst)
+{
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), SwapRedBlue(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4))));
+	for (; i < count; ++i)
+	{
+		dst[i * 4 + 0] = src[i * 4 + 2];
+		dst[i * 4 + 1] = src[i * 4 + 1];
+		dst[i * 4 + 2] = src[i * 4 + 0];
+		dst[i * 4 + 3] = src[i * 4 + 3];
+	}
+}
+
+
+enum struct Bc3Quality : uint32_t
+{
+	Fast, // One pass: bounding box endpoints, indices by projection
+	Default, // DirectXTex
+	High // DirectXTex with uniform channel weights, then a search for better alpha endpoints
+};
+
+constexpr const wchar_t* Bc3QualityNames[] = { L"fast", L"default", L"high" };
+
+inline const wchar_t* Bc3QualityName(Bc3Quality quality)
+{
+	return Bc3QualityNames[static_cast<uint32_t>(quality)];
+}
+
+// The 4x4 BGRA block at x, y, with edge pixels repeated where it leaves the image
+inline void LoadBlock(const DirectX::Image& img, size_t x, size_t y, uint8_t (&bgra)[64])
+{
+	for (size_t row = 0; row < 4; ++row)
+	{
+		const auto src = img.pixels + std::min(y + row, img.height - 1) * img.rowPitch;
+		for (size_t column = 0; column < 4; ++column)
+			std::copy_n(src + std::min(x + column, img.width - 1) * 4, 4, bgra + (row * 4 + column) * 4);
+	}
+}
+
+inline uint32_t To565(uint32_t r, uint32_t g, uint32_t b)
+{
+	return (((r * 31 + 127) / 255) << 11) | (((g * 63 + 127) / 255) << 5) | ((b * 31 + 127) / 255);
+}
+
+// The color half of a BC3 block, from the bounding box of the block's colors
+inline void EncodeColorFast(const uint8_t (&bgra)[64], uint8_t* block)
+{
+	uint8_t lo[3] = { 255, 255, 255 }, hi[3] = {};
+	for (size_t i = 0; i < 16; ++i)
+	{
+		for (size_t c = 0; c < 3; ++c)
+		{
+			lo[c] = std::min(lo[c], bgra[i * 4 + c]);
+			hi[c] = std::max(hi[c], bgra[i * 4 + c]);
+		}
+	}
+
+	uint32_t c0 = To565(hi[2], hi[1], hi[0]), c1 = To565(lo[2], lo[1], lo[0]);
+	uint32_t indices = 0;
+	if (c0 != c1)
+	{
+		if (c0 < c1)
+			std::swap(c0, c1); // Decoders that honor the BC1 order still see four colors
+
+		// Projected onto the decoded endpoints, step counts thirds from c1 to c0
+		alignas(16) int16_t e0[8], e1[8];
+		_mm_store_si128(reinterpret_cast<__m128i*>(e0), ExpandColor565(c0));
+		_mm_store_si128(reinterpret_cast<__m128i*>(e1), ExpandColor565(c1));
+		const int dr = e0[0] - e1[0], dg = e0[1] - e1[1], db = e0[2] - e1[2];
+		const int dd = dr * dr + dg * dg + db * db;
+		constexpr uint32_t IndexOfStep[] = { 1, 3, 2, 0 };
+		for (uint32_t i = 0; i < 16; ++i)
+		{
+			const int t = (bgra[i * 4 + 2] - e1[0]) * dr + (bgra[i * 4 + 1] - e1[1]) * dg + (bgra[i * 4] - e1[2]) * db;
+			const int step = t <= 0 ? 0 : std::min((t * 6 + dd) / (2 * dd), 3);
+			indices |= IndexOfStep[step] << (2 * i);
+		}
+	}
+
+	block[0] = static_cast<uint8_t>(c0);
+	block[1] = static_cast<uint8_t>(c0 >> 8);
+	block[2] = static_cast<uint8_t>(c1);
+	block[3] = static_cast<uint8_t>(c1 >> 8);
+	for (uint32_t i = 0; i < 4; ++i)
+		block[4 + i] = static_cast<uint8_t>(indices >> (8 * i));
+}
+
+inline void StoreAlphaBlock(uint32_t a0, uint32_t a1, uint64_t indices, uint8_t* block)
+{
+	block[0] = static_cast<uint8_t>(a0);
+	block[1] = static_cast<uint8_t>(a1);
+	for (uint32_t i = 0; i < 6; ++i)
+		block[2 + i] = static_cast<uint8_t>(indices >> (8 * i));
+}
+
+// The alpha half of a BC3 block, eight values between the block's extremes
+inline void EncodeAlphaFast(const uint8_t (&alpha)[16], uint8_t* block)
+{
+	const auto [lo, hi] = std::minmax_element(alpha, alpha + 16);
+	uint64_t indices = 0;
+	if (*hi != *lo)
+	{
+		const uint32_t range = *hi - *lo;
+		for (uint32_t i = 0; i < 16; ++i)
+		{
+			const uint32_t step = ((*hi - alpha[i]) * 7 + range / 2) / range; // From a0 towards a1
+			const uint64_t index = step == 0 ? 0 : step == 7 ? 1 : step + 1;
+			indices |= index << (3 * i);
+		}
+	}
+	StoreAlphaBlock(*hi, *lo, indices, block);
+}
+
+// Sum of squared errors of the best index for every value, and those indices
+inline uint32_t FitAlpha(const uint8_t (&alpha)[16], uint32_t a0, uint32_t a1, uint64_t& indices, uint32_t limit = UINT32_MAX)
+{
+	uint32_t palette[8];
+	DecodeAlphaPalette(a0, a1, palette);
+	uint32_t error = 0;
+	indices = 0;
+	for (uint32_t i = 0; i < 16 && error < limit; ++i)
+	{
+		uint32_t best = 0, bestError = UINT32_MAX;
+		for (uint32_t j = 0; j < 8; ++j)
+		{
+			const int d = static_cast<int>(palette[j]) - alpha[i];
+			const uint32_t e = static_cast<uint32_t>(d * d);
+			if (e < bestError)
+			{
+				best = j;
+				bestError = e;
+			}
+		}
+		error += bestError;
+		indices |= static_cast<uint64_t>(best) << (3 * i);
+	}
+	return error;
+}
+
+// Replaces the alpha half of block if a better pair of endpoints turns up. Every pair within
+// AlphaSearchWindow levels of the block's extremes is tried in both modes; the six value mode
+// gets 0 and 255 for free, so its endpoints only need to cover the values in between.
+inline void RefineAlpha(const uint8_t (&alpha)[16], uint8_t* block)
+{
+	constexpr int AlphaSearchWindow = 8;
+
+	// The block's own indices may not be the best for its endpoints
+	uint64_t indices;
+	uint32_t best = FitAlpha(alpha, block[0], block[1], indices);
+	StoreAlphaBlock(block[0], block[1], indices, block);
+
+	int lo = 255, hi = 0, innerLo = 255, innerHi = 0;
+	for (const auto a : alpha)
+	{
+		lo = std::min<int>(lo, a);
+		hi = std::max<int>(hi, a);
+		if (a != 0 && a != 255)
+		{
+			innerLo = std::min<int>(innerLo, a);
+			innerHi = std::max<int>(innerHi, a);
+		}
+	}
+
+	auto tryPair = [&](int a0, int a1) {
+		if (best == 0)
+			return;
+		const uint32_t error = FitAlpha(alpha, a0, a1, indices, best);
+		if (error < best)
+		{
+			best = error;
+			StoreAlphaBlock(a0, a1, indices, block);
+		}
+	};
+
+	for (int a0 = std::max(hi - AlphaSearchWindow, 1); a0 <= hi; ++a0)
+	{
+		for (int a1 = lo; a1 <= std::min(lo + AlphaSearchWindow, a0 - 1); ++a1)
+			tryPair(a0, a1);
+	}
+	if (innerLo > innerHi)
+		tryPair(0, 0); // Only 0 and 255
+	for (int a0 = innerLo; a0 <= std::min(innerLo + AlphaSearchWindow, innerHi); ++a0)
+	{
+		for (int a1 = std::max(innerHi - AlphaSearchWindow, a0); a1 <= innerHi; ++a1)
+			tryPair(a0, a1);
+	}
+}
+
+// Encoded BC3 blocks by their 4x4 BGRA source, shared by the threads compressing one image of
+// one quality. Glyph atlases repeat many blocks: empty space, solid stroke interiors, straight
+// stroke edges. Every tier encodes a block from its own pixels alone, so a reused result is the
+// one encoding it again would give. Only the first MaxBlocks distinct blocks are kept.
+class Bc3BlockMemo
+{
+public:
+	static constexpr size_t MaxBlocks = 65536;
+
+	struct Key
+	{
+		alignas(16) uint8_t bgra[64];
+
+		bool operator==(const Key&) const = default;
+	};
+
+	struct KeyHash
+	{
+		size_t operator()(const Key& key) const
+		{
+			uint64_t hash = 0;
+			for (size_t i = 0; i < sizeof(key.bgra); i += 8)
+			{
+				uint64_t word;
+				memcpy(&word, key.bgra + i, sizeof(word));
+				hash = (hash ^ word) * 0x9E3779B97F4A7C15;
+				hash ^= hash >> 29;
+			}
+			return static_cast<size_t>(hash);
+		}
+	};
+
+	// Copies the encoded block to block if key is known
+	bool Find(const Key& key, uint8_t* block)
+	{
+		auto& shard = ShardOf(key);
+		std::lock_guard lock(shard.lock);
+		const auto it = shard.blocks.find(key);
+		if (it == shard.blocks.end())
+			return false;
+		std::copy_n(it->second.data(), it->second.size(), block);
+		return true;
+	}
+
+	void Insert(const Key& key, const uint8_t* block)
+	{
+		if (m_size.load(std::memory_order_relaxed) >= MaxBlocks)
+			return;
+		auto& shard = ShardOf(key);
+		std::lock_guard lock(shard.lock);
+		auto [it, added] = shard.blocks.try_emplace(key);
+		if (added)
+		{
+			std::copy_n(block, it->second.size(), it->second.data());
+			m_size.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	// Blocks looked up, and how many of them didn't need encoding
+	void Count(uint64_t lookups, uint64_t hits)
+	{
+		m_lookups.fetch_add(lookups, std::memory_order_relaxed);
+		m_hits.fetch_add(hits, std::memory_order_relaxed);
+	}
+
+	uint64_t Lookups() const { return m_lookups.load(std::memory_order_relaxed); }
+	uint64_t Hits() const { return m_hits.load(std::memory_order_relaxed); }
+	double HitRate() const { return Lookups() != 0 ? static_cast<double>(Hits()) / static_cast<double>(Lookups()) : 0.0; }
+
+private:
+	static constexpr size_t ShardCount = 64;
+
+	struct alignas(64) Shard
+	{
+		std::mutex lock;
+		std::unordered_map<Key, std::array<uint8_t, 16>, KeyHash> blocks;
+	};
+
+	Shard& ShardOf(const Key& key) { return m_shards[(KeyHash()(key) >> 58) % ShardCount]; }
+
+	std::array<Shard, ShardCount> m_shards;
+	std::atomic<size_t> m_size = 0;
+	std::atomic<uint64_t> m_lookups = 0;
+	std::atomic<uint64_t> m_hits = 0;
+};
+
+// Encodes the blocks of img that cover [left, right) x [top, bottom) into the same blocks of
+// bc3. The bounds are multiples of 4 except at the right and bottom edges of the image.
+// With memo, known blocks are copied and every other distinct block is encoded once; the
+// DirectXTex tiers get those gathered into one strip. DirectXTex pads partial blocks unlike
+// LoadBlock, so for them the memo is only used when the image has none.
+void EncodeBc3Region(const DirectX::Image& img, size_t left, size_t top, size_t right, size_t bottom, Bc3Quality quality, DirectX::ScratchImage& bc3, Bc3BlockMemo* memo = nullptr)
+{
+	constexpr size_t BlockSize = 16;
+	const auto dst = bc3.GetImage(0, 0, 0);
+	auto blockAt = [&](size_t x, size_t y) { return dst->pixels + y / 4 * dst->rowPitch + x / 4 * BlockSize; };
+
+	if (memo && (quality == Bc3Quality::Fast || (img.width % 4 == 0 && img.height % 4 == 0)))
+	{
+		struct Miss
+		{
+			Bc3BlockMemo::Key key;
+			std::vector<uint8_t*> blocks;
+		};
+		std::vector<Miss> misses;
+		std::unordered_map<Bc3BlockMemo::Key, size_t, Bc3BlockMemo::KeyHash> missIndex;
+		uint64_t lookups = 0, hits = 0;
+		Bc3BlockMemo::Key key;
+		for (size_t y = top; y < bottom; y += 4)
+		{
+			for (size_t x = left; x < right; x += 4, ++lookups)
+			{
+				LoadBlock(img, x, y, key.bgra);
+				const auto block = blockAt(x, y);
+				if (memo->Find(key, block))
+				{
+					++hits;
+					continue;
+				}
+				auto [it, added] = missIndex.try_emplace(key, misses.size());
+				if (added)
+					misses.push_back({ key });
+				else
+					++hits;
+				misses[it->second].blocks.push_back(block);
+			}
+		}
+
+		std::vector<std::array<uint8_t, BlockSize>> encoded(misses.size());
+		if (quality == Bc3Quality::Fast)
+		{
+			for (size_t i = 0; i < misses.size(); ++i)
+			{
+				uint8_t alpha[16];
+				for (size_t j = 0; j < 16; ++j)
+					alpha[j] = misses[i].key.bgra[j * 4 + 3];
+				EncodeAlphaFast(alpha, encoded[i].data());
+				EncodeColorFast(misses[i].key.bgra, encoded[i].data() + 8);
+			}
+		}
+		else if (!misses.empty())
+		{
+			// StripBlocks blocks to a row, the end of the last row left empty
+			constexpr size_t StripBlocks = 1024;
+			const size_t stripWidth = std::min(misses.size(), StripBlocks) * 4, stripHeight = (misses.size() + StripBlocks - 1) / StripBlocks * 4;
+			std::vector<uint8_t> strip(stripWidth * stripHeight * 4);
+			for (size_t i = 0; i < misses.size(); ++i)
+			{
+				for (size_t row = 0; row < 4; ++row)
+					std::copy_n(misses[i].key.bgra + row * 16, 16, strip.data() + (i / StripBlocks * 4 + row) * stripWidth * 4 + i % StripBlocks * 16);
+			}
+			const DirectX::Image stripImage = {
+				.width = stripWidth,
+				.height = stripHeight,
+				.format = img.format,
+				.rowPitch = stripWidth * 4,
+				.slicePitch = strip.size(),
+				.pixels = strip.data()
+			};
+			DirectX::ScratchImage blocks;
+			const auto flags = quality == Bc3Quality::High ? DirectX::TEX_COMPRESS_UNIFORM : DirectX::TEX_COMPRESS_DEFAULT;
+			THROW_IF_FAILED(DirectX::Compress(stripImage, DXGI_FORMAT_BC3_UNORM, flags, DirectX::TEX_THRESHOLD_DEFAULT, blocks));
+
+			const auto src = blocks.GetImage(0, 0, 0);
+			for (size_t i = 0; i < misses.size(); ++i)
+			{
+				std::copy_n(src->pixels + i / StripBlocks * src->rowPitch + i % StripBlocks * BlockSize, BlockSize, encoded[i].data());
+				if (quality == Bc3Quality::High)
+				{
+					uint8_t alpha[16];
+					for (size_t j = 0; j < 16; ++j)
+						alpha[j] = misses[i].key.bgra[j * 4 + 3];
+					RefineAlpha(alpha, encoded[i].data());
+				}
+			}
+		}
+
+		for (size_t i = 0; i < misses.size(); ++i)
+		{
+			memo->Insert(misses[i].key, encoded[i].data());
+			for (const auto block : misses[i].blocks)
+				std::copy_n(encoded[i].data(), BlockSize, block);
+		}
+		memo->Count(lookups, hits);
+		return;
+	}
+
+	if (quality != Bc3Quality::Fast)
+	{
+		// A view of the region, rows keep the pitch of the whole image
+		const DirectX::Image region = {
+			.width = right - left,
+			.height = bottom - top,
+			.format = img.format,
+			.rowPitch = img.rowPitch,
+			.slicePitch = img.rowPitch * (bottom - top),
+			.pixels = img.pixels + top * img.rowPitch + left * 4
+		};
+		DirectX::ScratchImage blocks;
+		const auto flags = quality == Bc3Quality::High ? DirectX::TEX_COMPRESS_UNIFORM : DirectX::TEX_COMPRESS_DEFAULT;
+		THROW_IF_FAILED(DirectX::Compress(region, DXGI_FORMAT_BC3_UNORM, flags, DirectX::TEX_THRESHOLD_DEFAULT, blocks));
+
+		const auto src = blocks.GetImage(0, 0, 0);
+		for (size_t y = 0; y < (region.height + 3) / 4; ++y)
+			std::copy_n(src->pixels + y * src->rowPitch, (region.width + 3) / 4 * BlockSize, blockAt(left, top + y * 4));
+		if (quality == Bc3Quality::Default)
+			return;
+	}
+
+	alignas(16) uint8_t bgra[64];
+	uint8_t alpha[16];
+	for (size_t y = top; y < bottom; y += 4)
+	{
+		for (size_t x = left; x < right; x += 4)
+		{
+			LoadBlock(img, x, y, bgra);
+			for (size_t i = 0; i < 16; ++i)
+				alpha[i] = bgra[i * 4 + 3];
+
+			const auto block = blockAt(x, y);
+			if (quality == Bc3Quality::Fast)
+			{
+				EncodeAlphaFast(alpha, block);
+				EncodeColorFast(bgra, block + 8);
+			}
+			else
+			{
+				RefineAlpha(alpha, block);
+			}
+		}
+	}
+}
+
+// Per channel differences between a decoded image and its source
+struct BcError
+{
+	uint64_t squaredSum = 0;
+	uint64_t samples = 0;
+	uint32_t maxError = 0;
+
+	double Mse() const { return samples != 0 ? static_cast<double>(squaredSum) / static_cast<double>(samples) : 0.0; }
+
+	// Infinite when the two are identical
+	double Psnr() const { return squaredSum == 0 ? std::numeric_limits<double>::infinity() : 10.0 * std::log10(255.0 * 255.0 / Mse()); }
+
+	void Add(const BcError& other)
+	{
+		squaredSum += other.squaredSum;
+		samples += other.samples;
+		maxError = std::max(maxError, other.maxError);
+	}
+};
+
+struct AtlasError
+{
+	BcError atlas;
+	uint32_t xCells = 0;
+	uint32_t yCells = 0;
+	std::vector<BcError> cells; // Row major, so cell i holds the i-th character
+
+	// The n cells with the largest squared error, worst first
+	std::vector<size_t> Worst(size_t n) const
+	{
+		std::vector<size_t> order(cells.size());
+		std::iota(order.begin(), order.end(), size_t(0));
+		n = std::min(n, order.size());
+		std::partial_sort(order.begin(), order.begin() + n, order.end(), [&](size_t l, size_t r) { return cells[l].squaredSum > cells[r].squaredSum; });
+		order.resize(n);
+		return order;
+	}
+};
+
+inline uint32_t HorizontalSum32(__m128i v)
+{
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+	return static_cast<uint32_t>(_mm_cvtsi128_si32(v));
+}
+
+inline uint32_t HorizontalMaxU8(__m128i v)
+{
+	v = _mm_max_epu8(v, _mm_srli_si128(v, 8));
+	v = _mm_max_epu8(v, _mm_srli_si128(v, 4));
+	v = _mm_max_epu8(v, _mm_srli_si128(v, 2));
+	v = _mm_max_epu8(v, _mm_srli_si128(v, 1));
+	return static_cast<uint32_t>(_mm_cvtsi128_si32(v)) & 0xFF;
+}
+
+// Compares bc3 with source, a BGRA atlas of cellWidth x cellHeight cells, over all four
+// channels. Each row of cells is decoded and compared 4 pixels at a time on its own thread;
+// pixels outside every cell count for the whole atlas only.
+AtlasError MeasureBc3Error(const DirectX::Image& source, const DirectX::ScratchImage& bc3, uint32_t cellWidth = CharWidth, uint32_t cellHeight = CharHeight)
+{
+	TRACE_SCOPE("bc3 error");
+	const auto encoded = bc3.GetImage(0, 0, 0);
+	THROW_HR_IF(E_INVALIDARG, source.format != DXGI_FORMAT_B8G8R8A8_UNORM || encoded->format != DXGI_FORMAT_BC3_UNORM);
+	THROW_HR_IF(E_INVALIDARG, source.width != encoded->width || source.height != encoded->height);
+	THROW_HR_IF(E_INVALIDARG, cellWidth == 0 || cellHeight == 0 || cellWidth % 4 != 0 || source.width % 4 != 0);
+
+	const size_t width = source.width, height = source.height;
+	AtlasError error;
+	error.xCells = static_cast<uint32_t>(width / cellWidth);
+	error.yCells = static_cast<uint32_t>(height / cellHeight);
+	error.cells.resize(static_cast<size_t>(error.xCells) * error.yCells);
+
+	const size_t tasks = error.yCells + (error.yCells * cellHeight < height ? 1 : 0);
+	std::vector<BcError> outside(tasks);
+	ParallelFor(tasks, [&](size_t row, size_t) {
+		const size_t y0 = row * cellHeight, y1 = row < error.yCells ? y0 + cellHeight : height;
+		const size_t firstBlockRow = y0 / 4, decodedRows = std::min((y1 + 3) / 4 * 4, height) - firstBlockRow * 4;
+		std::vector<uint8_t> decoded(width * 4 * decodedRows);
+		DecodeBc(DXGI_FORMAT_BC3_UNORM, encoded->pixels + firstBlockRow * encoded->rowPitch, static_cast<uint32_t>(width), static_cast<uint32_t>(decodedRows), decoded.data(), width * 4);
+
+		const __m128i zero = _mm_setzero_si128();
+		for (size_t y = y0; y < y1; ++y)
+		{
+			const auto src = source.pixels + y * source.rowPitch;
+			const auto dec = decoded.data() + (y - firstBlockRow * 4) * width * 4;
+			for (size_t x = 0; x < width; x += cellWidth)
+			{
+				const size_t end = std::min<size_t>(x + cellWidth, width);
+				__m128i sum = zero, max = zero;
+				for (size_t i = x; i < end; i += 4)
+				{
+					const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+					const __m128i b = SwapRedBlue(_mm_loadu_si128(reinterpret_cast<const __m128i*>(dec + i * 4)));
+					const __m128i diff = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+					max = _mm_max_epu8(max, diff);
+					const __m128i lo = _mm_unpacklo_epi8(diff, zero), hi = _mm_unpackhi_epi8(diff, zero);
+					sum = _mm_add_epi32(sum, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+				}
+
+				const size_t column = x / cellWidth;
+				auto& target = row < error.yCells && column < error.xCells ? error.cells[row * error.xCells + column] : outside[row];
+				target.Add({ HorizontalSum32(sum), (end - x) * 4, HorizontalMaxU8(max) });
+			}
+		}
+	});
+
+	for (const auto& cell : error.cells)
+		error.atlas.Add(cell);
+	for (const auto& rest : outside)
+		error.atlas.Add(rest);
+	return error;
+}
+
+// psnr, mse and maxError of the atlas, then the n worst cells with their characters
+void WriteAtlasError(JsonWriter& json, const AtlasError& error, std::u32string_view chars, size_t worst)
+{
+	json.BeginObject();
+	json.Member("psnr", error.atlas.Psnr());
+	json.Member("mse", error.atlas.Mse());
+	json.Member("maxError", error.atlas.maxError);
+	json.Key("worst").BeginArray();
+	for (const auto cell : error.Worst(worst))
+	{
+		json.BeginObject();
+		json.Member("cell", cell);
+		if (cell < chars.size())
+			json.Member("char", static_cast<uint32_t>(chars[cell]));
+		json.Member("psnr", error.cells[cell].Psnr());
+		json.Member("maxError", error.cells[cell].maxError);
+		json.EndObject();
+	}
+	json.EndArray();
+	json.EndObject();
+}
@@ -0,0 +1,348 @@
+#pragma once
+
+// Benchmarks of each generation stage on synthetic fixtures. Fixtures are generated from
+// fixed seeds, so every run and every machine measures the same inputs.
+
+// fonts.wtd stand-ins: textureCount DXT5 textures of textureSize x textureSize
+struct WtdFixture
+{
+	const wchar_t* name;
+	uint32_t textureCount;
+	uint32_t textureSize;
+};
+constexpr WtdFixture WtdFixtures[] = {
+	{ L"small", 2, 512 },
+	{ L"medium", 6, 1024 },
+	{ L"large", 12, 2048 }
+};
+
+struct CharTableFixture
+{
+	const wchar_t* name;
+	uint32_t count;
+};
+constexpr CharTableFixture CharTableFixtures[] = {
+	{ L"small", 1000 },
+	{ L"full", TextureXChars * TextureYChars }
+};
+
+// A dictionary with the layout of the game's fonts.wtd. About a third of the
+// blocks hold noise and the rest are empty, roughly like a font texture.
+void WriteSyntheticWTD(const fs::path& path, const WtdFixture& fixture, uint32_t seed)
+{
+	using namespace RageUtil;
+
+	RageUtil::s_ptrTable.clear();
+	auto resetPtrTable = wil::scope_exit([] { RageUtil::s_ptrTable.clear(); });
+
+	std::mt19937 rng(seed);
+	const size_t pixelSize = static_cast<size_t>(fixture.textureSize) * fixture.textureSize; // DXT5 is a byte per pixel
+
+	BlockMap blockMap;
+	memset(&blockMap, RSC5::PadByte, sizeof(blockMap));
+	blockMap.virtualCount = 0;
+	blockMap.physicalCount = 0;
+
+	std::vector<std::string> names;
+	std::vector<std::unique_ptr<uint8_t[]>> pixels;
+	std::vector<grcTexturePC> textures(fixture.textureCount);
+	std::vector<std::pair<uint32_t, size_t>> order; // Dictionaries are sorted by hash
+	for (uint32_t i = 0; i < fixture.textureCount; ++i)
+	{
+		names.emplace_back(std::format("pack:/font{}.dds", i + 1));
+		order.emplace_back(HashString(std::format("font{}", i + 1).c_str()), i);
+
+		auto& data = pixels.emplace_back(std::make_unique<uint8_t[]>(pixelSize));
+		for (size_t block = 0; block < pixelSize / 16; ++block)
+		{
+			if (rng() % 3 == 0)
+				std::generate_n(data.get() + block * 16, 16, [&] { return static_cast<uint8_t>(rng()); });
+		}
+	}
+	std::sort(order.begin(), order.end());
+
+	for (uint32_t i = 0; i < fixture.textureCount; ++i)
+	{
+		auto& texture = textures[i];
+		texture = {};
+		texture.depth = 1;
+		texture.usageCount = 1;
+		texture.name.Set(names[i].c_str());
+		texture.width = static_cast<uint16_t>(fixture.textureSize);
+		texture.height = static_cast<uint16_t>(fixture.textureSize);
+		texture.pixelFormat = D3DFMT_DXT5;
+		texture.stride = static_cast<uint16_t>(fixture.textureSize);
+		texture.levels = 1;
+		std::fill_n(texture.unk28, 3, 1.0f);
+		texture.pixelData.Set(pixels[i].get());
+	}
+
+	std::vector<uint32_t> hashes;
+	std::vector<pgPtrT<grcTexturePC>> values(fixture.textureCount);
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		hashes.push_back(order[i].first);
+		values[i] = {};
+		values[i].Set(&textures[order[i].second]);
+	}
+
+	pgDictionary<grcTexturePC> dict = {};
+	dict.blockMap.Set(&blockMap);
+	dict.usageCount = 1;
+	dict.hashes.data.Set(hashes.data());
+	dict.hashes.size = dict.hashes.capacity = static_cast<uint16_t>(hashes.size());
+	dict.values.data.Set(values.data());
+	dict.values.size = dict.values.capacity = static_cast<uint16_t>(values.size());
+
+	RSC5::BlockList blockList;
+	blockList.AppendVirtual(&dict, sizeof(dict), nullptr);
+	dict.DumpToMemory(blockList);
+
+	wil::unique_hfile hFile(CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+	THROW_LAST_ERROR_IF(!hFile);
+	RSC5::Header header = { RSC5::Header::MagicValue, RSC5::ResourceType::Texture, {} };
+	RSC5::DumpToFile(hFile.get(), header, blockList);
+}
+
+// Shuffled CJK ideographs, with some of the punctuation drawn with the symbol font
+void WriteSyntheticCharTable(const fs::path& path, const CharTableFixture& fixture, uint32_t seed)
+{
+	std::u32string chars = U"，。、“”‘’！？：；（）《》…—";
+	std::u32string ideographs;
+	for (char32_t ch = U'\u4E00'; ch <= U'\u9FFF'; ++ch)
+		ideographs.push_back(ch);
+	std::shuffle(ideographs.begin(), ideographs.end(), std::mt19937(seed));
+	chars.append(ideographs, 0, fixture.count - std::min<size_t>(fixture.count, chars.size()));
+	chars.resize(fixture.count);
+
+	std::vector<CharFrequency> frequencies;
+	for (auto ch : chars)
+		frequencies.push_back({ ch, 1 });
+	WriteCharTable(path, frequencies);
+}
+
+// Excludes setup from the measurement when Restart is called after it
+class BenchTimer
+{
+public:
+	BenchTimer() { Restart(); }
+
+	void Restart()
+	{
+		m_allocations = g_allocations.count.load(std::memory_order_relaxed);
+		m_allocatedBytes = g_allocations.bytes.load(std::memory_order_relaxed);
+		m_start = std::chrono::steady_clock::now();
+	}
+
+	double ElapsedMs() const { return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count(); }
+	uint64_t Allocations() const { return g_allocations.count.load(std::memory_order_relaxed) - m_allocations; }
+	uint64_t AllocatedBytes() const { return g_allocations.bytes.load(std::memory_order_relaxed) - m_allocatedBytes; }
+
+private:
+	std::chrono::steady_clock::time_point m_start;
+	uint64_t m_allocations;
+	uint64_t m_allocatedBytes;
+};
+
+struct BenchResult
+{
+	std::wstring name;
+	uint64_t bytes = 0; // Processed per iteration
+	uint64_t items = 0; // Characters or textures per iteration, 0 if not meaningful
+	std::vector<double> ms; // Sorted
+	uint64_t allocations = 0; // Per iteration
+	uint64_t allocatedBytes = 0;
+
+	double Percentile(double p) const
+	{
+		// Nearest rank
+		const size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * ms.size()));
+		return ms[std::clamp<size_t>(rank, 1, ms.size()) - 1];
+	}
+
+	double Mean() const { return std::accumulate(ms.begin(), ms.end(), 0.0) / ms.size(); }
+};
+
+class BenchRunner
+{
+public:
+	BenchRunner(uint32_t iterations, std::wstring_view filter) : m_iterations(iterations), m_filter(filter) {}
+
+	// fn(BenchTimer&) is run once to warm up, then iterations times
+	template<typename F>
+	void Run(const std::wstring& name, uint64_t bytes, uint64_t items, F&& fn)
+	{
+		if (!m_filter.empty() && name.find(m_filter) == std::wstring::npos)
+			return;
+
+		BenchResult result = { .name = name, .bytes = bytes, .items = items };
+		{
+			BenchTimer timer;
+			fn(timer);
+		}
+		for (uint32_t i = 0; i < m_iterations; ++i)
+		{
+			BenchTimer timer;
+			fn(timer);
+			result.ms.push_back(timer.ElapsedMs());
+			result.allocations += timer.Allocations();
+			result.allocatedBytes += timer.AllocatedBytes();
+		}
+		result.allocations /= m_iterations;
+		result.allocatedBytes /= m_iterations;
+		std::sort(result.ms.begin(), result.ms.end());
+
+		Print(L"{:<28} {:>10.2f} {:>10.2f} {:>10.2f} {:>10.2f} {:>10.1f} {:>10}\n", result.name,
+			result.Percentile(50), result.Percentile(90), result.Percentile(99), result.ms.back(),
+			bytes / 1048576.0 / (result.Mean() / 1000.0), result.allocations);
+		m_results.emplace_back(std::move(result));
+	}
+
+	const std::vector<BenchResult>& Results() const { return m_results; }
+
+private:
+	uint32_t m_iterations;
+	std::wstring m_filter;
+	std::vector<BenchResult> m_results;
+};
+
+// bench [--iterations=N] [--filter=<name part>] [--font=<face>] [--dir=<fixture dir>] [--json=<results.json>|-]
+int CliBench(const CliArgs& args)
+{
+	const auto iterations = static_cast<uint32_t>(std::stoul(std::wstring(args.Get(L"iterations", L"5"))));
+	THROW_HR_IF(E_INVALIDARG, iterations == 0);
+	AllocationCounting counting; // BenchTimer reports allocations
+
+	wchar_t tempPath[MAX_PATH + 1];
+	THROW_LAST_ERROR_IF(GetTempPathW(static_cast<DWORD>(std::size(tempPath)), tempPath) == 0);
+	const fs::path dir = args.Get(L"dir") ? fs::path(*args.Get(L"dir")) : fs::path(tempPath) / L"CWTDGen-bench";
+	fs::create_directories(dir);
+
+	// A system font keeps binary fonts out of the repository, every Windows install has Microsoft YaHei
+	const auto face = std::wstring(args.Get(L"font", L"Microsoft YaHei"));
+	GenerateOptions options = { .fonts = { MakeLogFont(face, FW_BOLD), MakeLogFont(face, FW_BOLD) } };
+
+	Print(L"Writing fixtures to {}\n", dir.wstring());
+	uint32_t seed = 1;
+	for (const auto& fixture : WtdFixtures)
+		WriteSyntheticWTD(dir / std::format(L"{}.wtd", fixture.name), fixture, seed++);
+	for (const auto& fixture : CharTableFixtures)
+		WriteSyntheticCharTable(dir / std::format(L"{}.dat", fixture.name), fixture, seed++);
+
+	const auto fullTablePath = dir / std::format(L"{}.dat", CharTableFixtures[std::size(CharTableFixtures) - 1].name);
+	const auto fullCells = LoadCharTable(fullTablePath).Cells();
+	DirectX::ScratchImage blank;
+	THROW_IF_FAILED(blank.Initialize2D(DXGI_FORMAT_BC3_UNORM, TextureWidth, TextureHeight, 1, 1));
+	std::fill_n(blank.GetPixels(), blank.GetPixelsSize(), uint8_t(0));
+	constexpr uint64_t AtlasBytes = static_cast<uint64_t>(TextureWidth) * TextureHeight * 4;
+
+	BenchRunner bench(iterations, args.Get(L"filter", L""));
+	Print(L"{:<28} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10}\n", L"stage", L"p50 ms", L"p90 ms", L"p99 ms", L"max ms", L"MiB/s", L"allocs");
+
+	for (const auto& fixture : CharTableFixtures)
+	{
+		const auto path = dir / std::format(L"{}.dat", fixture.name);
+		bench.Run(std::format(L"chartable.load/{}", fixture.name), fs::file_size(path), fixture.count, [&](BenchTimer&) {
+			auto text = LoadCharTable(path).ToUtf16();
+		});
+	}
+
+	for (const auto& fixture : WtdFixtures)
+	{
+		const auto path = dir / std::format(L"{}.wtd", fixture.name);
+		const auto source = ReadWTD(path);
+		const auto out = dir / std::format(L"{}.out.wtd", fixture.name);
+
+		bench.Run(std::format(L"rsc5.inflate/{}", fixture.name), source.size, fixture.textureCount, [&](BenchTimer&) {
+			ReadWTD(path);
+		});
+		bench.Run(std::format(L"rsc5.layout/{}", fixture.name), source.size, fixture.textureCount + 1, [&](BenchTimer& timer) {
+			WtdPatch patch(source, blank);
+			timer.Restart();
+			RageUtil::RSC5::SortAndCalculateFlags(patch.blockList);
+		});
+		bench.Run(std::format(L"rsc5.deflate/{}", fixture.name), source.size + blank.GetPixelsSize(), fixture.textureCount + 1, [&](BenchTimer& timer) {
+			WtdPatch patch(source, blank);
+			timer.Restart();
+			patch.Write(out);
+		});
+	}
+
+	for (const bool useGDIP : { false, true })
+	{
+		auto backendOptions = options;
+		backendOptions.useGDIP = useGDIP;
+		for (const auto& fixture : CharTableFixtures)
+		{
+			const auto cells = LoadCharTable(dir / std::format(L"{}.dat", fixture.name)).Cells();
+			bench.Run(std::format(L"render.{}/{}", useGDIP ? L"gdip" : L"dwrite", fixture.name), AtlasBytes, cells.size(), [&](BenchTimer&) {
+				RenderCharsBitmap(backendOptions, cells);
+			});
+		}
+	}
+
+	{
+		const auto bitmap = RenderCharsBitmap(options, fullCells);
+		for (const auto quality : { Bc3Quality::Fast, Bc3Quality::Default, Bc3Quality::High })
+		{
+			bench.Run(std::format(L"bc3.compress/{}", Bc3QualityName(quality)), AtlasBytes, 1, [&](BenchTimer&) {
+				CompressCharsImage(bitmap.Image(), quality);
+			});
+		}
+		const auto dxt5Img = CompressCharsImage(bitmap.Image());
+		bench.Run(L"bc3.error", AtlasBytes, 1, [&](BenchTimer&) {
+			MeasureBc3Error(bitmap.Image(), dxt5Img);
+		});
+
+		// Changes the bitmap, so it runs last
+		const GlyphEffects effects = { .outline = 2, .shadowX = 2, .shadowY = 2, .shadowBlur = 2, .shadowOpacity = 153, .gamma = 1.2f };
+		bench.Run(L"effects/outline+shadow", AtlasBytes, 1, [&](BenchTimer&) {
+			ApplyGlyphEffects(bitmap.Image(), effects);
+		});
+	}
+
+	for (const auto& fixture : WtdFixtures)
+	{
+		const auto path = dir / std::format(L"{}.wtd", fixture.name);
+		const auto out = dir / std::format(L"{}.out.wtd", fixture.name);
+		bench.Run(std::format(L"e2e/{}", fixture.name), AtlasBytes, fullCells.size(), [&](BenchTimer&) {
+			auto charTable = LoadCharTable(fullTablePath);
+			auto dxt5Img = GenerateCharsImage(options, charTable.Cells());
+			CreateWTD(path, out, dxt5Img);
+		});
+	}
+
+	JsonWriter json;
+	json.BeginObject();
+	json.Member("iterations", iterations);
+	json.Member("font", face);
+	json.Key("results").BeginArray();
+	for (const auto& result : bench.Results())
+	{
+		const double seconds = result.Mean() / 1000.0;
+		json.BeginObject();
+		json.Member("name", result.name);
+		json.Member("meanMs", result.Mean());
+		json.Member("minMs", result.ms.front());
+		json.Member("p50Ms", result.Percentile(50));
+		json.Member("p90Ms", result.Percentile(90));
+		json.Member("p99Ms", result.Percentile(99));
+		json.Member("maxMs", result.ms.back());
+		json.Member("bytes", result.bytes);
+		json.Member("bytesPerSecond", result.bytes / seconds);
+		if (result.items != 0)
+		{
+			json.Member("items", result.items);
+			json.Member("itemsPerSecond", result.items / seconds);
+		}
+		json.Member("allocations", result.allocations);
+		json.Member("allocatedBytes", result.allocatedBytes);
+		json.EndObject();
+	}
+	json.EndArray();
+	json.EndObject();
+
+	if (auto jsonPath = args.Get(L"json"))
+		WriteJsonOutput(*jsonPath, json);
+	return ExitSuccess;
+}
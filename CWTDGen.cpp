@@ -3,6 +3,102 @@
 
 INT_PTR CALLBACK DialogProc(HWND, UINT, WPARAM, LPARAM);
 
+struct CliCommand
+{
+	std::wstring_view name;
+	int (*run)(const CliArgs&);
+	std::wstring_view usage;
+};
+
+constexpr CliCommand CliCommands[] = {
+	{ L"chars", CliChars, L"chars <text dir> [--out=char_table.dat] [--table=<current char_table.dat>] [--ext=.txt,...] [--include-ascii]" },
+	{ L"batch", CliBatch, L"batch <job file> [--json=<results.json>|-] [--threads=N] [--memory=MiB]" },
+	{ L"serve", CliServe, L"serve --root=<dir> [--port=N] [--threads=N]" },
+	{ L"watch", CliWatch, L"watch <job file> [--job=<variant>] [--debounce=ms]" },
+	{ L"bench", CliBench, L"bench [--iterations=N] [--filter=<name part>] [--font=<face>] [--dir=<fixture dir>] [--json=<results.json>|-]" },
+	{ L"regress", CliRegress, L"regress [--goldens=<goldens.ini>] [--baseline=<baseline.ini>] [--compare=bytes|pixels] [--threshold=%] [--size-threshold=%] [--repeat=N] [--font=<face>] [--dir=<work dir>] [--update-goldens] [--update-baseline] [--json=<results.json>|-]" },
+	{ L"extract", CliExtract, L"extract <fonts.wtd or dir>... [--out=<dir>] [--format=png|dds] [--json=<results.json>|-]" },
+	{ L"index", CliIndex, L"index <install dir> [--index=<file>] [--find=<texture name>] [--hash=<hex hash>] [--full] [--json=<results.json>|-]" },
+	{ L"img-patch", CliImgPatch, L"img-patch <archive.img> --font=<face> --charTable=<char_table.dat> [--entry=fonts.wtd] [--symbolFont=<face>] [--fallbackFonts=<face,...>] [--weight=700] [--backend=dwrite|gdip] [--quote=cn|en] [--in-place]" },
+	{ L"verify", CliVerify, L"verify <install dir>... [--manifest=<manifest.ini>] [--json=<results.json>|-]" },
+	{ L"quality", CliQuality, L"quality --font=<face> --charTable=<char_table.dat> [--tiers=fast,default,high] [--worst=N] [--symbolFont=<face>] [--fallbackFonts=<face,...>] [--weight=700] [--backend=dwrite|gdip] [--quote=cn|en] [--json=<results.json>|-]" },
+	{ L"deploy", CliDeploy, L"deploy <output dir> <install dir>... [--store=<dir>] [--mode=auto|clone|link|copy] [--json=<results.json>|-]" },
+	{ L"sweep", CliSweep, L"sweep --font=<face,...> [--size=52:64:2] [--weight=400,700] [--backend=dwrite,gdip] [--chars=<text>|--charTable=<char_table.dat>] [--sample=N] [--columns=16] [--scale=0.5] [--perSheet=48] [--out=<dir>] [--symbolFont=<face>] [--fallbackFonts=<face,...>] [--quote=cn|en] [--json=<results.json>|-]" },
+	{ L"preview", CliPreview, L"preview --font=<face> --text=<text> [--out=preview.png] [--width=800] [--height=600] [--zoom=0] [--top=0] [--symbolFont=<face>] [--fallbackFonts=<face,...>] [--weight=700] [--backend=dwrite|gdip] [--quote=cn|en]" },
+};
+
+void PrintUsage()
+{
+	PrintError(L"Usage: CWTDGen <command> [options]\n");
+	for (const auto& command : CliCommands)
+		PrintError(L"  {}\n", command.usage);
+	PrintError(L"Every command also accepts --trace=<trace.json>\n");
+	PrintError(L"Commands that take --font also accept the em size [--size=58], the font_chs format [--format=dxt5] (a8 and l8 only with --experimentalFormats=true) and glyph effects: [--outline=px] [--outlineColor=RRGGBB] [--shadow=x,y] [--shadowBlur=px] [--shadowColor=RRGGBB] [--shadowOpacity=%] [--gamma=1.0] [--contrast=1.0]\n");
+}
+
+int RunCommandLine(std::span<const PWSTR> args)
+{
+	InitConsole();
+
+	const auto command = std::find_if(std::begin(CliCommands), std::end(CliCommands), [&](const CliCommand& c) {
+		return c.name == args[0];
+	});
+	if (command == std::end(CliCommands))
+	{
+		PrintUsage();
+		return ExitUsage;
+	}
+
+	try
+	{
+		const CliArgs cliArgs(args.subspan(1));
+
+		// --trace=<trace.json> works with every command
+		const auto tracePath = cliArgs.Get(L"trace");
+		if (tracePath)
+		{
+			TraceRecorder::SetThreadName(L"main");
+			TraceRecorder::Instance().Start();
+		}
+		auto writeTrace = wil::scope_exit([&] {
+			if (tracePath)
+			{
+				try
+				{
+					WriteJsonOutput(*tracePath, TraceRecorder::Instance().Stop());
+					PrintError(L"Trace written to {}\n", *tracePath);
+				}
+				CATCH_LOG();
+			}
+		});
+
+		int ret = command->run(cliArgs);
+		if (ret == ExitUsage)
+			PrintError(L"Usage: CWTDGen {}\n", command->usage);
+		return ret;
+	}
+	catch (const wil::ResultException& e)
+	{
+		// The message attached by THROW_*_MSG names the option or file that was wrong
+		const auto hr = e.GetErrorCode();
+		const auto message = e.GetFailureInfo().pszMessage;
+		PrintError(L"{}: {}{} (0x{:08X})\n", command->name, message ? std::format(L"{}: ", message) : std::wstring(), HResultMessage(hr), static_cast<uint32_t>(hr));
+		return ExitFailure;
+	}
+	catch (const std::exception& e)
+	{
+		const std::string_view what(e.what()); // Standard library messages are ASCII, and converting must not throw here
+		PrintError(L"{}: {}\n", command->name, std::wstring(what.begin(), what.end()));
+		return ExitFailure;
+	}
+	catch (...)
+	{
+		const auto hr = wil::ResultFromCaughtException();
+		PrintError(L"{}: {} (0x{:08X})\n", command->name, HResultMessage(hr), static_cast<uint32_t>(hr));
+		return ExitFailure;
+	}
+}
+
 int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
 	_In_opt_ [[maybe_unused]] HINSTANCE hPrevInstance,
 	_In_ [[maybe_unused]] LPWSTR    lpCmdLine,
@@ -13,15 +109,24 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
 	auto guard = wil::CoInitializeEx(COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
 
 	g_exePath = GetModuleFsPath(hInstance).remove_filename();
-	SetCurrentDirectoryW(g_exePath.c_str());
 
-	THROW_IF_FAILED(D2D1CreateFactory(D2D1_FACTORY_TYPE_SINGLE_THREADED, &g_d2dFactory));
+	// Relative paths on the command line are relative to the caller's directory
+	int argc = 0;
+	wil::unique_hlocal_ptr<PWSTR> argv(CommandLineToArgvW(GetCommandLineW(), &argc));
+	const bool commandLineMode = argv && argc > 1;
+	if (!commandLineMode)
+		SetCurrentDirectoryW(g_exePath.c_str());
+
+	THROW_IF_FAILED(D2D1CreateFactory(D2D1_FACTORY_TYPE_MULTI_THREADED, &g_d2dFactory));
 	THROW_IF_FAILED(DWriteCreateFactory(DWRITE_FACTORY_TYPE_SHARED, __uuidof(g_dwriteFactory), g_dwriteFactory.put_unknown()));
 
 	ULONG_PTR token;
 	Gp::GdiplusStartupInput input;
 	THROW_IF_FAILED(HRESULT_FROM_GPSTATUS(Gp::GdiplusStartup(&token, &input, nullptr)));
 
+	if (commandLineMode)
+		return RunCommandLine(std::span<const PWSTR>(argv.get() + 1, static_cast<size_t>(argc) - 1));
+
 	return static_cast<int>(DialogBoxW(g_hInst, MAKEINTRESOURCEW(IDD_DIALOG), nullptr, DialogProc));
 }
 
@@ -103,187 +208,81 @@ bool CheckCharTableDat(HWND hWnd)
 	return true;
 }
 
-void UpdatePreview(HWND hWnd, std::wstring_view text, bool useGDIP, bool replaceChars)
+// Shows the part of preview's grid from top down in hWnd, top is clamped to the grid
+void ShowPreview(HWND hWnd, PreviewRenderer& preview, uint32_t& top)
 {
-	if (text.empty())
-		return;
-
 	RECT rc;
 	THROW_IF_WIN32_BOOL_FALSE(GetClientRect(hWnd, &rc));
+	const auto width = static_cast<uint32_t>(rc.right - rc.left), height = static_cast<uint32_t>(rc.bottom - rc.top);
+	top = std::min(top, preview.Layout().Height() > height ? preview.Layout().Height() - height : 0);
 
-	const uint32_t wndWidth = rc.right - rc.left, wndHeight = rc.bottom - rc.top;
-	uint32_t xMaxChars = wndWidth / CharWidth, yMaxChars = wndHeight / CharHeight;
-	uint32_t xChars = static_cast<uint32_t>(text.size()), yChars = 1;
-	bool requireScale = false;
-
-	do
-	{
-		if (xChars > xMaxChars)
-		{
-			xChars = xMaxChars;
-			yChars = (static_cast<uint32_t>(text.size()) + xMaxChars - 1) / xMaxChars;
-
-			if (requireScale)
-				break;
-
-			if (yChars > yMaxChars)
-			{
-				requireScale = true; // calc again
-				xMaxChars = static_cast<uint32_t>(ceilf(sqrtf(static_cast<float>(text.size()))));
-				xChars = static_cast<uint32_t>(text.size());
-			}
-		}
-	} while (requireScale);
-
-	const uint32_t width = xChars * CharWidth, height = yChars * CharHeight;
-
-	auto hdcWnd = wil::GetDC(hWnd);
-	THROW_HR_IF(E_FAIL, !hdcWnd);
-
-	HBITMAP hFinalBitmap = nullptr;
-	{
-		wil::unique_hdc hdc(CreateCompatibleDC(hdcWnd.get()));
-		THROW_HR_IF(E_FAIL, !hdc);
-		RGBQUAD* bmBits;
-		wil::unique_hbitmap hBitmap(CreateDIB(hdcWnd.get(), width, height, 32, reinterpret_cast<void**>(&bmBits)));
-		THROW_HR_IF(E_FAIL, !hBitmap);
-		auto selectBitmap = wil::SelectObject(hdc.get(), hBitmap.get());
-
-		GDIDrawCheckeredBackground(hdc.get(), static_cast<LONG>(width), static_cast<LONG>(height), xChars, yChars);
-		SetBitmapAlpha(bmBits, width, height, 255);
-
-		if (useGDIP)
-		{
-			GpDrawCharacters(hdc.get(), text, xChars, yChars, replaceChars);
-		}
-		else
-		{
-			DWriteDrawCharacters(hdc.get(), width, height, text, xChars, yChars, replaceChars);
-		}
-
-		if (requireScale)
-		{
-			uint32_t scaledWidth, scaledHeight;
-			if (width > height)
-			{
-				scaledWidth = wndWidth;
-				scaledHeight = height * scaledWidth / width;
-			}
-			else
-			{
-				scaledHeight = wndHeight;
-				scaledWidth = width * scaledHeight / height;
-			}
+	auto hBitmap = preview.RenderView(0, top, width, height);
+	wil::unique_hbitmap hOldBitmap(reinterpret_cast<HBITMAP>(SendMessageW(hWnd, STM_SETIMAGE, IMAGE_BITMAP, reinterpret_cast<LPARAM>(hBitmap.release()))));
+}
 
-			auto hBitmapScale = GDIScaleBitmap(hdcWnd.get(), hdc.get(), width, height, scaledWidth, scaledHeight);
-			hFinalBitmap = hBitmapScale.release();
-		}
-		else
-			hFinalBitmap = hBitmap.release();
-	}
+// Null if there is nothing to preview. The text is fitted to hWnd, the wheel scrolls and zooms it.
+std::unique_ptr<PreviewRenderer> UpdatePreview(HWND hWnd, std::u32string_view text, bool useGDIP, bool replaceChars)
+{
+	const GenerateOptions options = { .fonts = { g_font, g_symbolFont }, .useGDIP = useGDIP, .replaceChars = replaceChars };
+	auto preview = std::make_unique<PreviewRenderer>(options, text);
+	if (preview->Length() == 0)
+		return nullptr;
 
-	wil::unique_hbitmap hOldBitmap(reinterpret_cast<HBITMAP>(SendMessageW(hWnd, STM_SETIMAGE, IMAGE_BITMAP, reinterpret_cast<LPARAM>(hFinalBitmap))));
+	RECT rc;
+	THROW_IF_WIN32_BOOL_FALSE(GetClientRect(hWnd, &rc));
+	preview->SetLayout(LayoutPreview(preview->Length(), static_cast<uint32_t>(rc.right - rc.left), static_cast<uint32_t>(rc.bottom - rc.top)));
+	uint32_t top = 0;
+	ShowPreview(hWnd, *preview, top);
+	return preview;
 }
 
-auto GenerateCharsImage(HWND hWnd, std::wstring_view chars, bool useGDIP, bool replaceChars)
+// Ctrl+wheel zooms the preview, the wheel scrolls it by three rows a notch
+void ScrollPreview(HWND hWnd, PreviewRenderer& preview, uint32_t& top, int wheelDelta, bool zoom)
 {
-	auto hdcWnd = wil::GetDC(hWnd);
-	THROW_HR_IF(E_FAIL, !hdcWnd);
-	wil::unique_hdc hdc(CreateCompatibleDC(hdcWnd.get()));
-	THROW_HR_IF(E_FAIL, !hdc);
-	uint8_t* bmBits;
-	wil::unique_hbitmap hBitmap(CreateDIB(hdcWnd.get(), TextureWidth, TextureHeight, 32, reinterpret_cast<void**>(&bmBits)));
-	THROW_HR_IF(E_FAIL, !hBitmap);
-	auto selectBitmap = wil::SelectObject(hdc.get(), hBitmap.get());
-
-	std::fill_n(bmBits, TextureWidth * TextureHeight * 4, '\0');
-
-	if (useGDIP)
+	RECT rc;
+	THROW_IF_WIN32_BOOL_FALSE(GetClientRect(hWnd, &rc));
+	const auto layout = preview.Layout();
+	if (zoom)
 	{
-		GpDrawCharacters(hdc.get(), chars, TextureXChars, TextureYChars, replaceChars);
+		// Keeps the row at the top of the view in place
+		const uint32_t row = top / layout.cellHeight;
+		const float scale = layout.Scale() * powf(1.25f, static_cast<float>(wheelDelta) / WHEEL_DELTA);
+		preview.SetLayout(LayoutPreview(preview.Length(), static_cast<uint32_t>(rc.right - rc.left), static_cast<uint32_t>(rc.bottom - rc.top), scale));
+		top = static_cast<uint32_t>(static_cast<uint64_t>(row) * layout.xChars / preview.Layout().xChars * preview.Layout().cellHeight);
 	}
 	else
 	{
-		DWriteDrawCharacters(hdc.get(), TextureWidth, TextureHeight, chars, TextureXChars, TextureYChars, replaceChars);
+		const int64_t offset = -static_cast<int64_t>(wheelDelta) * 3 * layout.cellHeight / WHEEL_DELTA;
+		top = static_cast<uint32_t>(std::max<int64_t>(0, top + offset));
 	}
-
-#if 0
-	// image/png {557cf406-1a04-11d3-9a73-0000f81ef32e}
-	static const CLSID pngEncoderClsId = { 0x557cf406, 0x1a04, 0x11d3, { 0x9a, 0x73, 0x00, 0x00, 0xf8, 0x1e, 0xf3, 0x2e } };
-	Gp::Bitmap(TextureWidth, TextureHeight, TextureWidth * 4, PixelFormat32bppPARGB, bmBits).Save(L"font_chs.png", &pngEncoderClsId);
-#endif
-
-	DirectX::ScratchImage dxt5Img;
-
-	DirectX::Image img = {
-		.width = TextureWidth,
-		.height = TextureHeight,
-		.format = DXGI_FORMAT_B8G8R8A8_UNORM,
-		.rowPitch = TextureWidth * 4,
-		.slicePitch = TextureWidth * TextureHeight * 4,
-		.pixels = bmBits
-	};
-	THROW_IF_FAILED(DirectX::Compress(img, DXGI_FORMAT_BC3_UNORM, DirectX::TEX_COMPRESS_PARALLEL, DirectX::TEX_THRESHOLD_DEFAULT, dxt5Img));
-
-	return dxt5Img;
+	ShowPreview(hWnd, preview, top);
 }
 
-void CreateWTD(const fs::path& in, const fs::path& out, const DirectX::ScratchImage& dxt5Img)
-{
-	wil::unique_hfile hFile(CreateFileW(in.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
-	THROW_LAST_ERROR_IF(!hFile);
-
-	auto [header, data] = RageUtil::RSC5::ReadFromFile(hFile.get());
-	RageUtil::s_virtual = { data.get(), header.flags.GetVirtualSize() };
-	RageUtil::s_physical = { data.get() + RageUtil::s_virtual.size(), header.flags.GetPhysicalSize() };
-
-	auto dict = reinterpret_cast<RageUtil::pgDictionary<RageUtil::grcTexturePC>*>(data.get());
-
-	auto hash = RageUtil::HashString("font_chs");
+// Posted by a generation job when it ends
+constexpr UINT WM_GENERATE_DONE = WM_APP + 1;
+constexpr UINT_PTR ProgressTimerId = 1;
 
-	auto texture = *dict->values.data.Get()->Get(); // copy
-	texture.name.Set("pack:/font_chs.dds");
-	texture.width = TextureWidth;
-	texture.height = TextureHeight;
-	texture.pixelFormat = D3DFMT_DXT5;
-	texture.stride = TextureWidth;
-	texture.next = 0;
-	texture.prev = 0;
-	texture.pixelData.Set(dxt5Img.GetPixels());
-
-	std::span<uint32_t> hashes(dict->hashes.data.Get(), dict->hashes.size);
-	auto it = std::find(hashes.begin(), hashes.end(), hash);
-
-	RageUtil::pgDictionary<RageUtil::grcTexturePC>::TContainer containers;
-	if (it != hashes.end())
-	{
-		auto pos = std::distance(hashes.begin(), it);
-		auto ptr = dict->values.data.Get() + pos;
-		ptr->Set(&texture);
-	}
-	else
+const wchar_t* GeneratePhaseText(GeneratePhase phase)
+{
+	switch (phase)
 	{
-		containers = dict->Insert(hash, &texture);
+	case GeneratePhase::Queued: return L"等待中...";
+	case GeneratePhase::Load: return L"读取文件...";
+	case GeneratePhase::Render: return L"渲染字符...";
+	case GeneratePhase::Compress: return L"压缩贴图...";
+	case GeneratePhase::Write: return L"写入文件...";
+	default: return L"";
 	}
-
-	RageUtil::RSC5::BlockList blockList;
-	blockList.AppendVirtual(dict, sizeof(*dict), nullptr);
-	dict->DumpToMemory(blockList);
-
-	hFile.reset();
-	hFile.reset(CreateFileW(out.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
-	THROW_LAST_ERROR_IF(!hFile);
-
-	RageUtil::RSC5::DumpToFile(hFile.get(), header, blockList);
-
-	RageUtil::s_virtual = {};
-	RageUtil::s_physical = {};
-	RageUtil::s_ptrTable.clear();
 }
 
 INT_PTR CALLBACK DialogProc(HWND hDlg, UINT message, WPARAM wParam, [[maybe_unused]] LPARAM lParam)
 {
 	static HWND s_hPreview = nullptr;
+	static std::unique_ptr<PreviewRenderer> s_preview;
+	static uint32_t s_previewTop = 0;
+	static std::unique_ptr<TaskScheduler> s_scheduler;
+	static GeneratorCaches s_caches;
+	static std::shared_ptr<GenerateJob> s_job;
 	switch (message)
 	{
 	case WM_INITDIALOG:
@@ -302,22 +301,62 @@ INT_PTR CALLBACK DialogProc(HWND hDlg, UINT message, WPARAM wParam, [[maybe_unus
 		SetWindowPos(s_hPreview, nullptr, 0, 0, 0, 0, SWP_NOMOVE | SWP_NOSIZE | SWP_NOZORDER | SWP_NOOWNERZORDER | SWP_FRAMECHANGED);
 
 		SetDlgItemTextW(hDlg, IDC_PREVIEW_TEXT, L"测试文本");
+		SendDlgItemMessageW(hDlg, IDC_PROGRESS, PBM_SETRANGE32, 0, 1000);
 
 		return static_cast<INT_PTR>(TRUE);
 	}
+	case WM_TIMER:
+		if (wParam == ProgressTimerId && s_job)
+		{
+			SendDlgItemMessageW(hDlg, IDC_PROGRESS, PBM_SETPOS, static_cast<WPARAM>(s_job->Fraction() * 1000), 0);
+			if (!s_job->IsCancelled())
+				SetDlgItemTextW(hDlg, IDC_STATUS, GeneratePhaseText(s_job->Phase()));
+		}
+		break;
+	case WM_GENERATE_DONE:
+		if (s_job)
+		{
+			auto job = std::move(s_job);
+			job->Wait(); // The callback posts just before the job is marked done
+
+			KillTimer(hDlg, ProgressTimerId);
+			SetDlgItemTextW(hDlg, IDC_GENERATE, L"生成贴图");
+			EnableWindow(GetDlgItem(hDlg, IDC_GENERATE), TRUE);
+
+			const auto hr = job->Result();
+			SendDlgItemMessageW(hDlg, IDC_PROGRESS, PBM_SETPOS, SUCCEEDED(hr) ? 1000 : 0, 0);
+			SetDlgItemTextW(hDlg, IDC_STATUS, hr == HRESULT_FROM_WIN32(ERROR_CANCELLED) ? L"已取消" : L"");
+			if (SUCCEEDED(hr))
+			{
+				TaskDialog(hDlg, nullptr, L"CWTDGen", nullptr, L"生成成功", TDCBF_OK_BUTTON, TD_INFORMATION_ICON, nullptr);
+			}
+			else if (hr != HRESULT_FROM_WIN32(ERROR_CANCELLED))
+			{
+				LOG_HR(hr);
+				TaskDialog(hDlg, nullptr, L"CWTDGen", nullptr, L"生成贴图时出现错误。\n如果已经替换汉化贴图，请尝试还原原版贴图。", TDCBF_OK_BUTTON, TD_ERROR_ICON, nullptr);
+			}
+		}
+		return static_cast<INT_PTR>(TRUE);
 	case WM_COMMAND:
 		switch (auto wmId = LOWORD(wParam))
 		{
 		case IDCANCEL:
+			if (s_job)
+			{
+				s_job->Cancel();
+				s_job->Wait();
+				s_job.reset();
+			}
+			s_scheduler.reset();
 			EndDialog(hDlg, 0);
 			return static_cast<INT_PTR>(TRUE);
 		case IDC_SELECT_FONT:
 		case IDC_SELECT_SYMBOL_FONT:
 		{
-			auto font = ChooseFontDialog(hDlg, -58);
+			auto font = ChooseFontDialog(hDlg, DefaultFontHeight);
 			if (font.has_value())
 			{
-				font->lfHeight = -58;
+				font->lfHeight = DefaultFontHeight;
 				font->lfQuality = DEFAULT_QUALITY;
 				switch (wmId)
 				{
@@ -420,7 +459,8 @@ INT_PTR CALLBACK DialogProc(HWND hDlg, UINT message, WPARAM wParam, [[maybe_unus
 			{
 				try
 				{
-					UpdatePreview(s_hPreview, GetWindowString(GetDlgItem(hDlg, IDC_PREVIEW_TEXT)), IsDlgButtonChecked(hDlg, IDC_GDIP) == BST_CHECKED, IsDlgButtonChecked(hDlg, IDC_QUOTE_EN) == BST_CHECKED);
+					s_preview = UpdatePreview(s_hPreview, Utf16ToUtf32(GetWindowString(GetDlgItem(hDlg, IDC_PREVIEW_TEXT))), IsDlgButtonChecked(hDlg, IDC_GDIP) == BST_CHECKED, IsDlgButtonChecked(hDlg, IDC_QUOTE_EN) == BST_CHECKED);
+					s_previewTop = 0;
 				}
 				catch (...)
 				{
@@ -431,50 +471,50 @@ INT_PTR CALLBACK DialogProc(HWND hDlg, UINT message, WPARAM wParam, [[maybe_unus
 			break;
 		case IDC_GENERATE:
 		{
+			// The button cancels the running job
+			if (s_job)
+			{
+				s_job->Cancel();
+				EnableWindow(GetDlgItem(hDlg, IDC_GENERATE), FALSE);
+				SetDlgItemTextW(hDlg, IDC_STATUS, L"正在取消...");
+				break;
+			}
+
 			if (CheckFontSelected(hDlg) && CheckGamePathSelected(hDlg) && CheckCharTableDat(hDlg))
 			{
 				try
 				{
-					bool IV = IsDlgButtonChecked(hDlg, IDC_GAME_IV) == BST_CHECKED;
-					bool TLAD = IsDlgButtonChecked(hDlg, IDC_GAME_TLAD) == BST_CHECKED;
-					bool TBOGT = IsDlgButtonChecked(hDlg, IDC_GAME_TBOGT) == BST_CHECKED;
-
-					if (!(IV || TLAD || TBOGT))
-						break;
-
-					std::wstring chars;
+					BatchJob request = {
+						.name = L"dialog",
+						.options = {
+							.fonts = { g_font, g_symbolFont },
+							.useGDIP = IsDlgButtonChecked(hDlg, IDC_GDIP) == BST_CHECKED,
+							.replaceChars = IsDlgButtonChecked(hDlg, IDC_QUOTE_EN) == BST_CHECKED
+						},
+						.gamePath = g_gamePath,
+						.charTablePath = g_gamePath / CharTableDatPath,
+						.outputRoot = g_gamePath,
+						.manifest = false // The dialog writes into the game directory itself
+					};
+					static_assert(IDC_GAME_TLAD == IDC_GAME_IV + 1 && IDC_GAME_TBOGT == IDC_GAME_IV + 2 && std::size(Games) == 3);
+					for (int i = 0; i < static_cast<int>(std::size(Games)); ++i)
 					{
-						wil::unique_hfile hCharsFile(CreateFileW((g_gamePath / CharTableDatPath).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
-						chars = ReadCharTableDatToUtf16String(hCharsFile.get());
+						if (IsDlgButtonChecked(hDlg, IDC_GAME_IV + i) == BST_CHECKED)
+							request.games.push_back(&Games[i]);
 					}
 
-					bool useGDIP = IsDlgButtonChecked(hDlg, IDC_GDIP) == BST_CHECKED;
-					bool replaceChars = IsDlgButtonChecked(hDlg, IDC_QUOTE_EN) == BST_CHECKED;
-
-					auto dxt5Img = GenerateCharsImage(hDlg, chars, useGDIP, replaceChars);
-
-					if (IV)
-					{
-						auto path = g_gamePath / NewFontsPathIV;
-						fs::create_directories(path.parent_path());
-						CreateWTD(g_gamePath / FontsPathIV, path, dxt5Img);
-					}
-
-					if (TBOGT)
-					{
-						auto path = g_gamePath / NewFontsPathTBoGT;
-						fs::create_directories(path.parent_path());
-						CreateWTD(g_gamePath / FontsPathTBoGT, path, dxt5Img);
-					}
+					if (request.games.empty())
+						break;
 
-					if (TLAD)
-					{
-						auto path = g_gamePath / NewFontsPathTLAD;
-						fs::create_directories(path.parent_path());
-						CreateWTD(g_gamePath / FontsPathTLAD, path, dxt5Img);
-					}
+					if (!s_scheduler)
+						s_scheduler = std::make_unique<TaskScheduler>(std::max(std::thread::hardware_concurrency(), 1u));
+					s_caches.images.Clear(); // Only the inputs are worth keeping between runs
 
-					TaskDialog(hDlg, nullptr, L"CWTDGen", nullptr, L"生成成功", TDCBF_OK_BUTTON, TD_INFORMATION_ICON, nullptr);
+					s_job = StartGenerate(*s_scheduler, s_caches, std::move(request), [hDlg](GenerateJob&) { PostMessageW(hDlg, WM_GENERATE_DONE, 0, 0); });
+					SetDlgItemTextW(hDlg, IDC_GENERATE, L"取消");
+					SetDlgItemTextW(hDlg, IDC_STATUS, GeneratePhaseText(GeneratePhase::Queued));
+					SendDlgItemMessageW(hDlg, IDC_PROGRESS, PBM_SETPOS, 0, 0);
+					SetTimer(hDlg, ProgressTimerId, 100, nullptr);
 				}
 				catch (...)
 				{
@@ -492,6 +532,19 @@ INT_PTR CALLBACK DialogProc(HWND hDlg, UINT message, WPARAM wParam, [[maybe_unus
 			break;
 		}
 		break;
+	case WM_MOUSEWHEEL:
+	{
+		POINT pt = { GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam) };
+		RECT rc;
+		if (!s_preview || !GetWindowRect(s_hPreview, &rc) || !PtInRect(&rc, pt))
+			break;
+		try
+		{
+			ScrollPreview(s_hPreview, *s_preview, s_previewTop, GET_WHEEL_DELTA_WPARAM(wParam), (GET_KEYSTATE_WPARAM(wParam) & MK_CONTROL) != 0);
+		}
+		CATCH_LOG();
+		return static_cast<INT_PTR>(TRUE);
+	}
 	case WM_NOTIFY:
 		switch (reinterpret_cast<LPNMHDR>(lParam)->code)
 		{
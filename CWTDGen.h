@@ -11,13 +11,14 @@ constexpr uint32_t CharWidth = 64;
 constexpr uint32_t CharHeight = 66;
 constexpr uint32_t TextureXChars = TextureWidth / CharWidth;
 constexpr uint32_t TextureYChars = TextureHeight / CharHeight;
-constexpr std::pair<wchar_t, wchar_t> NonSymbolRange[] = {
-	{ L'\u4E00', L'\u9FFF' }, // 中日韩统一表意文字
-	{ L'\uFF10', L'\uFF19' }, // 全角0-9
-	{ L'\uFF41', L'\uFF5A' }  // 全角a-z
+constexpr std::pair<char32_t, char32_t> NonSymbolRange[] = {
+	{ U'\u4E00', U'\u9FFF' }, // 中日韩统一表意文字
+	{ U'\uFF10', U'\uFF19' }, // 全角0-9
+	{ U'\uFF41', U'\uFF5A' }, // 全角a-z
+	{ U'\U00020000', U'\U0003FFFF' } // 中日韩统一表意文字扩展B及以后
 };
-static const std::unordered_set<wchar_t> IgnoreSet = { L'\n', L'\r' };
-static const std::unordered_map<wchar_t, wchar_t> ReplaceMap = { {L'「', L'“'}, {L'」', L'”'}, {L'『', L'‘'}, {L'』', L'’'} };
+static const std::unordered_set<char32_t> IgnoreSet = { U'\n', U'\r' };
+static const std::unordered_map<char32_t, char32_t> ReplaceMap = { {U'「', U'“'}, {U'」', U'”'}, {U'『', U'‘'}, {U'』', U'’'} };
 
 constexpr auto FontsPathIV = LR"(pc\textures\fonts.wtd)";
 constexpr auto FontsPathTBoGT = LR"(TBoGT\pc\textures\fonts.wtd)";
@@ -27,6 +28,20 @@ constexpr auto NewFontsPathTBoGT = FontsPathTBoGT;
 constexpr auto NewFontsPathTLAD = FontsPathTLAD;
 constexpr auto CharTableDatPath = LR"(plugins\GTA4.CHS\char_table.dat)";
 
+struct GameInfo
+{
+	const wchar_t* name;
+	const wchar_t* fontsPath;
+	const wchar_t* newFontsPath;
+};
+constexpr GameInfo Games[] = {
+	{ L"IV", FontsPathIV, NewFontsPathIV },
+	{ L"TLAD", FontsPathTLAD, NewFontsPathTLAD },
+	{ L"TBoGT", FontsPathTBoGT, NewFontsPathTBoGT }
+};
+
+constexpr LONG DefaultFontHeight = -58;
+
 HINSTANCE g_hInst;
 fs::path g_exePath;
 wil::com_ptr<ID2D1Factory> g_d2dFactory;
@@ -36,5 +51,29 @@ LOGFONTW g_symbolFont = {};
 fs::path g_gamePath;
 
 #include "Util.hpp"
+#include "Json.hpp"
+#include "Trace.hpp"
+#include "CharTable.hpp"
+#include "Fonts.hpp"
 #include "Graphics.hpp"
 #include "RageUtil.hpp"
+#include "CharCorpus.hpp"
+#include "Bc.hpp"
+#include "Effects.hpp"
+#include "Generator.hpp"
+#include "Scheduler.hpp"
+#include "Io.hpp"
+#include "Cli.hpp"
+#include "Batch.hpp"
+#include "Preview.hpp"
+#include "Service.hpp"
+#include "Watch.hpp"
+#include "Bench.hpp"
+#include "Regress.hpp"
+#include "Extract.hpp"
+#include "Index.hpp"
+#include "Img.hpp"
+#include "Verify.hpp"
+#include "Quality.hpp"
+#include "Deploy.hpp"
+#include "Sweep.hpp"
@@ -0,0 +1,215 @@
+#pragma once
+
+// The generator core as a DLL, for tools that build fonts without starting CWTDGen.exe. A
+// context holds the options and caches of character tables and encoded atlases, so one context
+// kept for many builds stays warm. Functions return an HRESULT; cwtd_last_error has the message
+// of the calling thread's last failure.
+//
+// The Direct2D and DirectWrite factories, GDI+ and the text format and font coverage caches
+// are process-wide, shared by every context: the first context created starts them and the
+// last one destroyed shuts them down.
+//
+// A context is used by one thread at a time. Sources, bitmaps and atlases don't change once
+// made and may be used from any thread, also after their context is destroyed.
+//
+// The C functions are the ABI. The C++ classes below them only wrap those, inline.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef CWTDGEN_EXPORTS
+#define CWTD_API __declspec(dllexport)
+#else
+#define CWTD_API __declspec(dllimport)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CWTD_API_VERSION 1
+
+typedef int32_t cwtd_result; // HRESULT
+typedef struct cwtd_context cwtd_context;
+typedef struct cwtd_source cwtd_source; // A decoded fonts.wtd
+typedef struct cwtd_bitmap cwtd_bitmap; // A rendered BGRA atlas
+typedef struct cwtd_atlas cwtd_atlas; // An encoded atlas, the font_chs texture
+
+// CWTD_API_VERSION of the DLL, which may be newer than the header
+CWTD_API uint32_t cwtd_api_version(void);
+
+// UTF-8, empty after a call that succeeded. Valid until the thread's next call.
+CWTD_API const char* cwtd_last_error(void);
+
+CWTD_API cwtd_result cwtd_context_create(cwtd_context** context);
+CWTD_API void cwtd_context_destroy(cwtd_context* context);
+
+// The keys of a job file section: font (required), symbolFont, fallbackFonts, weight, size,
+// backend, quote, format, experimentalFormats, quality and the glyph effects, see Batch.hpp.
+// A NULL value removes the key. Values are checked when they are next used.
+CWTD_API cwtd_result cwtd_context_set_option(cwtd_context* context, const wchar_t* key, const wchar_t* value);
+
+CWTD_API cwtd_result cwtd_source_load(cwtd_context* context, const wchar_t* path, cwtd_source** source);
+CWTD_API cwtd_result cwtd_source_load_memory(cwtd_context* context, const void* data, size_t size, cwtd_source** source);
+CWTD_API void cwtd_source_destroy(cwtd_source* source);
+
+// chars are UTF-32 code points in cell order, e.g. a character table's
+CWTD_API cwtd_result cwtd_render(cwtd_context* context, const uint32_t* chars, size_t count, cwtd_bitmap** bitmap);
+CWTD_API cwtd_result cwtd_bitmap_pixels(const cwtd_bitmap* bitmap, const uint8_t** pixels, size_t* rowPitch, uint32_t* width, uint32_t* height);
+CWTD_API void cwtd_bitmap_destroy(cwtd_bitmap* bitmap);
+
+CWTD_API cwtd_result cwtd_encode(cwtd_context* context, const cwtd_bitmap* bitmap, cwtd_atlas** atlas);
+
+// Renders and encodes a char_table.dat, or reuses the atlas the context made for the same
+// options and an unchanged file
+CWTD_API cwtd_result cwtd_generate(cwtd_context* context, const wchar_t* charTablePath, cwtd_atlas** atlas);
+
+// size covers every BC3 block, rowPitch bytes to a row of blocks. With format=a8 or l8 they are
+// a byte per pixel and rowPitch bytes to a row of pixels.
+CWTD_API cwtd_result cwtd_atlas_blocks(const cwtd_atlas* atlas, const uint8_t** blocks, size_t* size, size_t* rowPitch, uint32_t* width, uint32_t* height);
+CWTD_API void cwtd_atlas_destroy(cwtd_atlas* atlas);
+
+// source with font_chs replaced or added. The file is replaced only once it is complete.
+CWTD_API cwtd_result cwtd_write_file(const cwtd_source* source, const cwtd_atlas* atlas, const wchar_t* path);
+
+// As cwtd_write_file, into *data which the caller frees with cwtd_free
+CWTD_API cwtd_result cwtd_write_memory(const cwtd_source* source, const cwtd_atlas* atlas, uint8_t** data, size_t* size);
+CWTD_API void cwtd_free(void* data);
+
+#ifdef __cplusplus
+}
+
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cwtd
+{
+	class Error : public std::runtime_error
+	{
+	public:
+		Error(cwtd_result hr, const char* message) : std::runtime_error(message), m_hr(hr) {}
+
+		cwtd_result Result() const { return m_hr; }
+
+	private:
+		cwtd_result m_hr;
+	};
+
+	inline void Check(cwtd_result hr)
+	{
+		if (hr < 0)
+			throw Error(hr, cwtd_last_error());
+	}
+
+	template<typename T, void (*Destroy)(T*)>
+	struct Deleter
+	{
+		void operator()(T* p) const { Destroy(p); }
+	};
+
+	class Source
+	{
+	public:
+		explicit Source(cwtd_source* source) : m_source(source) {}
+		const cwtd_source* Get() const { return m_source.get(); }
+
+	private:
+		std::unique_ptr<cwtd_source, Deleter<cwtd_source, cwtd_source_destroy>> m_source;
+	};
+
+	class Bitmap
+	{
+	public:
+		explicit Bitmap(cwtd_bitmap* bitmap) : m_bitmap(bitmap) {}
+		const cwtd_bitmap* Get() const { return m_bitmap.get(); }
+
+	private:
+		std::unique_ptr<cwtd_bitmap, Deleter<cwtd_bitmap, cwtd_bitmap_destroy>> m_bitmap;
+	};
+
+	class Atlas
+	{
+	public:
+		explicit Atlas(cwtd_atlas* atlas) : m_atlas(atlas) {}
+		const cwtd_atlas* Get() const { return m_atlas.get(); }
+
+		std::span<const uint8_t> Blocks() const
+		{
+			const uint8_t* blocks;
+			size_t size, rowPitch;
+			uint32_t width, height;
+			Check(cwtd_atlas_blocks(Get(), &blocks, &size, &rowPitch, &width, &height));
+			return { blocks, size };
+		}
+
+		void Write(const Source& source, const wchar_t* path) const { Check(cwtd_write_file(source.Get(), Get(), path)); }
+
+		std::vector<uint8_t> Write(const Source& source) const
+		{
+			uint8_t* data;
+			size_t size;
+			Check(cwtd_write_memory(source.Get(), Get(), &data, &size));
+			std::unique_ptr<uint8_t, Deleter<void, cwtd_free>> owned(data);
+			return { data, data + size };
+		}
+
+	private:
+		std::unique_ptr<cwtd_atlas, Deleter<cwtd_atlas, cwtd_atlas_destroy>> m_atlas;
+	};
+
+	class Context
+	{
+	public:
+		Context()
+		{
+			cwtd_context* context;
+			Check(cwtd_context_create(&context));
+			m_context.reset(context);
+		}
+
+		void SetOption(const wchar_t* key, const wchar_t* value) { Check(cwtd_context_set_option(m_context.get(), key, value)); }
+
+		Source LoadSource(const wchar_t* path)
+		{
+			cwtd_source* source;
+			Check(cwtd_source_load(m_context.get(), path, &source));
+			return Source(source);
+		}
+
+		Source LoadSource(std::span<const uint8_t> data)
+		{
+			cwtd_source* source;
+			Check(cwtd_source_load_memory(m_context.get(), data.data(), data.size(), &source));
+			return Source(source);
+		}
+
+		Bitmap Render(std::u32string_view chars)
+		{
+			cwtd_bitmap* bitmap;
+			Check(cwtd_render(m_context.get(), reinterpret_cast<const uint32_t*>(chars.data()), chars.size(), &bitmap));
+			return Bitmap(bitmap);
+		}
+
+		Atlas Encode(const Bitmap& bitmap)
+		{
+			cwtd_atlas* atlas;
+			Check(cwtd_encode(m_context.get(), bitmap.Get(), &atlas));
+			return Atlas(atlas);
+		}
+
+		Atlas Generate(const wchar_t* charTablePath)
+		{
+			cwtd_atlas* atlas;
+			Check(cwtd_generate(m_context.get(), charTablePath, &atlas));
+			return Atlas(atlas);
+		}
+
+	private:
+		std::unique_ptr<cwtd_context, Deleter<cwtd_context, cwtd_context_destroy>> m_context;
+	};
+}
+#endif
@@ -0,0 +1,15 @@
+﻿#include "pch.h"
+#include "CWTDGen.h"
+#include "CWTDGenApi.h"
+#include "Api.hpp"
+
+BOOL APIENTRY DllMain(HMODULE hModule, DWORD reason, [[maybe_unused]] LPVOID reserved)
+{
+	if (reason == DLL_PROCESS_ATTACH)
+	{
+		g_hInst = hModule;
+		g_exePath = GetModuleFsPath(hModule).remove_filename();
+		DisableThreadLibraryCalls(hModule);
+	}
+	return TRUE;
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+struct CharFrequency
+{
+	char32_t ch;
+	uint64_t count;
+};
+
+// Counts in a flat table for the BMP, supplementary planes are rare enough for a map
+class CharHistogram
+{
+public:
+	CharHistogram() : m_bmp(std::make_unique<uint64_t[]>(0x10000)) {}
+
+	void Add(std::u32string_view text)
+	{
+		for (auto ch : text)
+		{
+			if (ch < 0x10000)
+				++m_bmp[ch];
+			else
+				++m_supplementary[ch];
+		}
+	}
+
+	void Merge(const CharHistogram& other)
+	{
+		for (size_t i = 0; i < 0x10000; ++i)
+			m_bmp[i] += other.m_bmp[i];
+		for (const auto& [ch, count] : other.m_supplementary)
+			m_supplementary[ch] += count;
+	}
+
+	// Most frequent first, ties broken by code point so the result is stable
+	std::vector<CharFrequency> Sorted(bool includeAscii) const
+	{
+		std::vector<CharFrequency> result;
+		for (char32_t ch = includeAscii ? 0 : 0x80; ch < 0x10000; ++ch)
+		{
+			if (m_bmp[ch] != 0 && !IgnoreSet.contains(ch))
+				result.emplace_back(ch, m_bmp[ch]);
+		}
+		for (const auto& [ch, count] : m_supplementary)
+			result.emplace_back(ch, count);
+
+		std::sort(result.begin(), result.end(), [](const CharFrequency& l, const CharFrequency& r) {
+			return l.count != r.count ? l.count > r.count : l.ch < r.ch;
+		});
+		return result;
+	}
+
+private:
+	std::unique_ptr<uint64_t[]> m_bmp;
+	std::unordered_map<char32_t, uint64_t> m_supplementary;
+};
+
+struct CorpusScanResult
+{
+	CharHistogram histogram;
+	uint64_t fileCount = 0;
+	uint64_t byteCount = 0;
+	std::vector<std::pair<fs::path, HRESULT>> errors;
+};
+
+bool HasExtension(const fs::path& path, std::span<const std::wstring> extensions)
+{
+	if (extensions.empty())
+		return true;
+	const auto ext = path.extension().wstring();
+	return std::any_of(extensions.begin(), extensions.end(), [&](const std::wstring& e) {
+		return CompareStringOrdinal(ext.c_str(), static_cast<int>(ext.size()), e.c_str(), static_cast<int>(e.size()), TRUE) == CSTR_EQUAL;
+	});
+}
+
+CorpusScanResult ScanCorpus(const fs::path& root, std::span<const std::wstring> extensions)
+{
+	std::vector<fs::path> files;
+	for (const auto& entry : fs::recursive_directory_iterator(root, fs::directory_options::skip_permission_denied))
+	{
+		if (entry.is_regular_file() && HasExtension(entry.path(), extensions))
+			files.emplace_back(entry.path());
+	}
+
+	struct WorkerState
+	{
+		CharHistogram histogram;
+		std::u32string buffer;
+		uint64_t fileCount = 0;
+		uint64_t byteCount = 0;
+		std::vector<std::pair<fs::path, HRESULT>> errors;
+	};
+	std::vector<std::unique_ptr<WorkerState>> states(std::max(std::thread::hardware_concurrency(), 1u));
+	for (auto& state : states)
+		state = std::make_unique<WorkerState>();
+
+	ParallelFor(files.size(), [&](size_t i, size_t worker) {
+		auto& state = *states[worker];
+		try
+		{
+			auto mapped = MapFileForRead(files[i]);
+			state.buffer.clear();
+			DecodeTextToUtf32(mapped.Data(), state.buffer);
+			state.histogram.Add(state.buffer);
+			++state.fileCount;
+			state.byteCount += mapped.size;
+		}
+		catch (...)
+		{
+			state.errors.emplace_back(files[i], wil::ResultFromCaughtException());
+		}
+	});
+
+	CorpusScanResult result;
+	for (auto& state : states)
+	{
+		result.histogram.Merge(state->histogram);
+		result.fileCount += state->fileCount;
+		result.byteCount += state->byteCount;
+		std::move(state->errors.begin(), state->errors.end(), std::back_inserter(result.errors));
+	}
+	return result;
+}
+
+void WriteCharTable(const fs::path& path, std::span<const CharFrequency> chars)
+{
+	std::vector<uint32_t> data;
+	data.reserve(chars.size() + 1);
+	data.push_back(static_cast<uint32_t>(chars.size()));
+	for (const auto& c : chars)
+		data.push_back(c.ch);
+
+	wil::unique_hfile hFile(CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+	THROW_LAST_ERROR_IF(!hFile);
+	WriteFileCheckSize(hFile.get(), data.data(), static_cast<DWORD>(data.size() * sizeof(uint32_t)));
+}
+
+struct CharTableDiff
+{
+	std::u32string added;
+	std::u32string removed;
+	uint32_t moved = 0; // Kept, but drawn in a different cell
+};
+
+CharTableDiff DiffCharTables(const CharTable& current, const CharTable& updated)
+{
+	CharTableDiff diff;
+	for (auto ch : updated.Chars())
+	{
+		if (IgnoreSet.contains(ch))
+			continue;
+		const auto cell = current.CellOf(ch);
+		if (cell == CharTable::NoCell)
+			diff.added.push_back(ch);
+		else if (cell != updated.CellOf(ch))
+			++diff.moved;
+	}
+	for (auto ch : current.Chars())
+	{
+		if (!IgnoreSet.contains(ch) && updated.CellOf(ch) == CharTable::NoCell)
+			diff.removed.push_back(ch);
+	}
+	return diff;
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+// char_table.dat is a uint32_t count followed by count UTF-32LE code points.
+// The n-th character that is not in IgnoreSet is drawn into the n-th cell of font_chs.
+class CharTable
+{
+public:
+	static constexpr uint16_t NoCell = UINT16_MAX;
+
+	std::u32string_view Chars() const { return m_chars; }
+	uint32_t CellCount() const { return m_cellCount; }
+	bool HasSupplementary() const { return m_hasSupplementary; }
+
+	// Heap bytes held, roughly: the characters, the BMP index and the supplementary map's nodes
+	uint64_t MemoryBytes() const
+	{
+		return m_chars.size() * sizeof(char32_t) + (m_bmpCells ? 0x10000 * sizeof(uint16_t) : 0)
+			+ m_supplementaryCells.size() * (sizeof(std::pair<const char32_t, uint16_t>) + 2 * sizeof(void*));
+	}
+
+	// Which cell ch is drawn in, NoCell if the table does not contain it
+	uint16_t CellOf(char32_t ch) const
+	{
+		if (ch < 0x10000)
+			return m_bmpCells[ch];
+		auto it = m_supplementaryCells.find(ch);
+		return it != m_supplementaryCells.end() ? it->second : NoCell;
+	}
+
+	std::wstring ToUtf16() const;
+
+	// The characters in cell order, the n-th one is drawn in the n-th cell
+	std::u32string Cells() const
+	{
+		std::u32string cells;
+		cells.reserve(m_cellCount);
+		for (auto ch : m_chars)
+		{
+			if (ch >= 0x20 || !IgnoreSet.contains(ch))
+				cells.push_back(ch);
+		}
+		return cells;
+	}
+
+	friend CharTable ParseCharTable(std::span<const uint8_t> data);
+
+private:
+	std::u32string m_chars;
+	std::unique_ptr<uint16_t[]> m_bmpCells;
+	std::unordered_map<char32_t, uint16_t> m_supplementaryCells;
+	uint32_t m_cellCount = 0;
+	bool m_hasSupplementary = false;
+};
+
+// Checks 4 code points at a time. Throws on values that are not Unicode scalar values,
+// returns whether any code point is outside the BMP.
+bool ValidateUtf32(std::u32string_view text)
+{
+	const __m128i maxScalar = _mm_set1_epi32(0x10FFFF);
+	const __m128i maxBmp = _mm_set1_epi32(0xFFFF);
+	const __m128i surrogateMask = _mm_set1_epi32(static_cast<int>(0xFFFFF800));
+	const __m128i surrogate = _mm_set1_epi32(0xD800);
+
+	__m128i invalid = _mm_setzero_si128();
+	__m128i supplementary = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + 4 <= text.size(); i += 4)
+	{
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + i));
+		// Compares are signed, values >= 0x80000000 are caught by the sign bit instead
+		invalid = _mm_or_si128(invalid, _mm_or_si128(_mm_cmpgt_epi32(v, maxScalar), _mm_srai_epi32(v, 31)));
+		invalid = _mm_or_si128(invalid, _mm_cmpeq_epi32(_mm_and_si128(v, surrogateMask), surrogate));
+		supplementary = _mm_or_si128(supplementary, _mm_cmpgt_epi32(v, maxBmp));
+	}
+
+	bool hasInvalid = _mm_movemask_epi8(invalid) != 0;
+	bool hasSupplementary = _mm_movemask_epi8(supplementary) != 0;
+	for (; i < text.size(); ++i)
+	{
+		const char32_t ch = text[i];
+		hasInvalid |= ch > 0x10FFFF || (ch >= 0xD800 && ch <= 0xDFFF);
+		hasSupplementary |= ch > 0xFFFF;
+	}
+
+	THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_NO_UNICODE_TRANSLATION), hasInvalid);
+	return hasSupplementary;
+}
+
+// All code points must be in the BMP
+void NarrowUtf32(std::u32string_view text, wchar_t* out)
+{
+	size_t i = 0;
+	for (; i + 8 <= text.size(); i += 8)
+	{
+		__m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + i));
+		__m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + i + 4));
+		// SSE2 has no unsigned 32 to 16 bit pack, sign extend the low halves so packs doesn't saturate
+		lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+		hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packs_epi32(lo, hi));
+	}
+	for (; i < text.size(); ++i)
+		out[i] = static_cast<wchar_t>(text[i]);
+}
+
+std::wstring CharTable::ToUtf16() const
+{
+	std::wstring result;
+	if (!m_hasSupplementary)
+	{
+		result.resize(m_chars.size());
+		NarrowUtf32(m_chars, result.data());
+		return result;
+	}
+
+	result.reserve(m_chars.size() + 16);
+	for (auto ch : m_chars)
+	{
+		wchar_t buf[2];
+		result.append(buf, EncodeUtf16(ch, buf));
+	}
+	return result;
+}
+
+CharTable ParseCharTable(std::span<const uint8_t> data)
+{
+	uint32_t count = 0;
+	THROW_HR_IF(E_INVALIDARG, data.size() < sizeof(count));
+	memcpy(&count, data.data(), sizeof(count));
+	THROW_HR_IF(E_INVALIDARG, sizeof(count) + static_cast<size_t>(count) * sizeof(uint32_t) != data.size());
+	THROW_HR_IF(E_INVALIDARG, count >= CharTable::NoCell);
+
+	CharTable table;
+	table.m_chars.resize(count);
+	memcpy(table.m_chars.data(), data.data() + sizeof(count), static_cast<size_t>(count) * sizeof(uint32_t));
+	table.m_hasSupplementary = ValidateUtf32(table.m_chars);
+
+	table.m_bmpCells = std::make_unique_for_overwrite<uint16_t[]>(0x10000);
+	std::fill_n(table.m_bmpCells.get(), 0x10000, CharTable::NoCell);
+
+	uint16_t cell = 0;
+	for (auto ch : table.m_chars)
+	{
+		if (ch < 0x20 && IgnoreSet.contains(ch))
+			continue;
+
+		// The first occurrence wins for duplicated characters
+		if (ch < 0x10000)
+		{
+			if (table.m_bmpCells[ch] == CharTable::NoCell)
+				table.m_bmpCells[ch] = cell;
+		}
+		else
+			table.m_supplementaryCells.try_emplace(ch, cell);
+		++cell;
+	}
+	table.m_cellCount = cell;
+
+	return table;
+}
+
+CharTable LoadCharTable(const fs::path& path)
+{
+	TRACE_SCOPE("char table load");
+	auto mapped = MapFileForRead(path);
+	return ParseCharTable(mapped.Data());
+}
@@ -0,0 +1,205 @@
+#pragma once
+
+// Command line mode. CWTDGen is a GUI subsystem program, so output goes to the
+// redirected std handles if there are any, otherwise to the parent's console.
+
+void InitConsole()
+{
+	if (!GetStdHandle(STD_OUTPUT_HANDLE) || !GetStdHandle(STD_ERROR_HANDLE))
+		AttachConsole(ATTACH_PARENT_PROCESS);
+}
+
+void ConsoleWrite(DWORD stdHandle, std::wstring_view text)
+{
+	HANDLE hOut = GetStdHandle(stdHandle);
+	if (!hOut || hOut == INVALID_HANDLE_VALUE || text.empty())
+		return;
+
+	DWORD mode, written;
+	if (GetConsoleMode(hOut, &mode))
+		WriteConsoleW(hOut, text.data(), static_cast<DWORD>(text.size()), &written, nullptr);
+	else
+	{
+		auto utf8 = Utf16ToUtf8(text);
+		WriteFile(hOut, utf8.data(), static_cast<DWORD>(utf8.size()), &written, nullptr);
+	}
+}
+
+// "-" writes to stdout
+void WriteJsonOutput(std::wstring_view path, const JsonWriter& json)
+{
+	if (path == L"-")
+	{
+		HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
+		DWORD mode;
+		if (GetConsoleMode(hOut, &mode))
+			ConsoleWrite(STD_OUTPUT_HANDLE, Utf8ToUtf16(json.Str()) + L"\n");
+		else
+		{
+			WriteFileCheckSize(hOut, const_cast<char*>(json.Str().data()), static_cast<DWORD>(json.Str().size()));
+			WriteFileCheckSize(hOut, const_cast<char*>("\n"), 1);
+		}
+		return;
+	}
+
+	wil::unique_hfile hFile(CreateFileW(std::wstring(path).c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+	THROW_LAST_ERROR_IF(!hFile);
+	WriteFileCheckSize(hFile.get(), const_cast<char*>(json.Str().data()), static_cast<DWORD>(json.Str().size()));
+}
+
+template<typename... Args>
+void Print(std::wformat_string<Args...> fmt, Args&&... args)
+{
+	ConsoleWrite(STD_OUTPUT_HANDLE, std::format(fmt, std::forward<Args>(args)...));
+}
+
+template<typename... Args>
+void PrintError(std::wformat_string<Args...> fmt, Args&&... args)
+{
+	ConsoleWrite(STD_ERROR_HANDLE, std::format(fmt, std::forward<Args>(args)...));
+}
+
+std::wstring ToWString(std::u32string_view text)
+{
+	std::wstring result;
+	result.reserve(text.size());
+	for (auto ch : text)
+	{
+		wchar_t buf[2];
+		result.append(buf, EncodeUtf16(ch, buf));
+	}
+	return result;
+}
+
+std::vector<std::wstring> SplitList(std::wstring_view list, wchar_t separator = L',')
+{
+	std::vector<std::wstring> result;
+	while (!list.empty())
+	{
+		auto pos = list.find(separator);
+		auto item = list.substr(0, pos);
+		if (!item.empty())
+			result.emplace_back(item);
+		if (pos == std::wstring_view::npos)
+			break;
+		list.remove_prefix(pos + 1);
+	}
+	return result;
+}
+
+enum CliExitCode : int
+{
+	ExitSuccess = 0,
+	ExitFailure = 1, // The command ran but some work failed
+	ExitUsage = 2
+};
+
+// Options are --name=value, flags are --name, everything else is positional
+struct CliArgs
+{
+	std::vector<std::wstring_view> positional;
+	std::unordered_map<std::wstring_view, std::wstring_view> options;
+	std::unordered_set<std::wstring_view> flags;
+
+	CliArgs(std::span<const PWSTR> args)
+	{
+		for (std::wstring_view arg : args)
+		{
+			if (arg.starts_with(L"--"))
+			{
+				arg.remove_prefix(2);
+				auto pos = arg.find(L'=');
+				if (pos == std::wstring_view::npos)
+					flags.emplace(arg);
+				else
+					options.emplace(arg.substr(0, pos), arg.substr(pos + 1));
+			}
+			else
+				positional.emplace_back(arg);
+		}
+	}
+
+	std::optional<std::wstring_view> Get(std::wstring_view name) const
+	{
+		if (auto it = options.find(name); it != options.end())
+			return it->second;
+		return std::nullopt;
+	}
+
+	std::wstring_view Get(std::wstring_view name, std::wstring_view defaultValue) const
+	{
+		return Get(name).value_or(defaultValue);
+	}
+
+	bool Has(std::wstring_view flag) const { return flags.contains(flag); }
+
+	// A whole number of at least 1, nullopt if the option is absent. Anything else, 0 included,
+	// is E_INVALIDARG rather than a number std::stoul would half read.
+	std::optional<uint64_t> GetCount(std::wstring_view name) const
+	{
+		const auto value = Get(name);
+		if (!value)
+			return std::nullopt;
+		uint64_t count = 0;
+		const bool digits = !value->empty() && std::all_of(value->begin(), value->end(), [](wchar_t ch) { return ch >= L'0' && ch <= L'9'; });
+		if (digits)
+		{
+			for (const auto ch : *value)
+			{
+				if (count > (UINT64_MAX - 9) / 10)
+				{
+					count = 0;
+					break;
+				}
+				count = count * 10 + (ch - L'0');
+			}
+		}
+		THROW_HR_IF_MSG(E_INVALIDARG, count == 0, "--%.*ls must be a whole number of at least 1, not %.*ls",
+			static_cast<int>(name.size()), name.data(), static_cast<int>(value->size()), value->data());
+		return count;
+	}
+};
+
+// chars <text dir> [--out=char_table.dat] [--table=current char_table.dat] [--ext=.txt,...] [--include-ascii]
+int CliChars(const CliArgs& args)
+{
+	if (args.positional.empty())
+		return ExitUsage;
+
+	const fs::path root(args.positional[0]);
+	const auto extensions = SplitList(args.Get(L"ext", L".txt"));
+	const fs::path outPath(args.Get(L"out", L"char_table.dat"));
+
+	auto start = std::chrono::steady_clock::now();
+	auto scan = ScanCorpus(root, extensions);
+	auto chars = scan.histogram.Sorted(args.Has(L"include-ascii"));
+	auto scanTime = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+	for (const auto& [path, hr] : scan.errors)
+		PrintError(L"{}: error 0x{:08X}\n", path.wstring(), static_cast<uint32_t>(hr));
+	Print(L"Scanned {} files ({} KiB) in {} ms, {} distinct characters\n", scan.fileCount, scan.byteCount / 1024, scanTime.count(), chars.size());
+
+	THROW_HR_IF(E_INVALIDARG, chars.size() >= CharTable::NoCell);
+
+	// The current table is loaded before writing, --out may well be the same file
+	const auto tablePath = args.Get(L"table");
+	std::optional<CharTable> current;
+	if (tablePath)
+		current = LoadCharTable(fs::path(*tablePath));
+
+	WriteCharTable(outPath, chars);
+	Print(L"Wrote {}\n", outPath.wstring());
+
+	if (current)
+	{
+		auto updated = LoadCharTable(outPath);
+		auto diff = DiffCharTables(*current, updated);
+		Print(L"Against {}: {} added, {} removed, {} moved\n", fs::path(*tablePath).wstring(), diff.added.size(), diff.removed.size(), diff.moved);
+		if (!diff.added.empty())
+			Print(L"+ {}\n", ToWString(diff.added));
+		if (!diff.removed.empty())
+			Print(L"- {}\n", ToWString(diff.removed));
+	}
+
+	return scan.errors.empty() ? ExitSuccess : ExitFailure;
+}
@@ -0,0 +1,259 @@
+#pragma once
+
+// Rolls a batch output out to many installs. Each distinct file goes once into a content
+// addressed store, named by its SHA-256, and every install gets it from there: as a block
+// clone where the volume can share clusters (ReFS) and as a copy otherwise. Targets that
+// already hash to the content are left alone. --mode=link hard links targets to the store
+// instead; a linked target shares its data with the store and the other installs, so a tool
+// that writes one in place changes all of them. Store entries are hashed again before each
+// use and replaced when they no longer match their name.
+
+enum struct DeployMethod : uint32_t
+{
+	Unchanged,
+	Clone,
+	Link,
+	Copy
+};
+
+constexpr const wchar_t* DeployMethodNames[] = { L"unchanged", L"clone", L"link", L"copy" };
+
+enum struct DeployMode : uint32_t
+{
+	Auto, // Clone, then copy
+	Clone,
+	Link,
+	Copy
+};
+
+std::wstring VolumeOf(const fs::path& path)
+{
+	wchar_t volume[MAX_PATH];
+	THROW_IF_WIN32_BOOL_FALSE(GetVolumePathNameW(path.c_str(), volume, ARRAYSIZE(volume)));
+	return volume;
+}
+
+// The store's copy of file, added under its digest unless an entry there still hashes to it.
+// An entry can change after all if a linked install was written in place, and is then replaced.
+fs::path AddToStore(const fs::path& store, const fs::path& file, const Sha256Digest& digest)
+{
+	auto path = store / ToHex(digest);
+	if (fs::is_regular_file(path) && Sha256(MapFileForRead(path).Data()) == digest)
+		return path;
+
+	fs::create_directories(store);
+	auto temp = path;
+	temp += L".tmp";
+	THROW_IF_WIN32_BOOL_FALSE(CopyFileExW(file.c_str(), temp.c_str(), nullptr, nullptr, nullptr, 0));
+	auto removeTemp = wil::scope_exit([&] { DeleteFileW(temp.c_str()); });
+	THROW_HR_IF_MSG(HRESULT_FROM_WIN32(ERROR_CRC), Sha256(MapFileForRead(temp).Data()) != digest, "%ls changed while it was stored", file.c_str());
+	THROW_IF_WIN32_BOOL_FALSE(MoveFileExW(temp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING));
+	removeTemp.release();
+	return path;
+}
+
+// to as a block clone of from, which must be on the same ReFS volume. Whole clusters are
+// cloned, so to is sized up to them first and cut back after.
+void CloneFile(const fs::path& from, const fs::path& to)
+{
+	wil::unique_hfile src(CreateFileW(from.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+	THROW_LAST_ERROR_IF(!src);
+	LARGE_INTEGER size;
+	THROW_IF_WIN32_BOOL_FALSE(GetFileSizeEx(src.get(), &size));
+
+	DWORD sectorsPerCluster, bytesPerSector, freeClusters, totalClusters;
+	THROW_IF_WIN32_BOOL_FALSE(GetDiskFreeSpaceW(VolumeOf(to.parent_path()).c_str(), &sectorsPerCluster, &bytesPerSector, &freeClusters, &totalClusters));
+	const int64_t clusterSize = static_cast<int64_t>(sectorsPerCluster) * bytesPerSector;
+
+	wil::unique_hfile dst(CreateFileW(to.c_str(), GENERIC_READ | GENERIC_WRITE | DELETE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+	THROW_LAST_ERROR_IF(!dst);
+	auto removeTarget = wil::scope_exit([&] {
+		dst.reset();
+		DeleteFileW(to.c_str());
+	});
+
+	FILE_END_OF_FILE_INFO end = { .EndOfFile = { .QuadPart = (size.QuadPart + clusterSize - 1) / clusterSize * clusterSize } };
+	THROW_IF_WIN32_BOOL_FALSE(SetFileInformationByHandle(dst.get(), FileEndOfFileInfo, &end, sizeof(end)));
+	DUPLICATE_EXTENTS_DATA extents = { .FileHandle = src.get(), .ByteCount = end.EndOfFile };
+	DWORD returned;
+	THROW_IF_WIN32_BOOL_FALSE(DeviceIoControl(dst.get(), FSCTL_DUPLICATE_EXTENTS_TO_FILE, &extents, sizeof(extents), nullptr, 0, &returned, nullptr));
+	end.EndOfFile = size;
+	THROW_IF_WIN32_BOOL_FALSE(SetFileInformationByHandle(dst.get(), FileEndOfFileInfo, &end, sizeof(end)));
+	removeTarget.release();
+}
+
+bool SupportsBlockCloning(const std::wstring& volume)
+{
+	DWORD flags;
+	THROW_IF_WIN32_BOOL_FALSE(GetVolumeInformationW(volume.c_str(), nullptr, 0, nullptr, nullptr, &flags, nullptr, 0));
+	return (flags & FILE_SUPPORTS_BLOCK_REFCOUNTING) != 0;
+}
+
+// True if target already holds the store entry's content. Sharing the entry's file identity
+// isn't enough, a linked target may have been written in place, so it's always hashed.
+bool HasContent(const fs::path& target, const fs::path& stored, const Sha256Digest& digest)
+{
+	wil::unique_hfile storedFile(CreateFileW(stored.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+	THROW_LAST_ERROR_IF(!storedFile);
+	wil::unique_hfile targetFile(CreateFileW(target.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+	if (!targetFile)
+	{
+		const auto error = GetLastError();
+		THROW_WIN32_IF(error, error != ERROR_FILE_NOT_FOUND && error != ERROR_PATH_NOT_FOUND);
+		return false;
+	}
+
+	LARGE_INTEGER storedSize, targetSize;
+	THROW_IF_WIN32_BOOL_FALSE(GetFileSizeEx(storedFile.get(), &storedSize));
+	THROW_IF_WIN32_BOOL_FALSE(GetFileSizeEx(targetFile.get(), &targetSize));
+	if (storedSize.QuadPart != targetSize.QuadPart)
+		return false;
+	targetFile.reset();
+	return Sha256(MapFileForRead(target).Data()) == digest;
+}
+
+// Puts the store entry at target, next to it first and then renamed over it
+DeployMethod DeployFile(const fs::path& stored, const Sha256Digest& digest, const fs::path& target, DeployMode mode)
+{
+	TRACE_SCOPE("deploy file");
+	if (HasContent(target, stored, digest))
+		return DeployMethod::Unchanged;
+
+	fs::create_directories(target.parent_path());
+	auto temp = target;
+	temp += L".tmp";
+	DeleteFileW(temp.c_str());
+	auto removeTemp = wil::scope_exit([&] { DeleteFileW(temp.c_str()); });
+
+	const auto storeVolume = VolumeOf(stored);
+	const bool sameVolume = CompareStringOrdinal(storeVolume.c_str(), -1, VolumeOf(target.parent_path()).c_str(), -1, TRUE) == CSTR_EQUAL;
+	THROW_HR_IF_MSG(HRESULT_FROM_WIN32(ERROR_NOT_SAME_DEVICE), !sameVolume && (mode == DeployMode::Clone || mode == DeployMode::Link),
+		"%ls is not on the store's volume", target.c_str());
+
+	const bool clone = (mode == DeployMode::Auto || mode == DeployMode::Clone) && sameVolume && SupportsBlockCloning(storeVolume);
+	THROW_HR_IF_MSG(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED), mode == DeployMode::Clone && !clone, "%ls can't clone blocks", storeVolume.c_str());
+
+	DeployMethod method;
+	if (clone)
+	{
+		CloneFile(stored, temp);
+		method = DeployMethod::Clone;
+	}
+	else if (mode == DeployMode::Link)
+	{
+		THROW_IF_WIN32_BOOL_FALSE(CreateHardLinkW(temp.c_str(), stored.c_str(), nullptr));
+		method = DeployMethod::Link;
+	}
+	else
+	{
+		THROW_IF_WIN32_BOOL_FALSE(CopyFileExW(stored.c_str(), temp.c_str(), nullptr, nullptr, nullptr, 0));
+		method = DeployMethod::Copy;
+	}
+
+	THROW_IF_WIN32_BOOL_FALSE(MoveFileExW(temp.c_str(), target.c_str(), MOVEFILE_REPLACE_EXISTING));
+	removeTemp.release();
+	return method;
+}
+
+struct DeployResult
+{
+	fs::path target;
+	const wchar_t* game;
+	size_t file; // Into the stored files
+	DeployMethod method = DeployMethod::Unchanged;
+	HRESULT hr = S_OK;
+};
+
+// deploy <output dir> <install dir>... [--store=<dir>] [--mode=auto|clone|link|copy] [--json=<results.json>|-]
+int CliDeploy(const CliArgs& args)
+{
+	if (args.positional.size() < 2)
+		return ExitUsage;
+
+	const fs::path output(args.positional[0]);
+	const fs::path store = args.Get(L"store") ? fs::absolute(fs::path(*args.Get(L"store"))) : fs::absolute(output / L".store");
+	const std::wstring modeName(args.Get(L"mode", L"auto"));
+	constexpr const wchar_t* ModeNames[] = { L"auto", L"clone", L"link", L"copy" };
+	const auto modeIt = std::find_if(std::begin(ModeNames), std::end(ModeNames), [&](const wchar_t* name) { return EqualsIgnoreCase(modeName, name); });
+	THROW_HR_IF_MSG(E_INVALIDARG, modeIt == std::end(ModeNames), "unknown mode %ls", modeName.c_str());
+	const auto mode = static_cast<DeployMode>(modeIt - std::begin(ModeNames));
+
+	// Every game in the output's manifest, then the manifest itself so verify works on the installs
+	struct StoredFile
+	{
+		fs::path relative;
+		const wchar_t* game;
+		Sha256Digest digest;
+		fs::path stored;
+	};
+	std::vector<StoredFile> files;
+	for (const auto& entry : ReadManifest(output / ManifestFileName))
+		files.push_back({ entry.path, entry.game->name });
+	files.push_back({ ManifestFileName, L"-" });
+
+	const auto start = std::chrono::steady_clock::now();
+	for (auto& file : files)
+	{
+		TRACE_SCOPE("store file");
+		file.digest = Sha256(MapFileForRead(output / file.relative).Data());
+		file.stored = AddToStore(store, output / file.relative, file.digest);
+	}
+
+	std::vector<DeployResult> results;
+	for (const auto& install : std::span(args.positional).subspan(1))
+	{
+		for (size_t i = 0; i < files.size(); ++i)
+			results.push_back({ .target = fs::path(install) / files[i].relative, .game = files[i].game, .file = i });
+	}
+	ParallelFor(results.size(), [&](size_t i, size_t) {
+		auto& result = results[i];
+		try
+		{
+			const auto& file = files[result.file];
+			result.method = DeployFile(file.stored, file.digest, result.target, mode);
+		}
+		catch (...)
+		{
+			result.hr = wil::ResultFromCaughtException();
+		}
+	});
+	const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+	size_t counts[std::size(DeployMethodNames)] = {}, failed = 0;
+	JsonWriter json;
+	json.BeginObject();
+	json.Member("elapsedMs", elapsed.count());
+	json.Member("store", store.wstring());
+	json.Key("files").BeginArray();
+	for (const auto& result : results)
+	{
+		const auto status = FAILED(result.hr) ? L"failed" : DeployMethodNames[static_cast<uint32_t>(result.method)];
+		if (FAILED(result.hr))
+			++failed;
+		else
+			++counts[static_cast<uint32_t>(result.method)];
+		Print(L"{:<9} {:<6} {}{}\n", status, result.game, result.target.wstring(), FAILED(result.hr) ? L": " + HResultMessage(result.hr) : L"");
+
+		json.BeginObject();
+		json.Member("path", result.target.wstring());
+		json.Member("game", result.game);
+		json.Member("status", status);
+		json.Member("sha256", ToHex(files[result.file].digest));
+		if (FAILED(result.hr))
+			json.Member("message", HResultMessage(result.hr));
+		json.EndObject();
+	}
+	json.EndArray();
+	for (size_t i = 0; i < std::size(DeployMethodNames); ++i)
+		json.Member(Utf16ToUtf8(DeployMethodNames[i]), counts[i]);
+	json.Member("failed", failed);
+	json.EndObject();
+
+	if (auto jsonPath = args.Get(L"json"))
+		WriteJsonOutput(*jsonPath, json);
+	PrintError(L"{} files to {} installs in {} ms: {} cloned, {} linked, {} copied, {} unchanged, {} failed\n", results.size(), args.positional.size() - 1, elapsed.count(),
+		counts[static_cast<uint32_t>(DeployMethod::Clone)], counts[static_cast<uint32_t>(DeployMethod::Link)], counts[static_cast<uint32_t>(DeployMethod::Copy)],
+		counts[static_cast<uint32_t>(DeployMethod::Unchanged)], failed);
+
+	return failed == 0 ? ExitSuccess : ExitFailure;
+}
@@ -0,0 +1,313 @@
+#pragma once
+
+// Outline, shadow and coverage curves for rendered glyphs, applied to the atlas before BC3
+// encoding. The draw functions leave white glyphs on black, so each cell's coverage is read
+// into a plane, remapped through the curve, dilated for the outline and shifted and blurred
+// for the shadow with separable SSE2 kernels, then composited back as premultiplied BGRA in
+// the same pass. Cells are processed on their own, so no effect bleeds into a neighbour.
+
+struct GlyphEffects
+{
+	static constexpr uint32_t MaxRadius = 16;
+
+	uint32_t outline = 0; // Dilation radius in pixels, 0 for none
+	COLORREF outlineColor = RGB(0, 0, 0);
+	int32_t shadowX = 0;
+	int32_t shadowY = 0;
+	uint32_t shadowBlur = 0; // Box blur radius, the blur runs twice
+	COLORREF shadowColor = RGB(0, 0, 0);
+	uint8_t shadowOpacity = 0; // 0 for no shadow
+	float gamma = 1.0f; // Applied to the fill coverage after contrast
+	float contrast = 1.0f; // Around half coverage
+
+	bool Enabled() const { return outline != 0 || shadowOpacity != 0 || gamma != 1.0f || contrast != 1.0f; }
+	bool operator==(const GlyphEffects&) const = default;
+};
+
+// For cache keys, empty when there are no effects
+std::wstring GlyphEffectsKey(const GlyphEffects& effects)
+{
+	if (!effects.Enabled())
+		return {};
+	return std::format(L"o{}:{:06x};s{},{},{}:{:06x}:{};g{};c{}", effects.outline, effects.outlineColor, effects.shadowX, effects.shadowY,
+		effects.shadowBlur, effects.shadowColor, effects.shadowOpacity, effects.gamma, effects.contrast);
+}
+
+// The same effects for cells drawn at scale, e.g. in a preview
+GlyphEffects ScaleGlyphEffects(GlyphEffects effects, float scale)
+{
+	effects.outline = static_cast<uint32_t>(std::lround(effects.outline * scale));
+	effects.shadowX = static_cast<int32_t>(std::lround(effects.shadowX * scale));
+	effects.shadowY = static_cast<int32_t>(std::lround(effects.shadowY * scale));
+	effects.shadowBlur = static_cast<uint32_t>(std::lround(effects.shadowBlur * scale));
+	return effects;
+}
+
+// One cell's coverage with MaxRadius zero pixels on every side, so kernels read past the edges
+// without checks. Rows are padded to whole 16 pixel vectors.
+class CoveragePlane
+{
+public:
+	static constexpr uint32_t Pad = GlyphEffects::MaxRadius;
+
+	void Reset(uint32_t width, uint32_t height)
+	{
+		m_width = width;
+		m_height = height;
+		m_stride = RoundUp<16>(width) + 2 * Pad;
+		m_data.assign(static_cast<size_t>(m_stride) * (height + 2 * Pad), 0);
+	}
+
+	uint32_t Width() const { return m_width; }
+	uint32_t Height() const { return m_height; }
+	uint32_t VectorWidth() const { return RoundUp<16>(m_width); }
+
+	// y may be in [-Pad, height + Pad)
+	uint8_t* Row(int32_t y) { return m_data.data() + static_cast<size_t>(y + Pad) * m_stride + Pad; }
+	const uint8_t* Row(int32_t y) const { return m_data.data() + static_cast<size_t>(y + Pad) * m_stride + Pad; }
+
+private:
+	uint32_t m_width = 0;
+	uint32_t m_height = 0;
+	uint32_t m_stride = 0;
+	std::vector<uint8_t> m_data;
+};
+
+// dst(x, y) = max of src over x - radius .. x + radius
+void DilateRows(const CoveragePlane& src, CoveragePlane& dst, uint32_t radius)
+{
+	const int32_t r = static_cast<int32_t>(radius);
+	for (int32_t y = 0; y < static_cast<int32_t>(src.Height()); ++y)
+	{
+		const uint8_t* in = src.Row(y);
+		uint8_t* out = dst.Row(y);
+		for (int32_t x = 0; x < static_cast<int32_t>(src.VectorWidth()); x += 16)
+		{
+			__m128i acc = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + x - r));
+			for (int32_t k = -r + 1; k <= r; ++k)
+				acc = _mm_max_epu8(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + x + k)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), acc);
+		}
+	}
+}
+
+// dst(x, y) = max of src over y - radius .. y + radius
+void DilateColumns(const CoveragePlane& src, CoveragePlane& dst, uint32_t radius)
+{
+	const int32_t r = static_cast<int32_t>(radius);
+	for (int32_t y = 0; y < static_cast<int32_t>(src.Height()); ++y)
+	{
+		uint8_t* out = dst.Row(y);
+		for (int32_t x = 0; x < static_cast<int32_t>(src.VectorWidth()); x += 16)
+		{
+			__m128i acc = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src.Row(y - r) + x));
+			for (int32_t k = -r + 1; k <= r; ++k)
+				acc = _mm_max_epu8(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(src.Row(y + k) + x)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), acc);
+		}
+	}
+}
+
+// Sums in 16 bit lanes, 8 pixels at a time. Divides by 2 * radius + 1 with a rounded up
+// reciprocal, which stays exact at 255 for radius < 128.
+inline __m128i BoxAverage(__m128i sum, __m128i reciprocal)
+{
+	return _mm_packus_epi16(_mm_mulhi_epu16(sum, reciprocal), _mm_setzero_si128());
+}
+
+inline uint32_t BoxReciprocal(uint32_t radius)
+{
+	const uint32_t taps = 2 * radius + 1;
+	return (65536 + taps - 1) / taps;
+}
+
+// radius must be at least 1. Both passes stop at the plane width: the columns after it
+// stay 0, as the next pass reads them as the blur's right border.
+void BoxBlurRows(const CoveragePlane& src, CoveragePlane& dst, uint32_t radius)
+{
+	const int32_t r = static_cast<int32_t>(radius), width = static_cast<int32_t>(src.Width());
+	const uint32_t scale = BoxReciprocal(radius);
+	const __m128i zero = _mm_setzero_si128(), reciprocal = _mm_set1_epi16(static_cast<short>(scale));
+	for (int32_t y = 0; y < static_cast<int32_t>(src.Height()); ++y)
+	{
+		const uint8_t* in = src.Row(y);
+		uint8_t* out = dst.Row(y);
+		int32_t x = 0;
+		for (; x + 8 <= width; x += 8)
+		{
+			__m128i sum = zero;
+			for (int32_t k = -r; k <= r; ++k)
+				sum = _mm_add_epi16(sum, _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(in + x + k)), zero));
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(out + x), BoxAverage(sum, reciprocal));
+		}
+		for (; x < width; ++x)
+		{
+			uint32_t sum = 0;
+			for (int32_t k = -r; k <= r; ++k)
+				sum += in[x + k];
+			out[x] = static_cast<uint8_t>(sum * scale >> 16);
+		}
+	}
+}
+
+void BoxBlurColumns(const CoveragePlane& src, CoveragePlane& dst, uint32_t radius)
+{
+	const int32_t r = static_cast<int32_t>(radius), width = static_cast<int32_t>(src.Width());
+	const uint32_t scale = BoxReciprocal(radius);
+	const __m128i zero = _mm_setzero_si128(), reciprocal = _mm_set1_epi16(static_cast<short>(scale));
+	for (int32_t y = 0; y < static_cast<int32_t>(src.Height()); ++y)
+	{
+		uint8_t* out = dst.Row(y);
+		int32_t x = 0;
+		for (; x + 8 <= width; x += 8)
+		{
+			__m128i sum = zero;
+			for (int32_t k = -r; k <= r; ++k)
+				sum = _mm_add_epi16(sum, _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src.Row(y + k) + x)), zero));
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(out + x), BoxAverage(sum, reciprocal));
+		}
+		for (; x < width; ++x)
+		{
+			uint32_t sum = 0;
+			for (int32_t k = -r; k <= r; ++k)
+				sum += src.Row(y + k)[x];
+			out[x] = static_cast<uint8_t>(sum * scale >> 16);
+		}
+	}
+}
+
+// dst(x, y) = src(x - dx, y - dy) within the cell, 0 elsewhere
+void ShiftPlane(const CoveragePlane& src, CoveragePlane& dst, int32_t dx, int32_t dy)
+{
+	const int32_t width = static_cast<int32_t>(src.Width()), height = static_cast<int32_t>(src.Height());
+	const int32_t left = std::clamp(dx, 0, width), right = std::clamp(width + dx, 0, width);
+	for (int32_t y = 0; y < height; ++y)
+	{
+		uint8_t* out = dst.Row(y);
+		std::fill_n(out, width, uint8_t(0));
+		if (y - dy >= 0 && y - dy < height && left < right)
+			std::copy(src.Row(y - dy) + left - dx, src.Row(y - dy) + right - dx, out + left);
+	}
+}
+
+// a * b / 255, rounded
+inline uint32_t MulDiv255(uint32_t a, uint32_t b)
+{
+	const uint32_t t = a * b + 128;
+	return (t + (t >> 8)) >> 8;
+}
+
+// Contrast around half coverage, then gamma
+std::array<uint8_t, 256> MakeCoverageCurve(const GlyphEffects& effects)
+{
+	std::array<uint8_t, 256> curve;
+	for (uint32_t i = 0; i < 256; ++i)
+	{
+		const float contrasted = std::clamp((i / 255.0f - 0.5f) * effects.contrast + 0.5f, 0.0f, 1.0f);
+		curve[i] = static_cast<uint8_t>(std::lround(powf(contrasted, 1.0f / effects.gamma) * 255.0f));
+	}
+	curve[0] = 0; // Lower contrast must not fill the background
+	return curve;
+}
+
+struct GlyphEffectsScratch
+{
+	CoveragePlane fill;
+	CoveragePlane outline;
+	CoveragePlane shadow;
+	CoveragePlane temp;
+};
+
+void ApplyGlyphEffectsCell(uint8_t* cell, size_t rowPitch, uint32_t width, uint32_t height, const GlyphEffects& effects,
+	const std::array<uint8_t, 256>& curve, GlyphEffectsScratch& scratch)
+{
+	// GDI+ leaves alpha alone when it draws on a DC, so any channel may carry the coverage
+	auto& fill = scratch.fill;
+	fill.Reset(width, height);
+	bool empty = true;
+	for (uint32_t y = 0; y < height; ++y)
+	{
+		const uint8_t* in = cell + y * rowPitch;
+		uint8_t* out = fill.Row(static_cast<int32_t>(y));
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			const uint8_t coverage = std::max({ in[x * 4], in[x * 4 + 1], in[x * 4 + 2], in[x * 4 + 3] });
+			out[x] = curve[coverage];
+			empty = empty && coverage == 0;
+		}
+	}
+	if (empty)
+		return;
+
+	const CoveragePlane* outline = &fill;
+	if (effects.outline != 0)
+	{
+		scratch.temp.Reset(width, height);
+		scratch.outline.Reset(width, height);
+		DilateRows(fill, scratch.temp, effects.outline);
+		DilateColumns(scratch.temp, scratch.outline, effects.outline);
+		outline = &scratch.outline;
+	}
+
+	const bool shadow = effects.shadowOpacity != 0;
+	if (shadow)
+	{
+		scratch.shadow.Reset(width, height);
+		ShiftPlane(*outline, scratch.shadow, effects.shadowX, effects.shadowY);
+		if (effects.shadowBlur != 0)
+		{
+			scratch.temp.Reset(width, height);
+			for (int pass = 0; pass < 2; ++pass)
+			{
+				BoxBlurRows(scratch.shadow, scratch.temp, effects.shadowBlur);
+				BoxBlurColumns(scratch.temp, scratch.shadow, effects.shadowBlur);
+			}
+		}
+	}
+
+	// Shadow, then outline, then the white fill, each over the ones before
+	const uint32_t outlineColor[3] = { GetBValue(effects.outlineColor), GetGValue(effects.outlineColor), GetRValue(effects.outlineColor) };
+	const uint32_t shadowColor[3] = { GetBValue(effects.shadowColor), GetGValue(effects.shadowColor), GetRValue(effects.shadowColor) };
+	for (uint32_t y = 0; y < height; ++y)
+	{
+		uint8_t* out = cell + y * rowPitch;
+		const uint8_t* f = fill.Row(static_cast<int32_t>(y));
+		const uint8_t* o = outline->Row(static_cast<int32_t>(y));
+		const uint8_t* s = shadow ? scratch.shadow.Row(static_cast<int32_t>(y)) : nullptr;
+		for (uint32_t x = 0; x < width; ++x, out += 4)
+		{
+			const uint32_t fillAlpha = f[x], outlineAlpha = o[x], shadowAlpha = s ? MulDiv255(s[x], effects.shadowOpacity) : 0;
+			if ((fillAlpha | outlineAlpha | shadowAlpha) == 0)
+			{
+				std::fill_n(out, 4, uint8_t(0));
+				continue;
+			}
+
+			const uint32_t underAlpha = outlineAlpha + MulDiv255(shadowAlpha, 255 - outlineAlpha);
+			for (int c = 0; c < 3; ++c)
+			{
+				const uint32_t under = MulDiv255(outlineColor[c], outlineAlpha) + MulDiv255(MulDiv255(shadowColor[c], shadowAlpha), 255 - outlineAlpha);
+				out[c] = static_cast<uint8_t>(fillAlpha + MulDiv255(under, 255 - fillAlpha));
+			}
+			out[3] = static_cast<uint8_t>(fillAlpha + MulDiv255(underAlpha, 255 - fillAlpha));
+		}
+	}
+}
+
+// In place on a BGRA image of cellWidth x cellHeight cells, one task per cell row. Rows below
+// the last whole cell row are left alone.
+void ApplyGlyphEffects(const DirectX::Image& img, const GlyphEffects& effects, uint32_t cellWidth = CharWidth, uint32_t cellHeight = CharHeight)
+{
+	if (!effects.Enabled())
+		return;
+
+	TRACE_SCOPE("glyph effects");
+	THROW_HR_IF(E_INVALIDARG, effects.outline > GlyphEffects::MaxRadius || effects.shadowBlur > GlyphEffects::MaxRadius);
+	const auto curve = MakeCoverageCurve(effects);
+	const size_t xCells = img.width / cellWidth, yCells = img.height / cellHeight;
+	ParallelFor(yCells, [&](size_t row, size_t) {
+		GlyphEffectsScratch scratch;
+		for (size_t x = 0; x < xCells; ++x)
+			ApplyGlyphEffectsCell(img.pixels + row * cellHeight * img.rowPitch + x * cellWidth * 4, img.rowPitch, cellWidth, cellHeight, effects, curve, scratch);
+	});
+}
@@ -0,0 +1,315 @@
+#pragma once
+
+// Texture dumps for QA: every texture of any number of texture dictionaries, written as
+// PNG (top level, decoded) or DDS (every level, as stored). Dictionaries are read through
+// deep overlapped queues (see Io.hpp), then decoded and written on all hardware threads as
+// their reads complete.
+
+struct TextureEntry
+{
+	uint32_t hash;
+	std::string name;
+	D3DFORMAT d3dFormat;
+	DXGI_FORMAT format; // DXGI_FORMAT_UNKNOWN if it can't be extracted
+	uint32_t width;
+	uint32_t height;
+	uint32_t levels;
+	std::span<const uint8_t> pixels; // Every level, points into the source
+};
+
+// The textures of a decoded dictionary, in the dictionary's (hash) order
+std::vector<TextureEntry> ListTextures(const SourceResource& source)
+{
+	const RageUtil::TextureDictionaryView view(source.data.get(), source.header);
+	std::vector<TextureEntry> textures;
+	textures.reserve(view.Textures().size());
+	for (const auto& texture : view.Textures())
+	{
+		textures.push_back({
+			.hash = texture.hash,
+			.name = std::string(texture.name),
+			.d3dFormat = texture.texture->pixelFormat,
+			.format = texture.format,
+			.width = texture.texture->width,
+			.height = texture.texture->height,
+			.levels = texture.levels,
+			.pixels = texture.pixels
+		});
+	}
+	return textures;
+}
+
+// An RGBA8 PNG made for speed rather than size: the Sub filter on every row and the
+// fastest zlib level
+std::vector<uint8_t> EncodePngFast(const uint8_t* rgba, uint32_t width, uint32_t height)
+{
+	const size_t rowSize = static_cast<size_t>(width) * 4;
+	std::vector<uint8_t> filtered((rowSize + 1) * height);
+	for (uint32_t y = 0; y < height; ++y)
+	{
+		const uint8_t* src = rgba + y * rowSize;
+		uint8_t* dst = filtered.data() + y * (rowSize + 1);
+		*dst++ = 1; // Sub
+		std::copy_n(src, std::min<size_t>(rowSize, 4), dst);
+		size_t i = 4;
+		for (; i + 16 <= rowSize; i += 16)
+		{
+			const __m128i cur = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+			const __m128i left = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i - 4));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_sub_epi8(cur, left));
+		}
+		for (; i < rowSize; ++i)
+			dst[i] = static_cast<uint8_t>(src[i] - src[i - 4]);
+	}
+
+	uLongf compressedSize = compressBound(static_cast<uLong>(filtered.size()));
+	std::vector<uint8_t> compressed(compressedSize);
+	THROW_HR_IF(E_FAIL, compress2(compressed.data(), &compressedSize, filtered.data(), static_cast<uLong>(filtered.size()), Z_BEST_SPEED) != Z_OK);
+
+	std::vector<uint8_t> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	png.reserve(png.size() + compressedSize + 64);
+	auto put32 = [&png](uint32_t value) {
+		for (int shift = 24; shift >= 0; shift -= 8)
+			png.push_back(static_cast<uint8_t>(value >> shift));
+	};
+	auto chunk = [&](const char (&type)[5], const uint8_t* data, size_t size) {
+		put32(static_cast<uint32_t>(size));
+		const size_t start = png.size();
+		png.insert(png.end(), type, type + 4);
+		png.insert(png.end(), data, data + size);
+		put32(crc32(0, png.data() + start, static_cast<uInt>(size + 4)));
+	};
+
+	const uint8_t header[13] = {
+		static_cast<uint8_t>(width >> 24), static_cast<uint8_t>(width >> 16), static_cast<uint8_t>(width >> 8), static_cast<uint8_t>(width),
+		static_cast<uint8_t>(height >> 24), static_cast<uint8_t>(height >> 16), static_cast<uint8_t>(height >> 8), static_cast<uint8_t>(height),
+		8, 6, 0, 0, 0 // 8 bit RGBA, deflate, adaptive filtering, no interlace
+	};
+	chunk("IHDR", header, sizeof(header));
+	chunk("IDAT", compressed.data(), compressedSize);
+	chunk("IEND", nullptr, 0);
+	return png;
+}
+
+// The top level as RGBA8
+std::vector<uint8_t> DecodeTexture(const TextureEntry& texture)
+{
+	std::vector<uint8_t> rgba(static_cast<size_t>(texture.width) * texture.height * 4);
+	const size_t pixels = static_cast<size_t>(texture.width) * texture.height;
+	if (texture.format == DXGI_FORMAT_B8G8R8A8_UNORM)
+		BgraToRgba(texture.pixels.data(), pixels, rgba.data());
+	else if (texture.format == DXGI_FORMAT_A8_UNORM) // White with the alpha, as glyphs are drawn
+	{
+		for (size_t i = 0; i < pixels; ++i)
+			reinterpret_cast<uint32_t*>(rgba.data())[i] = 0x00FFFFFFu | (static_cast<uint32_t>(texture.pixels[i]) << 24);
+	}
+	else if (texture.format == DXGI_FORMAT_R8_UNORM) // L8
+	{
+		for (size_t i = 0; i < pixels; ++i)
+			reinterpret_cast<uint32_t*>(rgba.data())[i] = 0xFF000000u | texture.pixels[i] * 0x010101u;
+	}
+	else
+		DecodeBc(texture.format, texture.pixels.data(), texture.width, texture.height, rgba.data(), static_cast<size_t>(texture.width) * 4);
+	return rgba;
+}
+
+void SaveTextureDDS(const TextureEntry& texture, const fs::path& path)
+{
+	const DirectX::TexMetadata metadata = {
+		.width = texture.width,
+		.height = texture.height,
+		.depth = 1,
+		.arraySize = 1,
+		.mipLevels = texture.levels,
+		.format = texture.format,
+		.dimension = DirectX::TEX_DIMENSION_TEXTURE2D
+	};
+
+	std::vector<DirectX::Image> images;
+	auto pixels = const_cast<uint8_t*>(texture.pixels.data());
+	for (uint32_t level = 0; level < texture.levels; ++level)
+	{
+		DirectX::Image image = { .width = std::max(texture.width >> level, 1u), .height = std::max(texture.height >> level, 1u), .format = texture.format };
+		THROW_IF_FAILED(DirectX::ComputePitch(image.format, image.width, image.height, image.rowPitch, image.slicePitch));
+		image.pixels = pixels;
+		pixels += image.slicePitch;
+		images.push_back(image);
+	}
+	THROW_IF_FAILED(DirectX::SaveToDDSFile(images.data(), images.size(), metadata, DirectX::DDS_FLAGS_NONE, path.c_str()));
+}
+
+// A file name from a texture name like pack:/font_chs.dds
+std::wstring TextureFileName(const TextureEntry& texture)
+{
+	std::string_view name = texture.name;
+	if (auto slash = name.find_last_of(":/\\"); slash != name.npos)
+		name.remove_prefix(slash + 1);
+	if (name.size() > 4 && EqualsIgnoreCase(Utf8ToUtf16(name.substr(name.size() - 4)), L".dds"))
+		name.remove_suffix(4);
+
+	auto fileName = Utf8ToUtf16(name);
+	for (auto& ch : fileName)
+	{
+		if (ch < 0x20 || std::wstring_view(L"<>:\"/\\|?*").find(ch) != std::wstring_view::npos)
+			ch = L'_';
+	}
+	return fileName.empty() ? std::format(L"{:08x}", texture.hash) : fileName;
+}
+
+struct ExtractResult
+{
+	fs::path input;
+	HRESULT hr = S_OK;
+	uint64_t inputBytes = 0;
+	uint64_t outputBytes = 0;
+	std::vector<TextureEntry> textures; // pixels is empty once the dictionary is done
+	std::vector<fs::path> outputs; // Empty for textures that were skipped
+};
+
+// extract <fonts.wtd or dir>... [--out=extracted] [--format=png|dds] [--json=<results.json>|-]
+int CliExtract(const CliArgs& args)
+{
+	if (args.positional.empty())
+		return ExitUsage;
+
+	const fs::path outRoot = fs::absolute(args.Get(L"out", L"extracted"));
+	const auto format = args.Get(L"format", L"png");
+	THROW_HR_IF_MSG(E_INVALIDARG, format != L"png" && format != L"dds", "unknown format %.*ls", static_cast<int>(format.size()), format.data());
+
+	// Directories are searched for .wtd files, each dictionary gets a directory named after its path
+	std::vector<std::pair<fs::path, fs::path>> inputs; // Dictionary, output directory
+	for (const auto& arg : args.positional)
+	{
+		const fs::path path(arg);
+		if (fs::is_directory(path))
+		{
+			for (const auto& entry : fs::recursive_directory_iterator(path, fs::directory_options::skip_permission_denied))
+			{
+				if (entry.is_regular_file() && EqualsIgnoreCase(entry.path().extension().wstring(), L".wtd"))
+					inputs.emplace_back(entry.path(), outRoot / fs::relative(entry.path(), path).replace_extension());
+			}
+		}
+		else
+			inputs.emplace_back(path, outRoot / path.stem());
+	}
+
+	std::vector<ExtractResult> results(inputs.size());
+	std::vector<fs::path> files;
+	for (size_t i = 0; i < inputs.size(); ++i)
+	{
+		results[i].input = inputs[i].first;
+		files.push_back(inputs[i].first);
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	ForEachFileRead(files, [&](size_t i, std::span<const uint8_t> data) {
+		TRACE_SCOPE("dictionary");
+		auto& result = results[i];
+		try
+		{
+			result.inputBytes = data.size();
+			// Only the report's metadata outlives this call, the decoded dictionary doesn't
+			const auto source = ReadWTD(data);
+			result.textures = ListTextures(source);
+			auto forgetPixels = wil::scope_exit([&] {
+				for (auto& texture : result.textures)
+					texture.pixels = {};
+			});
+			fs::create_directories(inputs[i].second);
+
+			std::unordered_set<std::wstring> names; // Upper case, file names are case insensitive
+			auto upper = [](std::wstring name) {
+				CharUpperBuffW(name.data(), static_cast<DWORD>(name.size()));
+				return name;
+			};
+			for (const auto& texture : result.textures)
+			{
+				auto& out = result.outputs.emplace_back();
+				if (texture.format == DXGI_FORMAT_UNKNOWN)
+					continue;
+
+				// Textures may share a name, later ones get their hash appended rather than overwrite
+				auto name = TextureFileName(texture);
+				if (!names.insert(upper(name)).second)
+				{
+					auto renamed = std::format(L"{}-{:08x}", name, texture.hash);
+					for (uint32_t n = 2; !names.insert(upper(renamed)).second; ++n)
+						renamed = std::format(L"{}-{:08x}-{}", name, texture.hash, n);
+					PrintError(L"warning: {}: more than one texture named {}, writing {}\n", result.input.wstring(), name, renamed);
+					name = std::move(renamed);
+				}
+
+				out = inputs[i].second / (name + (format == L"png" ? L".png" : L".dds"));
+				if (format == L"png")
+				{
+					const auto png = EncodePngFast(DecodeTexture(texture).data(), texture.width, texture.height);
+					wil::unique_hfile hFile(CreateFileW(out.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+					THROW_LAST_ERROR_IF(!hFile);
+					WriteFileCheckSize(hFile.get(), const_cast<uint8_t*>(png.data()), static_cast<DWORD>(png.size()));
+				}
+				else
+					SaveTextureDDS(texture, out);
+				result.outputBytes += fs::file_size(out);
+			}
+		}
+		catch (...)
+		{
+			result.hr = wil::ResultFromCaughtException();
+		}
+	}, [&](size_t i, HRESULT hr) { results[i].hr = hr; });
+	const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	size_t failed = 0, textureCount = 0, skipped = 0;
+	uint64_t inputBytes = 0, outputBytes = 0;
+	JsonWriter json;
+	json.BeginObject();
+	json.Key("dictionaries").BeginArray();
+	for (const auto& result : results)
+	{
+		const bool ok = SUCCEEDED(result.hr);
+		failed += ok ? 0 : 1;
+		inputBytes += result.inputBytes;
+		outputBytes += result.outputBytes;
+		if (!ok)
+			PrintError(L"failed {}: {}\n", result.input.wstring(), HResultMessage(result.hr));
+
+		json.BeginObject();
+		json.Member("path", result.input.wstring());
+		json.Member("ok", ok);
+		if (!ok)
+			json.Member("message", HResultMessage(result.hr));
+		json.Key("textures").BeginArray();
+		for (size_t i = 0; i < result.textures.size(); ++i)
+		{
+			const auto& texture = result.textures[i];
+			const bool written = i < result.outputs.size() && !result.outputs[i].empty();
+			textureCount += written ? 1 : 0;
+			skipped += texture.format == DXGI_FORMAT_UNKNOWN ? 1 : 0;
+
+			json.BeginObject();
+			json.Member("hash", std::format("{:08x}", texture.hash));
+			json.Member("name", texture.name);
+			json.Member("d3dFormat", static_cast<uint32_t>(texture.d3dFormat));
+			json.Member("width", texture.width);
+			json.Member("height", texture.height);
+			json.Member("levels", texture.levels);
+			if (written)
+				json.Member("output", result.outputs[i].wstring());
+			json.EndObject();
+		}
+		json.EndArray();
+		json.EndObject();
+	}
+	json.EndArray();
+	json.Member("failed", failed);
+	json.Member("seconds", elapsed);
+	json.EndObject();
+
+	if (auto jsonPath = args.Get(L"json"))
+		WriteJsonOutput(*jsonPath, json);
+	PrintError(L"{} textures from {} of {} dictionaries in {:.2f} s, {:.1f} MB/s read, {:.1f} MB/s written{}\n",
+		textureCount, results.size() - failed, results.size(), elapsed, inputBytes / 1e6 / elapsed, outputBytes / 1e6 / elapsed,
+		skipped != 0 ? std::format(L", {} in unsupported formats skipped", skipped) : L"");
+
+	return failed == 0 ? ExitSuccess : ExitFailure;
+}
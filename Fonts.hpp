@@ -0,0 +1,207 @@
+#pragma once
+
+// Font selection for the atlas. A character in NonSymbolRange prefers font, any other prefers
+// symbolFont; if the preferred font has no glyph for it, the first of font, symbolFont and then
+// fallbacks that has one draws it. Coverage comes from each font's cmap, read once into a bitset,
+// and every character of a text is resolved before drawing starts, so drawing only looks up
+// the font of each character.
+struct FontSet
+{
+	LOGFONTW font;
+	LOGFONTW symbolFont;
+	std::vector<LOGFONTW> fallbacks;
+
+	size_t Count() const { return 2 + fallbacks.size(); }
+	const LOGFONTW& operator[](size_t i) const { return i == 0 ? font : i == 1 ? symbolFont : fallbacks[i - 2]; }
+
+	// In pixels, for DirectWrite. GDI+ reads the same size from lfHeight, which is -EmSize in every
+	// font; fonts not set up yet count as DefaultFontHeight.
+	float EmSize() const { return static_cast<float>(font.lfHeight < 0 ? -font.lfHeight : -DefaultFontHeight); }
+};
+
+// For cache keys
+std::wstring FontSetKey(const FontSet& fonts)
+{
+	std::wstring key;
+	for (size_t i = 0; i < fonts.Count(); ++i)
+		key += std::format(L"{}:{}:{};", fonts[i].lfFaceName, fonts[i].lfWeight, fonts[i].lfHeight);
+	return key;
+}
+
+// One bit per code point
+class FontCoverage
+{
+public:
+	static constexpr char32_t CodePoints = 0x110000;
+
+	FontCoverage() : m_bits(CodePoints / 64) {}
+
+	bool Has(char32_t ch) const { return ch < CodePoints && (m_bits[ch / 64] >> (ch % 64) & 1) != 0; }
+	void Set(char32_t ch) { m_bits[ch / 64] |= uint64_t(1) << (ch % 64); }
+
+private:
+	std::vector<uint64_t> m_bits;
+};
+
+// Adds the characters of every Unicode subtable (format 4 or 12) of an OpenType cmap table
+void ReadCmapCoverage(std::span<const uint8_t> cmap, FontCoverage& coverage)
+{
+	auto read16 = [&](size_t offset) -> uint32_t {
+		THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_INVALID_DATA), offset + 2 > cmap.size());
+		return (cmap[offset] << 8) | cmap[offset + 1];
+	};
+	auto read32 = [&](size_t offset) -> uint32_t {
+		return (read16(offset) << 16) | read16(offset + 2);
+	};
+
+	const uint32_t tableCount = read16(2);
+	for (uint32_t t = 0; t < tableCount; ++t)
+	{
+		const uint32_t platform = read16(4 + t * 8), encoding = read16(4 + t * 8 + 2);
+		const size_t offset = read32(4 + t * 8 + 4);
+		const bool unicode = platform == 0 || (platform == 3 && (encoding == 1 || encoding == 10));
+		if (!unicode)
+			continue;
+
+		const uint32_t format = read16(offset);
+		if (format == 4)
+		{
+			const size_t segments = read16(offset + 6) / 2;
+			const size_t ends = offset + 14, starts = ends + segments * 2 + 2, deltas = starts + segments * 2, rangeOffsets = deltas + segments * 2;
+			for (size_t i = 0; i < segments; ++i)
+			{
+				const uint32_t start = read16(starts + i * 2), end = read16(ends + i * 2);
+				const uint32_t delta = read16(deltas + i * 2), rangeOffset = read16(rangeOffsets + i * 2);
+				for (uint32_t ch = start; ch <= end && ch != 0xFFFF; ++ch)
+				{
+					uint32_t glyph = rangeOffset == 0 ? ch : read16(rangeOffsets + i * 2 + rangeOffset + (ch - start) * 2);
+					if (rangeOffset != 0 && glyph == 0)
+						continue;
+					if (((glyph + delta) & 0xFFFF) != 0)
+						coverage.Set(ch);
+				}
+			}
+		}
+		else if (format == 12)
+		{
+			const uint32_t groups = read32(offset + 12);
+			for (uint32_t i = 0; i < groups; ++i)
+			{
+				const size_t group = offset + 16 + static_cast<size_t>(i) * 12;
+				const uint32_t start = read32(group), end = std::min<uint32_t>(read32(group + 4), FontCoverage::CodePoints - 1);
+				const uint32_t startGlyph = read32(group + 8);
+				for (uint32_t ch = start + (startGlyph == 0 ? 1 : 0); ch <= end; ++ch)
+					coverage.Set(ch);
+			}
+		}
+	}
+}
+
+FontCoverage LoadFontCoverage(const LOGFONTW& lf)
+{
+	TRACE_SCOPE("font coverage");
+	wil::com_ptr<IDWriteGdiInterop> interop;
+	THROW_IF_FAILED(g_dwriteFactory->GetGdiInterop(&interop));
+	wil::com_ptr<IDWriteFont> font;
+	const HRESULT hr = interop->CreateFontFromLOGFONT(&lf, &font);
+	THROW_IF_FAILED_MSG(hr, "font %ls not found", lf.lfFaceName);
+	wil::com_ptr<IDWriteFontFace> fontFace;
+	THROW_IF_FAILED(font->CreateFontFace(&fontFace));
+
+	const void* data;
+	UINT32 size;
+	void* context;
+	BOOL exists;
+	THROW_IF_FAILED(fontFace->TryGetFontTable(DWRITE_MAKE_OPENTYPE_TAG('c', 'm', 'a', 'p'), &data, &size, &context, &exists));
+	THROW_HR_IF_MSG(HRESULT_FROM_WIN32(ERROR_INVALID_DATA), !exists, "font %ls has no cmap", lf.lfFaceName);
+	auto release = wil::scope_exit([&] { fontFace->ReleaseFontTable(context); });
+
+	FontCoverage coverage;
+	ReadCmapCoverage({ static_cast<const uint8_t*>(data), size }, coverage);
+	return coverage;
+}
+
+// Coverage is loaded once per face and weight; RefreshFonts clears it with the text formats
+struct FontCoverageCache
+{
+	std::mutex lock;
+	std::map<std::pair<std::wstring, LONG>, std::shared_ptr<const FontCoverage>> coverage;
+};
+
+FontCoverageCache& GetFontCoverageCache()
+{
+	static FontCoverageCache s_cache;
+	return s_cache;
+}
+
+std::shared_ptr<const FontCoverage> GetFontCoverage(const LOGFONTW& lf)
+{
+	auto& cache = GetFontCoverageCache();
+	const auto key = std::make_pair(std::wstring(lf.lfFaceName), lf.lfWeight);
+	{
+		std::lock_guard lock(cache.lock);
+		if (auto it = cache.coverage.find(key); it != cache.coverage.end())
+			return it->second;
+	}
+	auto coverage = std::make_shared<const FontCoverage>(LoadFontCoverage(lf));
+	std::lock_guard lock(cache.lock);
+	return cache.coverage.try_emplace(key, std::move(coverage)).first->second;
+}
+
+struct FontAssignment
+{
+	std::vector<uint8_t> fontOf; // Index into the FontSet for each character of the text
+	std::vector<char32_t> uncovered; // Characters no font has, drawn with their preferred font
+};
+
+// ch as it is drawn
+inline char32_t DrawnChar(char32_t ch, bool replaceChars)
+{
+	if (replaceChars)
+	{
+		if (auto it = ReplaceMap.find(ch); it != ReplaceMap.end())
+			return it->second;
+	}
+	return ch;
+}
+
+// "U+4E00 U+4E01 ..." for the first max code points
+std::wstring FormatCodePoints(std::span<const char32_t> chars, size_t max)
+{
+	std::wstring text;
+	for (size_t i = 0; i < std::min(chars.size(), max); ++i)
+		text += std::format(L"{}U+{:04X}", i == 0 ? L"" : L" ", static_cast<uint32_t>(chars[i]));
+	if (chars.size() > max)
+		text += L" ...";
+	return text;
+}
+
+FontAssignment ResolveFonts(const FontSet& fonts, std::u32string_view text, bool replaceChars)
+{
+	TRACE_SCOPE("resolve fonts");
+	THROW_HR_IF(E_INVALIDARG, fonts.Count() > UINT8_MAX);
+	std::vector<std::shared_ptr<const FontCoverage>> coverage;
+	for (size_t i = 0; i < fonts.Count(); ++i)
+		coverage.push_back(GetFontCoverage(fonts[i]));
+
+	FontAssignment assignment;
+	assignment.fontOf.resize(text.size());
+	for (size_t i = 0; i < text.size(); ++i)
+	{
+		const char32_t ch = DrawnChar(text[i], replaceChars);
+		const uint8_t preferred = IsCharInRanges(NonSymbolRange, ch) ? 0 : 1;
+		uint8_t font = preferred;
+		if (!coverage[preferred]->Has(ch))
+		{
+			size_t k = 0;
+			while (k < coverage.size() && !coverage[k]->Has(ch))
+				++k;
+			if (k < coverage.size())
+				font = static_cast<uint8_t>(k);
+			else if (!IgnoreSet.contains(text[i]))
+				assignment.uncovered.push_back(text[i]);
+		}
+		assignment.fontOf[i] = font;
+	}
+	return assignment;
+}
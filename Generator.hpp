@@ -0,0 +1,623 @@
+#pragma once
+
+// How font_chs is stored. The atlas is white glyphs whose coverage is in alpha, so the 8-bit
+// formats keep that plane uncompressed: A8 samples as (0, 0, 0, coverage) and L8 as (coverage,
+// coverage, coverage, 1) in D3D9. Which of them draws right depends on what the font shader
+// reads, and many D3D9 drivers can't create A8 textures while L8 works everywhere. The games
+// ship DXT5, the only format known to draw; A8 and L8 are experimental and have to be asked
+// for with experimentalFormats.
+enum struct AtlasFormat : uint32_t
+{
+	Dxt5,
+	A8,
+	L8
+};
+
+constexpr const wchar_t* AtlasFormatNames[] = { L"dxt5", L"a8", L"l8" };
+
+inline const wchar_t* AtlasFormatName(AtlasFormat format)
+{
+	return AtlasFormatNames[static_cast<uint32_t>(format)];
+}
+
+inline DXGI_FORMAT ToDxgiFormat(AtlasFormat format)
+{
+	constexpr DXGI_FORMAT Formats[] = { DXGI_FORMAT_BC3_UNORM, DXGI_FORMAT_A8_UNORM, DXGI_FORMAT_R8_UNORM };
+	return Formats[static_cast<uint32_t>(format)];
+}
+
+// nullopt for a font_chs format WtdPatch doesn't write
+inline std::optional<AtlasFormat> ToAtlasFormat(D3DFORMAT format)
+{
+	constexpr D3DFORMAT Formats[] = { D3DFMT_DXT5, D3DFMT_A8, D3DFMT_L8 };
+	for (uint32_t i = 0; i < std::size(Formats); ++i)
+	{
+		if (format == Formats[i])
+			return static_cast<AtlasFormat>(i);
+	}
+	return std::nullopt;
+}
+
+// The formats WtdPatch writes font_chs in
+inline bool IsFontChsFormat(D3DFORMAT format)
+{
+	return ToAtlasFormat(format).has_value();
+}
+
+struct GenerateOptions
+{
+	FontSet fonts;
+	bool useGDIP = false;
+	bool replaceChars = false;
+	AtlasFormat format = AtlasFormat::Dxt5;
+	Bc3Quality quality = Bc3Quality::Default; // For DXT5 only
+	GlyphEffects effects;
+};
+
+// A BGRA atlas with one character per CharWidth x CharHeight cell
+struct CharsBitmap
+{
+	wil::unique_hbitmap hBitmap;
+	uint8_t* bits = nullptr;
+	uint32_t width = 0;
+	uint32_t height = 0;
+
+	DirectX::Image Image() const
+	{
+		return {
+			.width = width,
+			.height = height,
+			.format = DXGI_FORMAT_B8G8R8A8_UNORM,
+			.rowPitch = width * 4,
+			.slicePitch = width * height * 4,
+			.pixels = bits
+		};
+	}
+};
+
+// progress, if given, counts rows
+CharsBitmap RenderCharsBitmap(const GenerateOptions& options, std::u32string_view chars, uint32_t width = TextureWidth, uint32_t height = TextureHeight, JobProgress* progress = nullptr)
+{
+	TRACE_SCOPE("render");
+	CharsBitmap bitmap = { .width = width, .height = height };
+
+	// A memory DC is enough for a DIB section, so this also works without a window
+	wil::unique_hdc hdc(CreateCompatibleDC(nullptr));
+	THROW_HR_IF(E_FAIL, !hdc);
+	bitmap.hBitmap = CreateDIB(hdc.get(), width, height, 32, reinterpret_cast<void**>(&bitmap.bits));
+	THROW_HR_IF(E_FAIL, !bitmap.hBitmap);
+	auto selectBitmap = wil::SelectObject(hdc.get(), bitmap.hBitmap.get());
+
+	std::fill_n(bitmap.bits, static_cast<size_t>(width) * height * 4, '\0');
+
+	const uint32_t xChars = width / CharWidth, yChars = height / CharHeight;
+	if (progress)
+		progress->Begin(yChars);
+	if (options.useGDIP)
+	{
+		GpDrawCharacters(hdc.get(), options.fonts, chars, xChars, yChars, options.replaceChars, progress);
+	}
+	else
+	{
+		DWriteDrawCharacters(hdc.get(), width, height, options.fonts, chars, xChars, yChars, options.replaceChars, options.fonts.EmSize(), progress);
+	}
+	ApplyGlyphEffects(bitmap.Image(), options.effects);
+
+#if 0
+	// image/png {557cf406-1a04-11d3-9a73-0000f81ef32e}
+	static const CLSID pngEncoderClsId = { 0x557cf406, 0x1a04, 0x11d3, { 0x9a, 0x73, 0x00, 0x00, 0xf8, 0x1e, 0xf3, 0x2e } };
+	Gp::Bitmap(width, height, width * 4, PixelFormat32bppPARGB, bitmap.bits).Save(L"font_chs.png", &pngEncoderClsId);
+#endif
+
+	TraceAllocations();
+	return bitmap;
+}
+
+// Recompresses only the 4x4 blocks that overlap rect, in place
+void CompressCharsRegion(const DirectX::Image& img, RECT rect, DirectX::ScratchImage& dxt5Img, Bc3Quality quality = Bc3Quality::Default, Bc3BlockMemo* memo = nullptr)
+{
+	TRACE_SCOPE("bc3 compress region");
+	const size_t left = static_cast<size_t>(rect.left) & ~size_t(3), top = static_cast<size_t>(rect.top) & ~size_t(3);
+	const size_t right = std::min((static_cast<size_t>(rect.right) + 3) & ~size_t(3), img.width);
+	const size_t bottom = std::min((static_cast<size_t>(rect.bottom) + 3) & ~size_t(3), img.height);
+	if (left >= right || top >= bottom)
+		return;
+	EncodeBc3Region(img, left, top, right, bottom, quality, dxt5Img, memo);
+}
+
+// The default quality without progress or memo is one parallel DirectXTex call, the path every
+// generation takes unless asked otherwise. Otherwise the image is compressed in bands, counted by
+// progress and cancelled between bands if it is given. With memo, the bands share it so each
+// distinct block is encoded about once; only callers that pass one (watch, quality) use it.
+DirectX::ScratchImage CompressCharsImage(const DirectX::Image& img, Bc3Quality quality = Bc3Quality::Default, JobProgress* progress = nullptr, Bc3BlockMemo* memo = nullptr)
+{
+	TRACE_SCOPE("bc3 compress");
+	DirectX::ScratchImage dxt5Img;
+	if (!progress && !memo && quality == Bc3Quality::Default)
+	{
+		THROW_IF_FAILED(DirectX::Compress(img, DXGI_FORMAT_BC3_UNORM, DirectX::TEX_COMPRESS_PARALLEL, DirectX::TEX_THRESHOLD_DEFAULT, dxt5Img));
+	}
+	else
+	{
+		constexpr size_t BandHeight = 64;
+		THROW_IF_FAILED(dxt5Img.Initialize2D(DXGI_FORMAT_BC3_UNORM, img.width, img.height, 1, 1));
+		const size_t bands = (img.height + BandHeight - 1) / BandHeight;
+		if (progress)
+			progress->Begin(bands);
+		ParallelFor(bands, [&](size_t band, size_t) {
+			if (progress)
+				progress->Check();
+			const auto top = static_cast<LONG>(band * BandHeight);
+			CompressCharsRegion(img, { 0, top, static_cast<LONG>(img.width), static_cast<LONG>(std::min(img.height, (band + 1) * BandHeight)) }, dxt5Img, quality, memo);
+			if (progress)
+				progress->Advance();
+		});
+	}
+	if (memo)
+	{
+		TraceCounter("bc3 memo lookups", static_cast<int64_t>(memo->Lookups()));
+		TraceCounter("bc3 memo hits", static_cast<int64_t>(memo->Hits()));
+	}
+	TraceAllocations();
+	return dxt5Img;
+}
+
+// The alpha of [left, right) x [top, bottom) of img, a BGRA atlas, into the same pixels of plane,
+// 16 pixels at a time
+void ExtractCoverageRegion(const DirectX::Image& img, size_t left, size_t top, size_t right, size_t bottom, const DirectX::Image& plane)
+{
+	for (size_t y = top; y < bottom; ++y)
+	{
+		const auto src = reinterpret_cast<const uint32_t*>(img.pixels + y * img.rowPitch);
+		const auto dst = plane.pixels + y * plane.rowPitch;
+		size_t x = left;
+		for (; x + 16 <= right; x += 16)
+		{
+			const auto p = reinterpret_cast<const __m128i*>(src + x);
+			const __m128i a0 = _mm_srli_epi32(_mm_loadu_si128(p), 24), a1 = _mm_srli_epi32(_mm_loadu_si128(p + 1), 24);
+			const __m128i a2 = _mm_srli_epi32(_mm_loadu_si128(p + 2), 24), a3 = _mm_srli_epi32(_mm_loadu_si128(p + 3), 24);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_packus_epi16(_mm_packs_epi32(a0, a1), _mm_packs_epi32(a2, a3)));
+		}
+		for (; x < right; ++x)
+			dst[x] = static_cast<uint8_t>(src[x] >> 24);
+	}
+}
+
+// img as a font_chs texture in format. DXT5 is CompressCharsImage, A8 and L8 copy the coverage
+// in bands the same way, so progress and cancellation behave alike.
+DirectX::ScratchImage EncodeCharsImage(const DirectX::Image& img, AtlasFormat format, Bc3Quality quality = Bc3Quality::Default, JobProgress* progress = nullptr, Bc3BlockMemo* memo = nullptr)
+{
+	if (format == AtlasFormat::Dxt5)
+		return CompressCharsImage(img, quality, progress, memo);
+
+	TRACE_SCOPE("coverage copy");
+	constexpr size_t BandHeight = 64;
+	DirectX::ScratchImage plane;
+	THROW_IF_FAILED(plane.Initialize2D(ToDxgiFormat(format), img.width, img.height, 1, 1));
+	const auto dst = plane.GetImage(0, 0, 0);
+	const size_t bands = (img.height + BandHeight - 1) / BandHeight;
+	if (progress)
+		progress->Begin(bands);
+	ParallelFor(bands, [&](size_t band, size_t) {
+		if (progress)
+			progress->Check();
+		ExtractCoverageRegion(img, 0, band * BandHeight, img.width, std::min(img.height, (band + 1) * BandHeight), *dst);
+		if (progress)
+			progress->Advance();
+	});
+	return plane;
+}
+
+// Updates the part of encoded, made by EncodeCharsImage, that rect of img covers
+void EncodeCharsRegion(const DirectX::Image& img, RECT rect, DirectX::ScratchImage& encoded, Bc3Quality quality = Bc3Quality::Default, Bc3BlockMemo* memo = nullptr)
+{
+	if (encoded.GetMetadata().format == DXGI_FORMAT_BC3_UNORM)
+	{
+		CompressCharsRegion(img, rect, encoded, quality, memo);
+		return;
+	}
+
+	const size_t left = static_cast<size_t>(rect.left), top = static_cast<size_t>(rect.top);
+	const size_t right = std::min(static_cast<size_t>(rect.right), img.width), bottom = std::min(static_cast<size_t>(rect.bottom), img.height);
+	if (left < right && top < bottom)
+		ExtractCoverageRegion(img, left, top, right, bottom, *encoded.GetImage(0, 0, 0));
+}
+
+DirectX::ScratchImage GenerateCharsImage(const GenerateOptions& options, std::u32string_view chars)
+{
+	auto bitmap = RenderCharsBitmap(options, chars);
+	return EncodeCharsImage(bitmap.Image(), options.format, options.quality);
+}
+
+// A decoded fonts.wtd, kept unmodified so it can be patched any number of times
+struct SourceResource
+{
+	RageUtil::RSC5::Header header;
+	std::unique_ptr<uint8_t[]> data;
+	size_t size;
+};
+
+SourceResource ReadWTD(FileRange& file)
+{
+	TRACE_SCOPE("read fonts.wtd");
+	auto [header, data] = RageUtil::RSC5::ReadFromFile(file);
+	const size_t size = static_cast<size_t>(header.flags.GetVirtualSize()) + header.flags.GetPhysicalSize();
+	return { header, std::move(data), size };
+}
+
+// From a file already read, e.g. by ReadFilesOverlapped
+SourceResource ReadWTD(std::span<const uint8_t> file)
+{
+	TRACE_SCOPE("read fonts.wtd");
+	MemoryInput input(file);
+	auto [header, data] = RageUtil::RSC5::ReadFromFile(input);
+	const size_t size = static_cast<size_t>(header.flags.GetVirtualSize()) + header.flags.GetPhysicalSize();
+	return { header, std::move(data), size };
+}
+
+SourceResource ReadWTD(const fs::path& path)
+{
+	wil::unique_hfile hFile(CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+	THROW_LAST_ERROR_IF(!hFile);
+	FileRange file(hFile.get());
+	return ReadWTD(file);
+}
+
+// What ReadWTD allocates for path, from its RSC5 header alone
+uint64_t ReadWTDDecodedSize(const fs::path& path)
+{
+	wil::unique_hfile hFile(CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+	THROW_LAST_ERROR_IF(!hFile);
+	RageUtil::RSC5::Header header;
+	FileRange(hFile.get()).ReadCheckSize(&header, sizeof(header));
+	THROW_HR_IF(E_INVALIDARG, header.magic != RageUtil::RSC5::Header::MagicValue);
+	return static_cast<uint64_t>(header.flags.GetVirtualSize()) + header.flags.GetPhysicalSize();
+}
+
+// A copy of source with font_chs replaced or inserted, laid out in blockList and ready to be written.
+// The dictionary uses the calling thread's segments, so it must stay on the thread that created it.
+class WtdPatch
+{
+public:
+	WtdPatch(const SourceResource& source, const DirectX::ScratchImage& image) : header(source.header)
+	{
+		TRACE_SCOPE("dictionary patch");
+		// What the games can load as font_chs: one level of TextureWidth x TextureHeight, DXT5, A8 or L8
+		const auto& metadata = image.GetMetadata();
+		const auto pixelFormat = RageUtil::ToD3dFormat(metadata.format);
+		THROW_HR_IF_MSG(HRESULT_FROM_WIN32(ERROR_INVALID_PIXEL_FORMAT), !IsFontChsFormat(pixelFormat), "font_chs can't be DXGI format %u", static_cast<uint32_t>(metadata.format));
+		THROW_HR_IF_MSG(E_INVALIDARG, metadata.width != TextureWidth || metadata.height != TextureHeight || metadata.mipLevels != 1,
+			"font_chs is %zux%zu with %zu levels, expected %ux%u with 1", metadata.width, metadata.height, metadata.mipLevels, TextureWidth, TextureHeight);
+
+		m_data = std::make_unique_for_overwrite<uint8_t[]>(source.size);
+		std::copy_n(source.data.get(), source.size, m_data.get());
+		const RageUtil::TextureDictionaryView view(m_data.get(), header);
+		THROW_HR_IF_MSG(HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT), view.Textures().empty(), "the dictionary has no texture to base font_chs on");
+
+		RageUtil::s_virtual = { m_data.get(), header.flags.GetVirtualSize() };
+		RageUtil::s_physical = { m_data.get() + RageUtil::s_virtual.size(), header.flags.GetPhysicalSize() };
+		auto resetOnFailure = wil::scope_exit([] { ResetSegments(); });
+
+		auto dict = reinterpret_cast<RageUtil::pgDictionary<RageUtil::grcTexturePC>*>(m_data.get());
+
+		auto hash = RageUtil::HashString("font_chs");
+
+		m_texture = *view.Textures()[0].texture; // copy
+		m_texture.name.Set("pack:/font_chs.dds");
+		m_texture.width = TextureWidth;
+		m_texture.height = TextureHeight;
+		m_texture.pixelFormat = pixelFormat;
+		m_texture.stride = TextureWidth; // A byte per pixel in each of the formats
+		// DXT5 keeps the level count of the texture it is copied from, as it always has. The 8-bit
+		// formats are new, so they state their single level rather than inherit one.
+		if (pixelFormat != D3DFMT_DXT5)
+			m_texture.levels = 1;
+		m_texture.next = 0;
+		m_texture.prev = 0;
+		m_texture.pixelData.Set(image.GetPixels());
+
+		if (auto existing = view.Find(hash))
+		{
+			auto ptr = dict->values.data.Get() + (existing - view.Textures().data());
+			ptr->Set(&m_texture);
+		}
+		else
+		{
+			m_containers = dict->Insert(hash, &m_texture);
+		}
+
+		blockList.AppendVirtual(dict, sizeof(*dict), nullptr);
+		dict->DumpToMemory(blockList);
+		resetOnFailure.release();
+	}
+
+	~WtdPatch() { ResetSegments(); }
+
+	WtdPatch(const WtdPatch&) = delete;
+	WtdPatch& operator=(const WtdPatch&) = delete;
+
+	// Written next to out and renamed over it, so a failed or cancelled write leaves out as it was.
+	// progress, if given, counts uncompressed bytes.
+	void Write(const fs::path& out, JobProgress* progress = nullptr)
+	{
+		TRACE_SCOPE("write fonts.wtd");
+		const auto temp = TempPathFor(out);
+		{
+			wil::unique_hfile hFile(CreateFileW(temp.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+			THROW_LAST_ERROR_IF(!hFile);
+			auto removeTemp = wil::scope_exit([&] {
+				hFile.reset();
+				DeleteFileW(temp.c_str());
+			});
+
+			RageUtil::RSC5::DumpToFile(hFile.get(), header, blockList, progress);
+			removeTemp.release();
+		}
+		if (!MoveFileExW(temp.c_str(), out.c_str(), MOVEFILE_REPLACE_EXISTING))
+		{
+			const auto error = GetLastError();
+			DeleteFileW(temp.c_str());
+			THROW_WIN32(error);
+		}
+		TraceAllocations();
+	}
+
+	// The resource as it would be written, for containers like IMG archives
+	std::vector<uint8_t> Serialize(JobProgress* progress = nullptr)
+	{
+		TRACE_SCOPE("serialize fonts.wtd");
+		MemoryOutput out;
+		RageUtil::RSC5::DumpTo(out, header, blockList, progress);
+		return std::move(out.data);
+	}
+
+	RageUtil::RSC5::Header header;
+	RageUtil::RSC5::BlockList blockList;
+
+private:
+	static void ResetSegments()
+	{
+		RageUtil::s_virtual = {};
+		RageUtil::s_physical = {};
+		RageUtil::s_ptrTable.clear();
+	}
+
+	std::unique_ptr<uint8_t[]> m_data;
+	RageUtil::grcTexturePC m_texture;
+	RageUtil::pgDictionary<RageUtil::grcTexturePC>::TContainer m_containers;
+};
+
+void PatchWTD(const SourceResource& source, const fs::path& out, const DirectX::ScratchImage& image)
+{
+	WtdPatch patch(source, image);
+	patch.Write(out);
+}
+
+// A copy of the font_chs texture data in a decoded fonts.wtd, empty if it has none
+std::vector<uint8_t> ReadFontChsPixels(const SourceResource& source)
+{
+	const RageUtil::TextureDictionaryView view(source.data.get(), source.header);
+	auto texture = view.Find(RageUtil::HashString("font_chs"));
+	if (!texture)
+		return {};
+
+	THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_INVALID_PIXEL_FORMAT), !IsFontChsFormat(texture->texture->pixelFormat));
+	size_t rowPitch, slicePitch;
+	THROW_IF_FAILED(DirectX::ComputePitch(texture->format, texture->texture->width, texture->texture->height, rowPitch, slicePitch));
+	return { texture->pixels.begin(), texture->pixels.begin() + slicePitch };
+}
+
+void CreateWTD(const fs::path& in, const fs::path& out, const DirectX::ScratchImage& image)
+{
+	PatchWTD(ReadWTD(in), out, image);
+}
+
+// Bytes a cache entry keeps alive, what SharedCache::Trim weighs entries by
+uint64_t CachedBytes(const CharTable& table) { return table.MemoryBytes(); }
+uint64_t CachedBytes(const SourceResource& source) { return source.size; }
+uint64_t CachedBytes(const DirectX::ScratchImage& image) { return image.GetPixelsSize(); }
+uint64_t CachedBytes(const std::vector<uint8_t>& bytes) { return bytes.size(); }
+
+// Loads each key once. Concurrent requests for a key that is being loaded wait for that load,
+// and a load that fails or is cancelled is not kept.
+// A request with a different version replaces the entry, e.g. after the file behind it changed.
+// Loaded entries are counted in bytes, and Trim drops the least recently used ones; requests
+// already holding an entry keep it alive until they let go.
+template<typename T>
+class SharedCache
+{
+public:
+	using Ptr = std::shared_ptr<const T>;
+
+	template<typename F>
+	Ptr Get(const std::wstring& key, F&& load, uint64_t version = 0)
+	{
+		std::promise<Ptr> promise;
+		std::shared_future<Ptr> future;
+		bool owner = false;
+		uint64_t loadId = 0;
+		{
+			std::lock_guard lock(m_lock);
+			auto [it, inserted] = m_entries.try_emplace(key);
+			if (inserted || it->second.version != version)
+			{
+				m_bytes -= it->second.bytes;
+				loadId = ++m_loads;
+				it->second = { version, loadId, promise.get_future().share() };
+				owner = true;
+				++m_misses;
+			}
+			else
+				++m_hits;
+			it->second.lastUse = ++m_uses;
+			future = it->second.future;
+		}
+
+		if (owner)
+		{
+			try
+			{
+				auto value = std::make_shared<T>(load());
+				const uint64_t bytes = CachedBytes(*value);
+				promise.set_value(std::move(value));
+
+				std::lock_guard lock(m_lock);
+				if (auto it = m_entries.find(key); it != m_entries.end() && it->second.loadId == loadId)
+				{
+					it->second.bytes = bytes;
+					m_bytes += bytes;
+				}
+			}
+			catch (...)
+			{
+				promise.set_exception(std::current_exception());
+
+				// Waiters already holding the future see the failure, later requests load again
+				std::lock_guard lock(m_lock);
+				if (auto it = m_entries.find(key); it != m_entries.end() && it->second.loadId == loadId)
+					m_entries.erase(it);
+			}
+		}
+		return future.get();
+	}
+
+	void Erase(const std::wstring& key)
+	{
+		std::lock_guard lock(m_lock);
+		if (auto it = m_entries.find(key); it != m_entries.end())
+		{
+			m_bytes -= it->second.bytes;
+			m_entries.erase(it);
+		}
+	}
+
+	void Clear()
+	{
+		std::lock_guard lock(m_lock);
+		m_entries.clear();
+		m_bytes = 0;
+	}
+
+	uint64_t Bytes()
+	{
+		std::lock_guard lock(m_lock);
+		return m_bytes;
+	}
+
+	// Drops loaded entries, least recently used first, until at most maxBytes are left. Entries
+	// still loading aren't counted yet and stay. Returns the bytes left.
+	uint64_t Trim(uint64_t maxBytes)
+	{
+		std::lock_guard lock(m_lock);
+		while (m_bytes > maxBytes)
+		{
+			auto oldest = m_entries.end();
+			for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+			{
+				if (it->second.bytes != 0 && (oldest == m_entries.end() || it->second.lastUse < oldest->second.lastUse))
+					oldest = it;
+			}
+			if (oldest == m_entries.end())
+				break;
+			m_bytes -= oldest->second.bytes;
+			m_entries.erase(oldest);
+		}
+		return m_bytes;
+	}
+
+	struct Stats
+	{
+		size_t entries;
+		uint64_t bytes;
+		uint64_t hits;
+		uint64_t misses;
+	};
+
+	Stats GetStats()
+	{
+		std::lock_guard lock(m_lock);
+		return { m_entries.size(), m_bytes, m_hits, m_misses };
+	}
+
+private:
+	struct Entry
+	{
+		uint64_t version;
+		uint64_t loadId;
+		std::shared_future<Ptr> future;
+		uint64_t bytes = 0; // Set once loaded
+		uint64_t lastUse = 0;
+	};
+
+	std::mutex m_lock;
+	std::unordered_map<std::wstring, Entry> m_entries;
+	uint64_t m_bytes = 0;
+	uint64_t m_uses = 0;
+	uint64_t m_hits = 0;
+	uint64_t m_misses = 0;
+	uint64_t m_loads = 0;
+};
+
+// Changes whenever the file is rewritten, used to notice stale cache entries
+uint64_t FileStamp(const fs::path& path)
+{
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	THROW_IF_WIN32_BOOL_FALSE(GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &data));
+	const uint64_t writeTime = (static_cast<uint64_t>(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime;
+	const uint64_t size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+	return writeTime ^ (size * 0x9E3779B97F4A7C15ull);
+}
+
+// Inputs and results shared by every job of a run, or by every request of the service
+struct GeneratorCaches
+{
+	SharedCache<CharTable> charTables;
+	SharedCache<SourceResource> sources;
+	SharedCache<DirectX::ScratchImage> images;
+
+	auto GetCharTable(const fs::path& path)
+	{
+		return charTables.Get(path.wstring(), [&] { return LoadCharTable(path); }, FileStamp(path));
+	}
+
+	auto GetSource(const fs::path& path)
+	{
+		return sources.Get(path.wstring(), [&] { return ReadWTD(path); }, FileStamp(path));
+	}
+
+	// generate(const CharTable&) makes the image on a miss
+	template<typename F>
+	auto GetImage(const GenerateOptions& options, const fs::path& charTablePath, F&& generate)
+	{
+		const auto key = std::format(L"{}|{}|{}|{}|{}|{}|{}", FontSetKey(options.fonts), options.useGDIP, options.replaceChars,
+			AtlasFormatName(options.format), Bc3QualityName(options.quality), GlyphEffectsKey(options.effects), charTablePath.wstring());
+		return images.Get(key, [&] { return generate(*GetCharTable(charTablePath)); }, FileStamp(charTablePath));
+	}
+
+	auto GetImage(const GenerateOptions& options, const fs::path& charTablePath)
+	{
+		return GetImage(options, charTablePath, [&](const CharTable& charTable) { return GenerateCharsImage(options, charTable.Chars()); });
+	}
+
+	uint64_t Bytes()
+	{
+		return charTables.Bytes() + sources.Bytes() + images.Bytes();
+	}
+
+	// Evicts down to maxBytes, images first, then the sources and char tables they are made from.
+	// Returns the bytes left.
+	uint64_t Trim(uint64_t maxBytes)
+	{
+		uint64_t held = Bytes();
+		auto trim = [&](auto& cache) {
+			if (held <= maxBytes)
+				return;
+			const uint64_t before = cache.Bytes();
+			held = held - before + cache.Trim(before - std::min(before, held - maxBytes));
+		};
+		trim(images);
+		trim(sources);
+		trim(charTables);
+		return held;
+	}
+};
@@ -55,7 +55,7 @@ auto CreateDIB(HDC hdc, LONG width, LONG height, WORD bitCount, void** bitmapBit
 	return wil::unique_hbitmap(CreateDIBSection(hdc, &bmi, DIB_RGB_COLORS, bitmapBits, nullptr, 0));
 }
 
-void GDIDrawCheckeredBackground(HDC hdc, LONG width, LONG height, uint32_t xChars, uint32_t yChars, COLORREF color1 = 0x202020, COLORREF color2 = 0x303030)
+void GDIDrawCheckeredBackground(HDC hdc, LONG width, LONG height, uint32_t xChars, uint32_t yChars, COLORREF color1 = 0x202020, COLORREF color2 = 0x303030, uint32_t cellWidth = CharWidth, uint32_t cellHeight = CharHeight)
 {
 	wil::unique_hbrush hBrush1(CreateSolidBrush(color1));
 	THROW_HR_IF(E_FAIL, !hBrush1);
@@ -68,10 +68,10 @@ void GDIDrawCheckeredBackground(HDC hdc, LONG width, LONG height, uint32_t xChar
 	{
 		for (uint32_t x = y % 2; x < xChars; x += 2)
 		{
-			fillRect.left = static_cast<LONG>(x * CharWidth);
-			fillRect.top = static_cast<LONG>(y * CharHeight);
-			fillRect.right = fillRect.left + CharWidth;
-			fillRect.bottom = fillRect.top + CharHeight;
+			fillRect.left = static_cast<LONG>(x * cellWidth);
+			fillRect.top = static_cast<LONG>(y * cellHeight);
+			fillRect.right = fillRect.left + cellWidth;
+			fillRect.bottom = fillRect.top + cellHeight;
 			FillRect(hdc, &fillRect, hBrush2.get());
 		}
 	}
@@ -102,16 +102,42 @@ wil::unique_hbitmap GDIScaleBitmap(HDC hdcRef, HDC hdcSrc, int width, int height
 	return hBitmapScale;
 }
 
-void GDIDrawCharacters(HDC hdc, std::wstring_view text, uint32_t xChars, uint32_t yChars)
+// image/png {557cf406-1a04-11d3-9a73-0000f81ef32e}
+static const CLSID PngEncoderClsId = { 0x557cf406, 0x1a04, 0x11d3, { 0x9a, 0x73, 0x00, 0x00, 0xf8, 0x1e, 0xf3, 0x2e } };
+
+std::vector<uint8_t> GpEncodePng(HBITMAP hBitmap)
 {
-	wil::unique_hfont hFont(CreateFontIndirectW(&g_font));
-	THROW_HR_IF(E_FAIL, !hFont);
+	Gp::Bitmap bitmap(hBitmap, nullptr);
+	THROW_IF_FAILED(HRESULT_FROM_GPSTATUS(bitmap.GetLastStatus()));
+
+	wil::com_ptr<IStream> stream;
+	THROW_IF_FAILED(CreateStreamOnHGlobal(nullptr, TRUE, &stream));
+	THROW_IF_FAILED(HRESULT_FROM_GPSTATUS(bitmap.Save(stream.get(), &PngEncoderClsId)));
+
+	HGLOBAL hGlobal;
+	THROW_IF_FAILED(GetHGlobalFromStream(stream.get(), &hGlobal));
+	STATSTG stat;
+	THROW_IF_FAILED(stream->Stat(&stat, STATFLAG_NONAME));
+
+	auto data = static_cast<const uint8_t*>(GlobalLock(hGlobal));
+	THROW_LAST_ERROR_IF_NULL(data);
+	std::vector<uint8_t> png(data, data + stat.cbSize.QuadPart);
+	GlobalUnlock(hGlobal);
+	return png;
+}
 
-	wil::unique_hfont hSymbolFont(CreateFontIndirectW(&g_symbolFont));
-	THROW_HR_IF(E_FAIL, !hSymbolFont);
+void GDIDrawCharacters(HDC hdc, const FontSet& fonts, std::u32string_view text, uint32_t xChars, uint32_t yChars)
+{
+	const auto assignment = ResolveFonts(fonts, text, false);
+	std::vector<wil::unique_hfont> hFonts;
+	for (size_t i = 0; i < fonts.Count(); ++i)
+	{
+		hFonts.emplace_back(CreateFontIndirectW(&fonts[i]));
+		THROW_HR_IF(E_FAIL, !hFonts.back());
+	}
 
-	auto select = wil::SelectObject(hdc, hFont.get());
-	bool symbolFontSelected = false;
+	auto select = wil::SelectObject(hdc, hFonts[0].get());
+	uint8_t selectedFont = 0;
 
 	SetBkMode(hdc, TRANSPARENT);
 	SetTextColor(hdc, 0xffffff);
@@ -119,13 +145,14 @@ void GDIDrawCharacters(HDC hdc, std::wstring_view text, uint32_t xChars, uint32_
 	size_t i = 0;
 	for (uint32_t y = 0; y < yChars; ++y)
 	{
+		TRACE_SCOPE("render row");
 		for (uint32_t x = 0; x < xChars && i < text.size(); ++x, ++i)
 		{
-			bool isSymbol = !IsWCharInRanges(NonSymbolRange, text[i]);
-			if (isSymbol != symbolFontSelected)
+			TRACE_SCOPE("glyph");
+			if (assignment.fontOf[i] != selectedFont)
 			{
-				SelectObject(hdc, isSymbol ? hSymbolFont.get() : hFont.get());
-				symbolFontSelected = isSymbol;
+				selectedFont = assignment.fontOf[i];
+				SelectObject(hdc, hFonts[selectedFont].get());
 			}
 
 			RECT rect;
@@ -134,27 +161,38 @@ void GDIDrawCharacters(HDC hdc, std::wstring_view text, uint32_t xChars, uint32_
 			rect.right = rect.left + CharWidth;
 			rect.bottom = rect.top + CharHeight;
 
-			DrawTextW(hdc, &text[i], 1, &rect, DT_CENTER | DT_NOPREFIX | DT_SINGLELINE | DT_BOTTOM);
+			wchar_t buf[2];
+			DrawTextW(hdc, buf, static_cast<int>(EncodeUtf16(text[i], buf)), &rect, DT_CENTER | DT_NOPREFIX | DT_SINGLELINE | DT_BOTTOM);
 		}
 	}
 }
 
-void GpDrawCharacters(HDC hdc, std::wstring_view text, uint32_t xChars, uint32_t yChars, bool replaceChars)
+// progress, if given, advances by one per row and cancels between rows. transform, if given,
+// maps the full size grid onto hdc, and glyphs are drawn at the size it scales them to. Glyphs
+// are cut at their cell unless clip is false.
+void GpDrawCharacters(HDC hdc, const FontSet& fonts, std::u32string_view text, uint32_t xChars, uint32_t yChars, bool replaceChars, JobProgress* progress = nullptr, const Gp::Matrix* transform = nullptr, bool clip = true)
 {
 	Gp::Graphics graphics(hdc);
 	THROW_IF_FAILED(HRESULT_FROM_GPSTATUS(graphics.GetLastStatus()));
+	if (transform)
+		THROW_IF_FAILED(HRESULT_FROM_GPSTATUS(graphics.SetTransform(transform)));
 	THROW_IF_FAILED(HRESULT_FROM_GPSTATUS(graphics.SetSmoothingMode(Gp::SmoothingModeHighQuality)));
 	THROW_IF_FAILED(HRESULT_FROM_GPSTATUS(graphics.SetTextRenderingHint(Gp::TextRenderingHintAntiAliasGridFit)));
 
-	Gp::Font font(hdc, &g_font);
-	THROW_IF_FAILED(HRESULT_FROM_GPSTATUS(font.GetLastStatus()));
-	Gp::Font symbolFont(hdc, &g_symbolFont);
-	THROW_IF_FAILED(HRESULT_FROM_GPSTATUS(symbolFont.GetLastStatus()));
+	const auto assignment = ResolveFonts(fonts, text, replaceChars);
+	std::vector<std::unique_ptr<Gp::Font>> gpFonts;
+	for (size_t i = 0; i < fonts.Count(); ++i)
+	{
+		gpFonts.push_back(std::make_unique<Gp::Font>(hdc, &fonts[i]));
+		THROW_IF_FAILED(HRESULT_FROM_GPSTATUS(gpFonts.back()->GetLastStatus()));
+	}
 
 	Gp::StringFormat format;
 	THROW_IF_FAILED(HRESULT_FROM_GPSTATUS(format.GetLastStatus()));
 	THROW_IF_FAILED(HRESULT_FROM_GPSTATUS(format.SetAlignment(Gp::StringAlignmentCenter)));
 	THROW_IF_FAILED(HRESULT_FROM_GPSTATUS(format.SetLineAlignment(Gp::StringAlignmentCenter)));
+	if (!clip)
+		THROW_IF_FAILED(HRESULT_FROM_GPSTATUS(format.SetFormatFlags(Gp::StringFormatFlagsNoClip)));
 
 	Gp::SolidBrush brush(0xffffffff);
 	THROW_IF_FAILED(HRESULT_FROM_GPSTATUS(brush.GetLastStatus()));
@@ -162,38 +200,116 @@ void GpDrawCharacters(HDC hdc, std::wstring_view text, uint32_t xChars, uint32_t
 	size_t i = 0;
 	for (uint32_t y = 0; y < yChars; ++y)
 	{
+		TRACE_SCOPE("render row");
 		for (uint32_t x = 0; x < xChars && i < text.size(); ++x, ++i)
 		{
+			TRACE_SCOPE("glyph");
 			while (i < text.size() && IgnoreSet.contains(text[i]))
 				++i;
-
-			bool isSymbol = !IsWCharInRanges(NonSymbolRange, text[i]);
+			if (i == text.size())
+				break;
 
 			Gp::RectF rect(static_cast<Gp::REAL>(x * CharWidth), static_cast<Gp::REAL>(y * CharHeight), CharWidth, CharHeight);
 
-			wchar_t ch = text[i];
-			if (replaceChars)
-			{
-				if (auto it = ReplaceMap.find(ch); it != ReplaceMap.end())
-					ch = it->second;
-			}
-
-			graphics.DrawString(&ch, 1, isSymbol ? &symbolFont : &font, rect, &format, &brush);
+			wchar_t buf[2];
+			graphics.DrawString(buf, static_cast<INT>(EncodeUtf16(DrawnChar(text[i], replaceChars), buf)), gpFonts[assignment.fontOf[i]].get(), rect, &format, &brush);
 		}
+
+		if (progress)
+			progress->Advance();
+	}
+}
+
+// IDWriteTextFormat is immutable, so formats are created once and shared between renders and threads
+struct TextFormatCache
+{
+	std::mutex lock;
+	std::map<std::tuple<std::wstring, LONG, float>, wil::com_ptr<IDWriteTextFormat>> formats;
+};
+
+TextFormatCache& GetTextFormatCache()
+{
+	static TextFormatCache s_cache;
+	return s_cache;
+}
+
+wil::com_ptr<IDWriteTextFormat> GetTextFormat(const LOGFONTW& lf, float fontSize)
+{
+	auto& cache = GetTextFormatCache();
+	auto key = std::make_tuple(std::wstring(lf.lfFaceName), lf.lfWeight, fontSize);
+	std::lock_guard lock(cache.lock);
+	auto& textFormat = cache.formats[key];
+	if (!textFormat)
+	{
+		THROW_IF_FAILED(g_dwriteFactory->CreateTextFormat(lf.lfFaceName, nullptr, static_cast<DWRITE_FONT_WEIGHT>(lf.lfWeight), DWRITE_FONT_STYLE_NORMAL, DWRITE_FONT_STRETCH_NORMAL, fontSize, L"", &textFormat));
+		THROW_IF_FAILED(textFormat->SetTextAlignment(DWRITE_TEXT_ALIGNMENT_CENTER));
+		THROW_IF_FAILED(textFormat->SetParagraphAlignment(DWRITE_PARAGRAPH_ALIGNMENT_FAR));
 	}
+	return textFormat;
 }
 
-void DWriteDrawCharacters(ID2D1RenderTarget* renderTarget, std::wstring_view text, uint32_t xChars, uint32_t yChars, bool replaceChars, float fontSize = 58.0f)
+// Picks up font files that were installed, removed or rewritten since the formats and coverage were loaded
+void RefreshFonts()
 {
-	wil::com_ptr<IDWriteTextFormat> textFormat;
-	THROW_IF_FAILED(g_dwriteFactory->CreateTextFormat(g_font.lfFaceName, nullptr, static_cast<DWRITE_FONT_WEIGHT>(g_font.lfWeight), DWRITE_FONT_STYLE_NORMAL, DWRITE_FONT_STRETCH_NORMAL, fontSize, L"", &textFormat));
-	THROW_IF_FAILED(textFormat->SetTextAlignment(DWRITE_TEXT_ALIGNMENT_CENTER));
-	THROW_IF_FAILED(textFormat->SetParagraphAlignment(DWRITE_PARAGRAPH_ALIGNMENT_FAR));
+	auto& cache = GetTextFormatCache();
+	std::lock_guard lock(cache.lock);
+	wil::com_ptr<IDWriteFontCollection> collection;
+	THROW_IF_FAILED(g_dwriteFactory->GetSystemFontCollection(&collection, TRUE));
+	cache.formats.clear();
+
+	auto& coverageCache = GetFontCoverageCache();
+	std::lock_guard coverageLock(coverageCache.lock);
+	coverageCache.coverage.clear();
+}
 
-	wil::com_ptr<IDWriteTextFormat> symbolTextFormat;
-	THROW_IF_FAILED(g_dwriteFactory->CreateTextFormat(g_symbolFont.lfFaceName, nullptr, static_cast<DWRITE_FONT_WEIGHT>(g_symbolFont.lfWeight), DWRITE_FONT_STYLE_NORMAL, DWRITE_FONT_STRETCH_NORMAL, fontSize, L"", &symbolTextFormat));
-	THROW_IF_FAILED(symbolTextFormat->SetTextAlignment(DWRITE_TEXT_ALIGNMENT_CENTER));
-	THROW_IF_FAILED(symbolTextFormat->SetParagraphAlignment(DWRITE_PARAGRAPH_ALIGNMENT_FAR));
+// The files DirectWrite loads lf from, fonts that are not local files are skipped
+std::vector<fs::path> GetFontFilePaths(const LOGFONTW& lf)
+{
+	wil::com_ptr<IDWriteGdiInterop> interop;
+	THROW_IF_FAILED(g_dwriteFactory->GetGdiInterop(&interop));
+	wil::com_ptr<IDWriteFont> font;
+	THROW_IF_FAILED(interop->CreateFontFromLOGFONT(&lf, &font));
+	wil::com_ptr<IDWriteFontFace> fontFace;
+	THROW_IF_FAILED(font->CreateFontFace(&fontFace));
+
+	UINT32 count = 0;
+	THROW_IF_FAILED(fontFace->GetFiles(&count, nullptr));
+	std::vector<IDWriteFontFile*> rawFiles(count);
+	THROW_IF_FAILED(fontFace->GetFiles(&count, rawFiles.data()));
+	std::vector<wil::com_ptr<IDWriteFontFile>> files;
+	for (auto file : rawFiles)
+		files.emplace_back().attach(file);
+
+	std::vector<fs::path> paths;
+	for (const auto& file : files)
+	{
+		const void* key;
+		UINT32 keySize;
+		THROW_IF_FAILED(file->GetReferenceKey(&key, &keySize));
+		wil::com_ptr<IDWriteFontFileLoader> loader;
+		THROW_IF_FAILED(file->GetLoader(&loader));
+		auto localLoader = loader.try_query<IDWriteLocalFontFileLoader>();
+		if (!localLoader)
+			continue;
+
+		UINT32 length;
+		THROW_IF_FAILED(localLoader->GetFilePathLengthFromKey(key, keySize, &length));
+		std::wstring path(length + 1, L'\0');
+		THROW_IF_FAILED(localLoader->GetFilePathFromKey(key, keySize, path.data(), length + 1));
+		path.resize(length);
+		paths.emplace_back(std::move(path));
+	}
+	return paths;
+}
+
+// progress, if given, advances by one per row and cancels between rows. Each row is flushed
+// first, otherwise Direct2D would batch all the drawing into EndDraw.
+void DWriteDrawCharacters(ID2D1RenderTarget* renderTarget, const FontSet& fonts, std::u32string_view text, uint32_t xChars, uint32_t yChars, bool replaceChars, float fontSize = 58.0f, JobProgress* progress = nullptr)
+{
+	const auto assignment = ResolveFonts(fonts, text, replaceChars);
+	std::vector<wil::com_ptr<IDWriteTextFormat>> textFormats;
+	for (size_t i = 0; i < fonts.Count(); ++i)
+		textFormats.push_back(GetTextFormat(fonts[i], fontSize));
 
 	wil::com_ptr<ID2D1SolidColorBrush> brush;
 	THROW_IF_FAILED(renderTarget->CreateSolidColorBrush(D2D1::ColorF(0xffffff), &brush));
@@ -201,12 +317,14 @@ void DWriteDrawCharacters(ID2D1RenderTarget* renderTarget, std::wstring_view tex
 	size_t i = 0;
 	for (uint32_t y = 0; y < yChars; ++y)
 	{
+		TRACE_SCOPE("render row");
 		for (uint32_t x = 0; x < xChars && i < text.size(); ++x, ++i)
 		{
+			TRACE_SCOPE("glyph");
 			while (i < text.size() && IgnoreSet.contains(text[i]))
 				++i;
-
-			bool isSymbol = !IsWCharInRanges(NonSymbolRange, text[i]);
+			if (i == text.size())
+				break;
 
 			D2D1_RECT_F rect;
 			rect.left = static_cast<float>(x * CharWidth);
@@ -214,19 +332,19 @@ void DWriteDrawCharacters(ID2D1RenderTarget* renderTarget, std::wstring_view tex
 			rect.right = rect.left + CharWidth;
 			rect.bottom = rect.top + CharHeight;
 
-			wchar_t ch = text[i];
-			if (replaceChars)
-			{
-				if (auto it = ReplaceMap.find(ch); it != ReplaceMap.end())
-					ch = it->second;
-			}
+			wchar_t buf[2];
+			renderTarget->DrawText(buf, EncodeUtf16(DrawnChar(text[i], replaceChars), buf), textFormats[assignment.fontOf[i]].get(), rect, brush.get());
+		}
 
-			renderTarget->DrawText(&ch, 1, isSymbol ? symbolTextFormat.get() : textFormat.get(), rect, brush.get());
+		if (progress)
+		{
+			THROW_IF_FAILED(renderTarget->Flush());
+			progress->Advance();
 		}
 	}
 }
 
-void DWriteDrawCharacters(HDC hdc, LONG width, LONG height, std::wstring_view text, uint32_t xChars, uint32_t yChars, bool replaceChars, float fontSize = 58.0f)
+void DWriteDrawCharacters(HDC hdc, LONG width, LONG height, const FontSet& fonts, std::u32string_view text, uint32_t xChars, uint32_t yChars, bool replaceChars, float fontSize = 58.0f, JobProgress* progress = nullptr)
 {
 	wil::com_ptr<ID2D1DCRenderTarget> dcRenderTarget;
 	D2D1_RENDER_TARGET_PROPERTIES props = {
@@ -245,6 +363,6 @@ void DWriteDrawCharacters(HDC hdc, LONG width, LONG height, std::wstring_view te
 	THROW_IF_FAILED(dcRenderTarget->BindDC(hdc, &rect));
 
 	dcRenderTarget->BeginDraw();
-	DWriteDrawCharacters(dcRenderTarget.get(), text, xChars, yChars, replaceChars, fontSize);
-	dcRenderTarget->EndDraw();
+	auto endDraw = wil::scope_exit([&] { dcRenderTarget->EndDraw(); });
+	DWriteDrawCharacters(dcRenderTarget.get(), fonts, text, xChars, yChars, replaceChars, fontSize, progress);
 }
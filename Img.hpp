@@ -0,0 +1,177 @@
+#pragma once
+
+// GTA IV IMG (version 3) archives. Entries are stored in 2048 byte blocks, and a resource
+// entry holds the same bytes as the loose file, RSC5 header included. Only archives with a
+// plain table of contents are supported; the game's own archives encrypt it.
+
+struct ImgHeader
+{
+	static constexpr uint32_t MagicValue = 0xA94E2A52;
+	static constexpr uint32_t Version3 = 3;
+
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entryCount;
+	uint32_t tableSize; // Entries and names
+	uint16_t entrySize;
+	uint16_t unknown;
+};
+static_assert(sizeof(ImgHeader) == 20);
+
+struct ImgEntry
+{
+	static constexpr uint64_t BlockSize = 2048;
+
+	uint32_t sizeOrFlags; // RSC5 flags for resources, the size otherwise
+	uint32_t resourceType; // 0 if not a resource
+	uint32_t offsetBlock;
+	uint16_t usedBlocks;
+	uint16_t flags; // Low 11 bits: padding in the last block
+
+	uint64_t Offset() const { return offsetBlock * BlockSize; }
+	uint64_t Size() const { return usedBlocks * BlockSize - (flags & 0x7FF); }
+};
+static_assert(sizeof(ImgEntry) == 16);
+
+class ImgArchive
+{
+public:
+	ImgArchive(const fs::path& path, bool writable)
+	{
+		m_file.reset(CreateFileW(path.c_str(), GENERIC_READ | (writable ? GENERIC_WRITE : 0), FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+		THROW_LAST_ERROR_IF(!m_file);
+
+		FileRange file(m_file.get());
+		file.ReadCheckSize(&m_header, sizeof(m_header));
+		THROW_HR_IF_MSG(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED), m_header.magic != ImgHeader::MagicValue, "%ls is encrypted or not an IMG archive", path.c_str());
+		THROW_HR_IF_MSG(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED), m_header.version != ImgHeader::Version3 || m_header.entrySize != sizeof(ImgEntry), "%ls is not a version 3 IMG archive", path.c_str());
+		THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT), static_cast<uint64_t>(m_header.entryCount) * sizeof(ImgEntry) > m_header.tableSize);
+
+		m_entries.resize(m_header.entryCount);
+		file.ReadCheckSize(m_entries.data(), static_cast<DWORD>(m_entries.size() * sizeof(ImgEntry)));
+
+		std::string names(m_header.tableSize - m_entries.size() * sizeof(ImgEntry), '\0');
+		file.ReadCheckSize(names.data(), static_cast<DWORD>(names.size()));
+		m_names = SplitNames(names, m_entries.size());
+	}
+
+	size_t Count() const { return m_entries.size(); }
+	const ImgEntry& Entry(size_t index) const { return m_entries[index]; }
+	const std::string& Name(size_t index) const { return m_names[index]; }
+
+	// Case insensitive, npos if there is no such entry
+	size_t Find(std::string_view name) const
+	{
+		for (size_t i = 0; i < m_names.size(); ++i)
+		{
+			if (CompareStringOrdinal(Utf8ToUtf16(m_names[i]).c_str(), -1, Utf8ToUtf16(name).c_str(), -1, TRUE) == CSTR_EQUAL)
+				return i;
+		}
+		return std::string_view::npos;
+	}
+
+	FileRange Open(size_t index) const
+	{
+		const auto& entry = m_entries[index];
+		return FileRange(m_file.get(), entry.Offset(), entry.Size());
+	}
+
+	// Rewrites one entry in new blocks at the end of the archive, flushed before the table entry
+	// points at them, so an interrupted write leaves the old entry intact. With inPlace, data that
+	// fits the entry's own blocks overwrites them instead; that keeps the archive from growing but
+	// a failure halfway leaves the entry corrupt. Returns whether the entry moved.
+	bool Replace(size_t index, std::span<const uint8_t> data, uint32_t sizeOrFlags, bool inPlace = false)
+	{
+		TRACE_SCOPE("img replace");
+		auto entry = m_entries[index];
+		const uint64_t blocks = (data.size() + ImgEntry::BlockSize - 1) / ImgEntry::BlockSize;
+		THROW_HR_IF(E_BOUNDS, blocks > UINT16_MAX);
+
+		const bool fits = inPlace && blocks <= entry.usedBlocks;
+		const uint64_t offsetBlock = fits ? entry.offsetBlock : EndBlock();
+		THROW_HR_IF(E_BOUNDS, offsetBlock > UINT32_MAX);
+
+		FileRange out(m_file.get(), offsetBlock * ImgEntry::BlockSize, blocks * ImgEntry::BlockSize);
+		out.Write(data.data(), data.size());
+		const std::vector<uint8_t> padding(blocks * ImgEntry::BlockSize - data.size());
+		out.Write(padding.data(), padding.size());
+		THROW_IF_WIN32_BOOL_FALSE(FlushFileBuffers(m_file.get()));
+
+		entry.sizeOrFlags = sizeOrFlags;
+		entry.offsetBlock = static_cast<uint32_t>(offsetBlock);
+		entry.usedBlocks = static_cast<uint16_t>(blocks);
+		entry.flags = static_cast<uint16_t>((entry.flags & ~0x7FF) | padding.size());
+		FileRange table(m_file.get(), sizeof(ImgHeader) + index * sizeof(ImgEntry), sizeof(ImgEntry));
+		table.Write(&entry, sizeof(entry));
+		THROW_IF_WIN32_BOOL_FALSE(FlushFileBuffers(m_file.get()));
+
+		m_entries[index] = entry;
+		return !fits;
+	}
+
+private:
+	static std::vector<std::string> SplitNames(std::string_view names, size_t count)
+	{
+		std::vector<std::string> result;
+		result.reserve(count);
+		while (result.size() < count)
+		{
+			const auto end = names.find('\0');
+			THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT), end == names.npos);
+			result.emplace_back(names.substr(0, end));
+			names.remove_prefix(end + 1);
+		}
+		return result;
+	}
+
+	// The first block after every entry and the table
+	uint64_t EndBlock() const
+	{
+		LARGE_INTEGER size;
+		THROW_IF_WIN32_BOOL_FALSE(GetFileSizeEx(m_file.get(), &size));
+		uint64_t end = static_cast<uint64_t>(size.QuadPart);
+		end = std::max<uint64_t>(end, sizeof(ImgHeader) + m_header.tableSize);
+		for (const auto& entry : m_entries)
+			end = std::max(end, (static_cast<uint64_t>(entry.offsetBlock) + entry.usedBlocks) * ImgEntry::BlockSize);
+		return (end + ImgEntry::BlockSize - 1) / ImgEntry::BlockSize;
+	}
+
+	wil::unique_hfile m_file;
+	ImgHeader m_header = {};
+	std::vector<ImgEntry> m_entries;
+	std::vector<std::string> m_names;
+};
+
+// img-patch <archive.img> --font=<face> --charTable=<char_table.dat> [--entry=fonts.wtd]
+//           [--symbolFont=<face>] [--fallbackFonts=<face,...>] [--weight=700] [--backend=dwrite|gdip] [--quote=cn|en] [--in-place]
+int CliImgPatch(const CliArgs& args)
+{
+	if (args.positional.empty() || !args.Get(L"charTable"))
+		return ExitUsage;
+
+	const auto options = ParseGenerateOptions(L"img-patch", [&](const wchar_t* key) -> std::optional<std::wstring> {
+		if (auto value = args.Get(key))
+			return std::wstring(*value);
+		return std::nullopt;
+	});
+	const auto entryName = Utf16ToUtf8(args.Get(L"entry", L"fonts.wtd"));
+
+	ImgArchive archive(fs::path(args.positional[0]), true);
+	const auto index = archive.Find(entryName);
+	THROW_HR_IF_MSG(HRESULT_FROM_WIN32(ERROR_NOT_FOUND), index == std::string_view::npos, "no %hs in the archive", entryName.c_str());
+	THROW_HR_IF_MSG(HRESULT_FROM_WIN32(ERROR_INVALID_DATA), archive.Entry(index).resourceType != static_cast<uint32_t>(RageUtil::RSC5::ResourceType::Texture), "%hs is not a texture dictionary", entryName.c_str());
+
+	const auto start = std::chrono::steady_clock::now();
+	const auto image = GenerateCharsImage(options, LoadCharTable(fs::path(*args.Get(L"charTable"))).Chars());
+
+	auto range = archive.Open(index);
+	const auto oldSize = archive.Entry(index).Size();
+	WtdPatch patch(ReadWTD(range), image);
+	const auto data = patch.Serialize();
+	const bool moved = archive.Replace(index, data, patch.header.flags.uint32, args.Has(L"in-place"));
+	const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+	Print(L"{}: {} -> {} bytes, {} ({} ms)\n", Utf8ToUtf16(archive.Name(index)), oldSize, data.size(),
+		moved ? L"moved to the end of the archive" : L"rewritten in place", elapsed.count());
+	return ExitSuccess;
+}
@@ -0,0 +1,375 @@
+#pragma once
+
+// Install-wide index of texture dictionaries: which .wtd carries which texture hashes,
+// formats and sizes. Only the virtual segment of each dictionary is inflated, and a rescan
+// reuses the entries of files whose size and write time are unchanged.
+//
+// The index file is laid out to be mapped and read in place:
+// TextureIndexHeader, TextureIndexFile[fileCount] sorted by path, TextureIndexTexture[textureCount],
+// then the UTF-8 strings the records point into.
+
+struct TextureIndexHeader
+{
+	static constexpr uint32_t MagicValue = 0x49545743; // CWTI
+	static constexpr uint32_t CurrentVersion = 1;
+
+	uint32_t magic;
+	uint32_t version;
+	uint32_t fileCount;
+	uint32_t textureCount;
+	uint32_t stringsSize;
+	uint32_t reserved;
+};
+static_assert(sizeof(TextureIndexHeader) == 24);
+
+struct TextureIndexFile
+{
+	uint64_t size;
+	uint64_t writeTime;
+	uint32_t pathOffset; // Relative to the install, lower case
+	uint32_t pathSize;
+	uint32_t firstTexture;
+	uint32_t textureCount;
+	HRESULT hr; // Why the dictionary could not be read, its textures are then missing
+	uint32_t reserved;
+};
+static_assert(sizeof(TextureIndexFile) == 40);
+
+struct TextureIndexTexture
+{
+	uint32_t hash;
+	uint32_t nameOffset;
+	uint32_t nameSize;
+	D3DFORMAT format;
+	uint16_t width;
+	uint16_t height;
+	uint8_t levels;
+	uint8_t reserved[3];
+};
+static_assert(sizeof(TextureIndexTexture) == 24);
+
+// A mapped index file, validated on open
+class TextureIndexView
+{
+public:
+	explicit TextureIndexView(const fs::path& path) : m_file(MapFileForRead(path))
+	{
+		const auto data = m_file.Data();
+		THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT), data.size() < sizeof(TextureIndexHeader));
+		m_header = reinterpret_cast<const TextureIndexHeader*>(data.data());
+		THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT), m_header->magic != TextureIndexHeader::MagicValue);
+		THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_REVISION_MISMATCH), m_header->version != TextureIndexHeader::CurrentVersion);
+
+		const size_t filesEnd = sizeof(TextureIndexHeader) + static_cast<size_t>(m_header->fileCount) * sizeof(TextureIndexFile);
+		const size_t texturesEnd = filesEnd + static_cast<size_t>(m_header->textureCount) * sizeof(TextureIndexTexture);
+		THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT), texturesEnd + m_header->stringsSize != data.size());
+		m_files = { reinterpret_cast<const TextureIndexFile*>(data.data() + sizeof(TextureIndexHeader)), m_header->fileCount };
+		m_textures = { reinterpret_cast<const TextureIndexTexture*>(data.data() + filesEnd), m_header->textureCount };
+		m_strings = { reinterpret_cast<const char*>(data.data() + texturesEnd), m_header->stringsSize };
+
+		for (const auto& file : m_files)
+		{
+			THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT), static_cast<uint64_t>(file.pathOffset) + file.pathSize > m_strings.size());
+			THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT), static_cast<uint64_t>(file.firstTexture) + file.textureCount > m_textures.size());
+		}
+		for (const auto& texture : m_textures)
+			THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT), static_cast<uint64_t>(texture.nameOffset) + texture.nameSize > m_strings.size());
+	}
+
+	std::span<const TextureIndexFile> Files() const { return m_files; }
+	std::span<const TextureIndexTexture> Textures(const TextureIndexFile& file) const { return m_textures.subspan(file.firstTexture, file.textureCount); }
+	std::string_view Path(const TextureIndexFile& file) const { return m_strings.substr(file.pathOffset, file.pathSize); }
+	std::string_view Name(const TextureIndexTexture& texture) const { return m_strings.substr(texture.nameOffset, texture.nameSize); }
+
+	// path is relative and lower case, as stored
+	const TextureIndexFile* Find(std::string_view path) const
+	{
+		auto it = std::lower_bound(m_files.begin(), m_files.end(), path, [this](const TextureIndexFile& file, std::string_view key) { return Path(file) < key; });
+		return it != m_files.end() && Path(*it) == path ? &*it : nullptr;
+	}
+
+private:
+	MappedFile m_file;
+	const TextureIndexHeader* m_header = nullptr;
+	std::span<const TextureIndexFile> m_files;
+	std::span<const TextureIndexTexture> m_textures;
+	std::string_view m_strings;
+};
+
+struct IndexedTexture
+{
+	uint32_t hash;
+	std::string name;
+	D3DFORMAT format;
+	uint16_t width;
+	uint16_t height;
+	uint8_t levels;
+};
+
+struct IndexedFile
+{
+	std::string path; // Relative to the install, lower case
+	uint64_t size = 0;
+	uint64_t writeTime = 0;
+	HRESULT hr = S_OK;
+	std::vector<IndexedTexture> textures;
+};
+
+std::string IndexPath(const fs::path& relative)
+{
+	auto path = Utf16ToUtf8(relative.wstring());
+	std::transform(path.begin(), path.end(), path.begin(), [](char ch) { return ch >= 'A' && ch <= 'Z' ? static_cast<char>(ch - 'A' + 'a') : ch; });
+	return path;
+}
+
+// Reads the textures of a dictionary from its virtual segment
+std::vector<IndexedTexture> IndexDictionary(const fs::path& path)
+{
+	TRACE_SCOPE("index dictionary");
+	wil::unique_hfile hFile(CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+	THROW_LAST_ERROR_IF(!hFile);
+	auto [header, data] = RageUtil::RSC5::ReadFromFile(hFile.get(), true);
+
+	const RageUtil::TextureDictionaryView view(data.get(), header, true);
+	std::vector<IndexedTexture> textures;
+	textures.reserve(view.Textures().size());
+	for (const auto& texture : view.Textures())
+	{
+		textures.push_back({
+			.hash = texture.hash,
+			.name = std::string(texture.name),
+			.format = texture.texture->pixelFormat,
+			.width = texture.texture->width,
+			.height = texture.texture->height,
+			.levels = texture.texture->levels
+		});
+	}
+	return textures;
+}
+
+void WriteTextureIndex(const fs::path& path, std::span<const IndexedFile> files)
+{
+	std::vector<TextureIndexFile> fileRecords;
+	std::vector<TextureIndexTexture> textureRecords;
+	std::string strings;
+	auto addString = [&strings](std::string_view s) {
+		const auto offset = static_cast<uint32_t>(strings.size());
+		strings += s;
+		return offset;
+	};
+
+	for (const auto& file : files)
+	{
+		fileRecords.push_back({
+			.size = file.size,
+			.writeTime = file.writeTime,
+			.pathOffset = addString(file.path),
+			.pathSize = static_cast<uint32_t>(file.path.size()),
+			.firstTexture = static_cast<uint32_t>(textureRecords.size()),
+			.textureCount = static_cast<uint32_t>(file.textures.size()),
+			.hr = file.hr
+		});
+		for (const auto& texture : file.textures)
+		{
+			textureRecords.push_back({
+				.hash = texture.hash,
+				.nameOffset = addString(texture.name),
+				.nameSize = static_cast<uint32_t>(texture.name.size()),
+				.format = texture.format,
+				.width = texture.width,
+				.height = texture.height,
+				.levels = texture.levels
+			});
+		}
+	}
+
+	const TextureIndexHeader header = {
+		.magic = TextureIndexHeader::MagicValue,
+		.version = TextureIndexHeader::CurrentVersion,
+		.fileCount = static_cast<uint32_t>(fileRecords.size()),
+		.textureCount = static_cast<uint32_t>(textureRecords.size()),
+		.stringsSize = static_cast<uint32_t>(strings.size())
+	};
+
+	// Replaced in one step, so readers never map a half written index
+	auto temp = path;
+	temp += L".tmp";
+	{
+		wil::unique_hfile hFile(CreateFileW(temp.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+		THROW_LAST_ERROR_IF(!hFile);
+		WriteFileCheckSize(hFile.get(), const_cast<TextureIndexHeader*>(&header), sizeof(header));
+		WriteFileCheckSize(hFile.get(), fileRecords.data(), static_cast<DWORD>(fileRecords.size() * sizeof(TextureIndexFile)));
+		WriteFileCheckSize(hFile.get(), textureRecords.data(), static_cast<DWORD>(textureRecords.size() * sizeof(TextureIndexTexture)));
+		WriteFileCheckSize(hFile.get(), strings.data(), static_cast<DWORD>(strings.size()));
+	}
+	THROW_IF_WIN32_BOOL_FALSE(MoveFileExW(temp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING));
+}
+
+// Every .wtd under root, directories under root are walked in parallel
+std::vector<IndexedFile> FindDictionaries(const fs::path& root)
+{
+	std::vector<fs::path> dirs;
+	std::vector<IndexedFile> files;
+	auto add = [&root](const fs::directory_entry& entry, std::vector<IndexedFile>& out) {
+		if (entry.is_regular_file() && EqualsIgnoreCase(entry.path().extension().wstring(), L".wtd"))
+		{
+			out.push_back({
+				.path = IndexPath(entry.path().lexically_relative(root)),
+				.size = entry.file_size(),
+				.writeTime = static_cast<uint64_t>(entry.last_write_time().time_since_epoch().count())
+			});
+		}
+	};
+
+	for (const auto& entry : fs::directory_iterator(root, fs::directory_options::skip_permission_denied))
+	{
+		if (entry.is_directory())
+			dirs.push_back(entry.path());
+		else
+			add(entry, files);
+	}
+
+	std::vector<std::vector<IndexedFile>> found(dirs.size());
+	ParallelFor(dirs.size(), [&](size_t i, size_t) {
+		for (const auto& entry : fs::recursive_directory_iterator(dirs[i], fs::directory_options::skip_permission_denied))
+			add(entry, found[i]);
+	});
+	for (auto& dirFiles : found)
+		std::move(dirFiles.begin(), dirFiles.end(), std::back_inserter(files));
+
+	std::sort(files.begin(), files.end(), [](const IndexedFile& l, const IndexedFile& r) { return l.path < r.path; });
+	return files;
+}
+
+// index <install dir> [--index=<file>] [--find=<texture name>] [--hash=<hex hash>] [--full] [--json=<results.json>|-]
+int CliIndex(const CliArgs& args)
+{
+	if (args.positional.empty())
+		return ExitUsage;
+
+	const auto start = std::chrono::steady_clock::now();
+	const fs::path root = fs::absolute(args.positional[0]);
+	const fs::path indexPath = fs::absolute(args.Get(L"index") ? fs::path(*args.Get(L"index")) : root / L"CWTDGen.idx");
+
+	std::optional<TextureIndexView> previous;
+	if (!args.Has(L"full") && fs::is_regular_file(indexPath))
+	{
+		try
+		{
+			previous.emplace(indexPath);
+		}
+		catch (...)
+		{
+			PrintError(L"ignoring {}: {}\n", indexPath.wstring(), HResultMessage(wil::ResultFromCaughtException()));
+		}
+	}
+
+	auto files = FindDictionaries(root);
+	std::vector<size_t> stale;
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		auto& file = files[i];
+		const auto old = previous ? previous->Find(file.path) : nullptr;
+		if (old && old->size == file.size && old->writeTime == file.writeTime && SUCCEEDED(old->hr))
+		{
+			for (const auto& texture : previous->Textures(*old))
+				file.textures.push_back({ texture.hash, std::string(previous->Name(texture)), texture.format, texture.width, texture.height, texture.levels });
+		}
+		else
+			stale.push_back(i);
+	}
+
+	ParallelFor(stale.size(), [&](size_t i, size_t) {
+		auto& file = files[stale[i]];
+		try
+		{
+			file.textures = IndexDictionary(root / Utf8ToUtf16(file.path));
+		}
+		catch (...)
+		{
+			file.hr = wil::ResultFromCaughtException();
+		}
+	});
+
+	previous.reset(); // Unmap before replacing the file
+	WriteTextureIndex(indexPath, files);
+	const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+	size_t textureCount = 0, failed = 0;
+	for (const auto& file : files)
+	{
+		textureCount += file.textures.size();
+		if (FAILED(file.hr))
+		{
+			++failed;
+			PrintError(L"failed {}: {}\n", Utf8ToUtf16(file.path), HResultMessage(file.hr));
+		}
+	}
+
+	JsonWriter json;
+	json.BeginObject();
+	json.Member("index", indexPath.wstring());
+	json.Member("dictionaries", files.size());
+	json.Member("rescanned", stale.size());
+	json.Member("failed", failed);
+	json.Member("textures", textureCount);
+	json.Member("elapsedMs", elapsed.count());
+
+	// A patched fonts.wtd carries font_chs
+	const auto fontChs = RageUtil::HashString("font_chs");
+	json.Key("games").BeginArray();
+	for (const auto& game : Games)
+	{
+		const auto path = IndexPath(game.fontsPath);
+		auto it = std::lower_bound(files.begin(), files.end(), path, [](const IndexedFile& file, const std::string& key) { return file.path < key; });
+		const bool found = it != files.end() && it->path == path && SUCCEEDED(it->hr);
+		const IndexedTexture* texture = nullptr;
+		if (found)
+		{
+			auto t = std::find_if(it->textures.begin(), it->textures.end(), [&](const IndexedTexture& t) { return t.hash == fontChs; });
+			texture = t != it->textures.end() ? &*t : nullptr;
+		}
+
+		Print(L"{:<6} {}\n", game.name, !found ? std::wstring(L"no fonts.wtd") :
+			texture ? std::format(L"patched, font_chs {}x{} format {}", texture->width, texture->height, static_cast<uint32_t>(texture->format)) : std::wstring(L"not patched"));
+		json.BeginObject();
+		json.Member("game", game.name);
+		json.Member("found", found);
+		json.Member("patched", texture != nullptr);
+		json.EndObject();
+	}
+	json.EndArray();
+
+	const auto findName = args.Get(L"find");
+	const auto findHash = args.Get(L"hash");
+	if (findName || findHash)
+	{
+		const uint32_t hash = findHash ? std::stoul(std::wstring(*findHash), nullptr, 16) : RageUtil::HashString(Utf16ToUtf8(*findName).c_str());
+		json.Key("matches").BeginArray();
+		for (const auto& file : files)
+		{
+			for (const auto& texture : file.textures)
+			{
+				if (texture.hash != hash)
+					continue;
+				Print(L"{:08x} {} in {}, {}x{} format {} levels {}\n", texture.hash, Utf8ToUtf16(texture.name), Utf8ToUtf16(file.path), texture.width, texture.height, static_cast<uint32_t>(texture.format), texture.levels);
+				json.BeginObject();
+				json.Member("path", file.path);
+				json.Member("name", texture.name);
+				json.Member("format", static_cast<uint32_t>(texture.format));
+				json.Member("width", texture.width);
+				json.Member("height", texture.height);
+				json.Member("levels", texture.levels);
+				json.EndObject();
+			}
+		}
+		json.EndArray();
+	}
+	json.EndObject();
+
+	if (auto jsonPath = args.Get(L"json"))
+		WriteJsonOutput(*jsonPath, json);
+	PrintError(L"{} dictionaries ({} rescanned), {} textures in {} ms\n", files.size(), stale.size(), textureCount, elapsed.count());
+
+	return failed == 0 ? ExitSuccess : ExitFailure;
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+// Overlapped reads of many files through one I/O completion port. Up to QueueDepth reads of
+// ReadChunkSize are kept in flight across up to MaxOpenFiles files, so the device sees a deep
+// queue rather than one synchronous request per thread. Chunks land straight in each file's
+// buffer, allocated once from its size, and a file is handed on as soon as its last chunk
+// completes while reads of the others stay queued. Files handed on are bounded too, see
+// ForEachFileRead. Single files still go through FileRange.
+
+constexpr DWORD ReadChunkSize = 1024 * 1024;
+constexpr size_t QueueDepth = 64;
+constexpr size_t MaxOpenFiles = 32;
+constexpr size_t MaxBufferedFiles = 64;
+constexpr uint64_t MaxBufferedBytes = 256ull * 1024 * 1024;
+
+// done(index, hr, data) runs on the calling thread for each of paths, in completion order
+template<typename F>
+void ReadFilesOverlapped(std::span<const fs::path> paths, F&& done)
+{
+	TRACE_SCOPE("overlapped reads");
+	wil::unique_handle port(CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1));
+	THROW_LAST_ERROR_IF(!port);
+
+	struct Request : OVERLAPPED
+	{
+		size_t file;
+		DWORD size;
+	};
+	struct OpenFile
+	{
+		wil::unique_hfile handle;
+		std::vector<uint8_t> data;
+		uint64_t issued = 0; // Bytes with a read issued
+		size_t pending = 0;
+		HRESULT hr = S_OK;
+	};
+
+	std::vector<Request> requests(QueueDepth);
+	std::vector<Request*> idle;
+	for (auto& request : requests)
+		idle.push_back(&request);
+	std::map<size_t, OpenFile> open;
+	size_t nextPath = 0;
+
+	// Reads must not complete into requests or buffers that are gone
+	auto drain = wil::scope_exit([&] {
+		for (auto& [index, file] : open)
+			CancelIoEx(file.handle.get(), nullptr);
+		while (idle.size() < requests.size())
+		{
+			DWORD bytes;
+			ULONG_PTR key;
+			LPOVERLAPPED overlapped = nullptr;
+			if (!GetQueuedCompletionStatus(port.get(), &bytes, &key, &overlapped, INFINITE) && !overlapped)
+				break;
+			idle.push_back(static_cast<Request*>(overlapped));
+		}
+	});
+
+	auto finish = [&](size_t index) {
+		auto node = open.extract(index);
+		auto& file = node.mapped();
+		done(index, file.hr, std::move(file.data));
+	};
+
+	auto openNext = [&] {
+		const size_t index = nextPath++;
+		OpenFile file;
+		file.handle.reset(CreateFileW(paths[index].c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+		LARGE_INTEGER size = {};
+		if (!file.handle || !GetFileSizeEx(file.handle.get(), &size) || !CreateIoCompletionPort(file.handle.get(), port.get(), index, 0))
+		{
+			done(index, HRESULT_FROM_WIN32(GetLastError()), std::vector<uint8_t>());
+			return;
+		}
+		file.data.resize(static_cast<size_t>(size.QuadPart));
+		if (file.data.empty())
+		{
+			done(index, S_OK, std::move(file.data));
+			return;
+		}
+		open.emplace(index, std::move(file));
+	};
+
+	auto issue = [&](size_t index, OpenFile& file) {
+		while (!idle.empty() && file.issued < file.data.size() && SUCCEEDED(file.hr))
+		{
+			auto request = idle.back();
+			*request = {};
+			request->file = index;
+			request->size = static_cast<DWORD>(std::min<uint64_t>(ReadChunkSize, file.data.size() - file.issued));
+			request->Offset = static_cast<DWORD>(file.issued);
+			request->OffsetHigh = static_cast<DWORD>(file.issued >> 32);
+			if (!ReadFile(file.handle.get(), file.data.data() + file.issued, request->size, nullptr, request) && GetLastError() != ERROR_IO_PENDING)
+			{
+				file.hr = HRESULT_FROM_WIN32(GetLastError());
+				break;
+			}
+			idle.pop_back();
+			file.issued += request->size;
+			++file.pending;
+		}
+	};
+
+	while (true)
+	{
+		while (!idle.empty() && open.size() < MaxOpenFiles && nextPath < paths.size())
+			openNext();
+		for (auto it = open.begin(); it != open.end() && !idle.empty();)
+		{
+			auto& [index, file] = *it++;
+			issue(index, file);
+			if (file.pending == 0 && (FAILED(file.hr) || file.issued == file.data.size()))
+				finish(index);
+		}
+		if (open.empty() && nextPath == paths.size())
+			break;
+		if (idle.size() == requests.size())
+			continue; // Every open file failed to issue and was finished
+
+		DWORD bytes;
+		ULONG_PTR key;
+		LPOVERLAPPED overlapped = nullptr;
+		const BOOL ok = GetQueuedCompletionStatus(port.get(), &bytes, &key, &overlapped, INFINITE);
+		THROW_LAST_ERROR_IF(!ok && !overlapped);
+		auto request = static_cast<Request*>(overlapped);
+		idle.push_back(request);
+
+		auto& file = open.at(request->file);
+		--file.pending;
+		if (!ok)
+			file.hr = HRESULT_FROM_WIN32(GetLastError());
+		else if (bytes != request->size)
+			file.hr = HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+		TraceCounter("read bytes", bytes);
+		if (file.pending == 0 && (FAILED(file.hr) || file.issued == file.data.size()))
+			finish(request->file);
+	}
+}
+
+// Runs stage(index, data) on all hardware threads for each of paths as soon as its read
+// completes, so inflating one file overlaps reading the next. A file that can't be read goes
+// to failed(index, hr) instead. Exceptions from stage are logged, stage should catch its own.
+// Reading stops while MaxBufferedFiles files or MaxBufferedBytes bytes wait for or are in
+// stage, and goes on as they are released; a single larger file still goes through alone.
+template<typename Stage, typename Failed>
+void ForEachFileRead(std::span<const fs::path> paths, Stage&& stage, Failed&& failed)
+{
+	TaskScheduler scheduler;
+	std::mutex lock;
+	std::condition_variable released;
+	size_t bufferedFiles = 0;
+	uint64_t bufferedBytes = 0;
+
+	ReadFilesOverlapped(paths, [&](size_t index, HRESULT hr, std::vector<uint8_t>&& data) {
+		if (FAILED(hr))
+		{
+			failed(index, hr);
+			return;
+		}
+
+		const uint64_t bytes = data.size();
+		{
+			TRACE_SCOPE("read backpressure");
+			std::unique_lock guard(lock);
+			released.wait(guard, [&] { return bufferedFiles == 0 || (bufferedFiles < MaxBufferedFiles && bufferedBytes + bytes <= MaxBufferedBytes); });
+			++bufferedFiles;
+			bufferedBytes += bytes;
+		}
+		scheduler.Submit([&, index, bytes, data = std::make_shared<std::vector<uint8_t>>(std::move(data))] {
+			auto release = wil::scope_exit([&] {
+				*data = {};
+				{
+					std::lock_guard guard(lock);
+					--bufferedFiles;
+					bufferedBytes -= bytes;
+				}
+				released.notify_all();
+			});
+			stage(index, std::span<const uint8_t>(*data));
+		});
+	});
+	scheduler.WaitIdle();
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+// Minimal streaming JSON writer for machine readable command output
+class JsonWriter
+{
+public:
+	JsonWriter& BeginObject() { Separator(); m_out += '{'; m_first.push_back(true); return *this; }
+	JsonWriter& EndObject() { m_out += '}'; m_first.pop_back(); return *this; }
+	JsonWriter& BeginArray() { Separator(); m_out += '['; m_first.push_back(true); return *this; }
+	JsonWriter& EndArray() { m_out += ']'; m_first.pop_back(); return *this; }
+
+	JsonWriter& Key(std::string_view key)
+	{
+		Separator();
+		AppendString(key);
+		m_out += ':';
+		m_afterKey = true;
+		return *this;
+	}
+
+	JsonWriter& Value(std::string_view value) { Separator(); AppendString(value); return *this; }
+	JsonWriter& Value(std::wstring_view value) { return Value(std::string_view(Utf16ToUtf8(value))); }
+	JsonWriter& Value(const char* value) { return Value(std::string_view(value)); }
+	JsonWriter& Value(const wchar_t* value) { return Value(std::wstring_view(value)); }
+	JsonWriter& Value(bool value) { Separator(); m_out += value ? "true" : "false"; return *this; }
+	JsonWriter& Value(std::nullptr_t) { Separator(); m_out += "null"; return *this; }
+
+	template<typename T> requires std::is_arithmetic_v<T>
+	JsonWriter& Value(T value)
+	{
+		Separator();
+		if constexpr (std::is_floating_point_v<T>)
+			m_out += std::isfinite(value) ? std::format("{}", value) : "null";
+		else
+			m_out += std::format("{}", value);
+		return *this;
+	}
+
+	template<typename T>
+	JsonWriter& Member(std::string_view key, T&& value)
+	{
+		Key(key);
+		return Value(std::forward<T>(value));
+	}
+
+	const std::string& Str() const { return m_out; }
+
+private:
+	void Separator()
+	{
+		if (m_afterKey)
+		{
+			m_afterKey = false;
+			return;
+		}
+		if (!m_first.empty())
+		{
+			if (!m_first.back())
+				m_out += ',';
+			m_first.back() = false;
+		}
+	}
+
+	void AppendString(std::string_view str)
+	{
+		m_out += '"';
+		for (char c : str)
+		{
+			switch (c)
+			{
+			case '"': m_out += "\\\""; break;
+			case '\\': m_out += "\\\\"; break;
+			case '\n': m_out += "\\n"; break;
+			case '\r': m_out += "\\r"; break;
+			case '\t': m_out += "\\t"; break;
+			default:
+				if (static_cast<uint8_t>(c) < 0x20)
+					m_out += std::format("\\u{:04x}", static_cast<uint8_t>(c));
+				else
+					m_out += c;
+			}
+		}
+		m_out += '"';
+	}
+
+	std::string m_out;
+	std::vector<bool> m_first;
+	bool m_afterKey = false;
+};
@@ -0,0 +1,290 @@
+#pragma once
+
+// Text previews at display scale. The grid and the cell size are worked out from the length
+// of the text and the view before anything is drawn, and glyphs are drawn straight at that
+// size through a transform instead of drawing the full size grid and shrinking it. The grid
+// is cut into tiles of TileChars x TileChars cells, and only the tiles a view touches are
+// rendered, each once per layout, so scrolling and zooming cost the same for any length of
+// text. Nothing needs a window, so the dialog, the service and the preview command share it.
+
+// Past this the grid scrolls instead of shrinking further
+constexpr float MinPreviewScale = 0.125f;
+constexpr float MaxPreviewScale = 4.0f;
+
+struct PreviewLayout
+{
+	uint32_t xChars = 0;
+	uint32_t yChars = 0;
+	uint32_t cellWidth = CharWidth;
+	uint32_t cellHeight = CharHeight;
+
+	float Scale() const { return static_cast<float>(cellWidth) / CharWidth; }
+	uint32_t Width() const { return xChars * cellWidth; }
+	uint32_t Height() const { return yChars * cellHeight; }
+
+	bool operator==(const PreviewLayout&) const = default;
+};
+
+// As many cells of CharWidth * scale as fit viewWidth per row, at least one
+PreviewLayout LayoutPreviewAt(size_t length, uint32_t viewWidth, float scale)
+{
+	PreviewLayout layout;
+	layout.cellWidth = static_cast<uint32_t>(std::max(1L, std::lround(CharWidth * scale)));
+	layout.cellHeight = static_cast<uint32_t>(std::max(1L, std::lround(CharHeight * scale)));
+	const size_t perRow = std::max<size_t>(1, viewWidth / layout.cellWidth);
+	layout.xChars = static_cast<uint32_t>(std::clamp<size_t>(length, 1, perRow));
+	layout.yChars = static_cast<uint32_t>((length + layout.xChars - 1) / layout.xChars);
+	return layout;
+}
+
+// zoom 0 fits the text in the view: full size if it fits, otherwise the largest scale at which
+// it does, but not below MinPreviewScale. Any other zoom is the scale itself.
+PreviewLayout LayoutPreview(size_t length, uint32_t viewWidth, uint32_t viewHeight, float zoom = 0)
+{
+	if (zoom > 0)
+		return LayoutPreviewAt(length, viewWidth, std::clamp(zoom, MinPreviewScale, MaxPreviewScale));
+
+	auto fits = [&](float scale) { return LayoutPreviewAt(length, viewWidth, scale).Height() <= viewHeight; };
+	if (fits(1.0f) || !fits(MinPreviewScale))
+		return LayoutPreviewAt(length, viewWidth, fits(1.0f) ? 1.0f : MinPreviewScale);
+
+	float low = MinPreviewScale, high = 1.0f;
+	for (int i = 0; i < 16; ++i)
+	{
+		const float mid = (low + high) / 2;
+		if (fits(mid))
+			low = mid;
+		else
+			high = mid;
+	}
+	return LayoutPreviewAt(length, viewWidth, low);
+}
+
+class PreviewRenderer
+{
+public:
+	static constexpr uint32_t TileChars = 16; // Even, so the checkered background lines up across tiles
+	static constexpr size_t MaxCachedTiles = 256;
+
+	PreviewRenderer(const GenerateOptions& options, std::u32string_view text) : m_options(options)
+	{
+		// The draw functions skip these, which would shift a tile's rows against the grid
+		std::ranges::copy_if(text, std::back_inserter(m_text), [](char32_t ch) { return !IgnoreSet.contains(ch); });
+	}
+
+	size_t Length() const { return m_text.size(); }
+	const PreviewLayout& Layout() const { return m_layout; }
+
+	void SetLayout(const PreviewLayout& layout)
+	{
+		if (layout == m_layout)
+			return;
+		m_layout = layout;
+		m_tiles.clear();
+	}
+
+	// Draws the viewWidth x viewHeight part of the grid at (left, top) onto hdc at (0, 0). Parts
+	// of the view outside the grid are left as they are.
+	void Draw(HDC hdc, uint32_t left, uint32_t top, uint32_t viewWidth, uint32_t viewHeight)
+	{
+		TRACE_SCOPE("preview draw");
+		if (m_text.empty())
+			return;
+
+		const uint32_t tileWidth = TileChars * m_layout.cellWidth, tileHeight = TileChars * m_layout.cellHeight;
+		const uint32_t right = std::min(left + viewWidth, m_layout.Width()), bottom = std::min(top + viewHeight, m_layout.Height());
+		wil::unique_hdc hdcTile(CreateCompatibleDC(hdc));
+		THROW_HR_IF(E_FAIL, !hdcTile);
+		for (uint32_t ty = top / tileHeight; ty * tileHeight < bottom; ++ty)
+		{
+			for (uint32_t tx = left / tileWidth; tx * tileWidth < right; ++tx)
+			{
+				const auto& tile = GetTile(tx, ty);
+				auto select = wil::SelectObject(hdcTile.get(), tile.hBitmap.get());
+				BitBlt(hdc, static_cast<int>(tx * tileWidth) - static_cast<int>(left), static_cast<int>(ty * tileHeight) - static_cast<int>(top),
+					tile.width, tile.height, hdcTile.get(), 0, 0, SRCCOPY);
+			}
+		}
+	}
+
+	// The part of the view covered by the grid as a 32 bpp top-down DIB
+	wil::unique_hbitmap RenderView(uint32_t left, uint32_t top, uint32_t viewWidth, uint32_t viewHeight)
+	{
+		const LONG width = static_cast<LONG>(std::min(viewWidth, m_layout.Width() - std::min(left, m_layout.Width())));
+		const LONG height = static_cast<LONG>(std::min(viewHeight, m_layout.Height() - std::min(top, m_layout.Height())));
+		THROW_HR_IF(E_INVALIDARG, width == 0 || height == 0);
+
+		wil::unique_hdc hdc(CreateCompatibleDC(nullptr));
+		THROW_HR_IF(E_FAIL, !hdc);
+		wil::unique_hbitmap hBitmap(CreateDIB(hdc.get(), width, height, 32));
+		THROW_HR_IF(E_FAIL, !hBitmap);
+		{
+			auto selectBitmap = wil::SelectObject(hdc.get(), hBitmap.get());
+			Draw(hdc.get(), left, top, width, height);
+		}
+		return hBitmap;
+	}
+
+private:
+	struct Tile
+	{
+		wil::unique_hbitmap hBitmap;
+		int width;
+		int height;
+	};
+
+	const Tile& GetTile(uint32_t tx, uint32_t ty)
+	{
+		const auto key = std::make_pair(tx, ty);
+		if (auto it = m_tiles.find(key); it != m_tiles.end())
+			return it->second;
+
+		// Zooming through long text would otherwise keep every tile ever shown
+		if (m_tiles.size() >= MaxCachedTiles)
+			m_tiles.clear();
+		return m_tiles.emplace(key, RenderTile(tx, ty)).first->second;
+	}
+
+	// Tiles on the right and bottom edges are cut to the grid
+	Tile RenderTile(uint32_t tx, uint32_t ty) const
+	{
+		TRACE_SCOPE("preview tile");
+		const uint32_t x0 = tx * TileChars, y0 = ty * TileChars;
+		const uint32_t xChars = std::min(TileChars, m_layout.xChars - x0), yChars = std::min(TileChars, m_layout.yChars - y0);
+		Tile tile = { nullptr, static_cast<int>(xChars * m_layout.cellWidth), static_cast<int>(yChars * m_layout.cellHeight) };
+
+		wil::unique_hdc hdc(CreateCompatibleDC(nullptr));
+		THROW_HR_IF(E_FAIL, !hdc);
+		RGBQUAD* bmBits;
+		tile.hBitmap = CreateDIB(hdc.get(), tile.width, tile.height, 32, reinterpret_cast<void**>(&bmBits));
+		THROW_HR_IF(E_FAIL, !tile.hBitmap);
+		auto selectBitmap = wil::SelectObject(hdc.get(), tile.hBitmap.get());
+
+		GDIDrawCheckeredBackground(hdc.get(), tile.width, tile.height, xChars, yChars, 0x202020, 0x303030, m_layout.cellWidth, m_layout.cellHeight);
+		SetBitmapAlpha(bmBits, tile.width, tile.height, 255);
+
+		// With effects the glyphs are drawn on black first, so the effects only see their coverage
+		const bool effects = m_options.effects.Enabled();
+		wil::unique_hdc hdcGlyphs;
+		wil::unique_hbitmap hGlyphs;
+		RGBQUAD* glyphBits = nullptr;
+		wil::unique_select_object selectGlyphs;
+		if (effects)
+		{
+			hdcGlyphs.reset(CreateCompatibleDC(nullptr));
+			THROW_HR_IF(E_FAIL, !hdcGlyphs);
+			hGlyphs = CreateDIB(hdcGlyphs.get(), tile.width, tile.height, 32, reinterpret_cast<void**>(&glyphBits));
+			THROW_HR_IF(E_FAIL, !hGlyphs);
+			selectGlyphs = wil::SelectObject(hdcGlyphs.get(), hGlyphs.get());
+		}
+		const HDC hdcDraw = effects ? hdcGlyphs.get() : hdc.get();
+
+		// The cells may be rounded to whole pixels differently across and down
+		const float scaleX = static_cast<float>(m_layout.cellWidth) / CharWidth, scaleY = static_cast<float>(m_layout.cellHeight) / CharHeight;
+		auto row = [&](uint32_t y) {
+			const size_t start = static_cast<size_t>(y0 + y) * m_layout.xChars + x0;
+			return start < m_text.size() ? std::u32string_view(m_text).substr(start, xChars) : std::u32string_view();
+		};
+
+		if (m_options.useGDIP)
+		{
+			for (uint32_t y = 0; y < yChars && !row(y).empty(); ++y)
+			{
+				Gp::Matrix transform(scaleX, 0, 0, scaleY, 0, static_cast<Gp::REAL>(y * m_layout.cellHeight));
+				GpDrawCharacters(hdcDraw, m_options.fonts, row(y), xChars, 1, m_options.replaceChars, nullptr, &transform);
+			}
+		}
+		else
+		{
+			wil::com_ptr<ID2D1DCRenderTarget> dcRenderTarget;
+			const D2D1_RENDER_TARGET_PROPERTIES props = D2D1::RenderTargetProperties(D2D1_RENDER_TARGET_TYPE_DEFAULT,
+				D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED));
+			THROW_IF_FAILED(g_d2dFactory->CreateDCRenderTarget(&props, &dcRenderTarget));
+			const RECT rect = { 0, 0, tile.width, tile.height };
+			THROW_IF_FAILED(dcRenderTarget->BindDC(hdcDraw, &rect));
+
+			dcRenderTarget->BeginDraw();
+			for (uint32_t y = 0; y < yChars && !row(y).empty(); ++y)
+			{
+				dcRenderTarget->SetTransform(D2D1::Matrix3x2F::Scale(scaleX, scaleY) * D2D1::Matrix3x2F::Translation(0, static_cast<float>(y * m_layout.cellHeight)));
+				DWriteDrawCharacters(dcRenderTarget.get(), m_options.fonts, row(y), xChars, 1, m_options.replaceChars, m_options.fonts.EmSize());
+			}
+			THROW_IF_FAILED(dcRenderTarget->EndDraw());
+		}
+
+		if (effects)
+		{
+			GdiFlush();
+			const DirectX::Image glyphs = {
+				.width = static_cast<size_t>(tile.width),
+				.height = static_cast<size_t>(tile.height),
+				.format = DXGI_FORMAT_B8G8R8A8_UNORM,
+				.rowPitch = static_cast<size_t>(tile.width) * 4,
+				.slicePitch = static_cast<size_t>(tile.width) * tile.height * 4,
+				.pixels = reinterpret_cast<uint8_t*>(glyphBits)
+			};
+			ApplyGlyphEffects(glyphs, ScaleGlyphEffects(m_options.effects, scaleX), m_layout.cellWidth, m_layout.cellHeight);
+
+			// Premultiplied glyphs over the background
+			for (size_t i = 0; i < static_cast<size_t>(tile.width) * tile.height; ++i)
+			{
+				const auto& src = glyphBits[i];
+				auto& dst = bmBits[i];
+				const uint32_t inverse = 255 - src.rgbReserved;
+				dst.rgbBlue = static_cast<BYTE>(src.rgbBlue + MulDiv255(dst.rgbBlue, inverse));
+				dst.rgbGreen = static_cast<BYTE>(src.rgbGreen + MulDiv255(dst.rgbGreen, inverse));
+				dst.rgbRed = static_cast<BYTE>(src.rgbRed + MulDiv255(dst.rgbRed, inverse));
+			}
+		}
+		return tile;
+	}
+
+	GenerateOptions m_options;
+	std::u32string m_text;
+	PreviewLayout m_layout;
+	std::map<std::pair<uint32_t, uint32_t>, Tile> m_tiles;
+};
+
+// The top of a zoom 0 layout of text in viewWidth x viewHeight, for one-off previews
+wil::unique_hbitmap RenderPreview(const GenerateOptions& options, std::u32string_view text, uint32_t viewWidth, uint32_t viewHeight, float zoom = 0, uint32_t top = 0)
+{
+	PreviewRenderer preview(options, text);
+	THROW_HR_IF_MSG(E_INVALIDARG, preview.Length() == 0, "nothing to preview");
+	preview.SetLayout(LayoutPreview(preview.Length(), viewWidth, viewHeight, zoom));
+	return preview.RenderView(0, top, viewWidth, viewHeight);
+}
+
+// preview --font=<face> --text=<text> [--out=preview.png] [--width=800] [--height=600] [--zoom=0] [--top=0]
+//         [--symbolFont=<face>] [--fallbackFonts=<face,...>] [--weight=700] [--backend=dwrite|gdip] [--quote=cn|en]
+int CliPreview(const CliArgs& args)
+{
+	const auto text = args.Get(L"text");
+	if (!text)
+		return ExitUsage;
+
+	const auto options = ParseGenerateOptions(L"preview", [&](const wchar_t* key) -> std::optional<std::wstring> {
+		if (auto value = args.Get(key))
+			return std::wstring(*value);
+		return std::nullopt;
+	});
+	const auto width = std::stoul(std::wstring(args.Get(L"width", L"800")));
+	const auto height = std::stoul(std::wstring(args.Get(L"height", L"600")));
+	const auto zoom = std::stof(std::wstring(args.Get(L"zoom", L"0")));
+	const auto top = std::stoul(std::wstring(args.Get(L"top", L"0")));
+	const fs::path out(args.Get(L"out", L"preview.png"));
+
+	const auto start = std::chrono::steady_clock::now();
+	PreviewRenderer preview(options, Utf16ToUtf32(*text));
+	THROW_HR_IF_MSG(E_INVALIDARG, preview.Length() == 0, "nothing to preview");
+	preview.SetLayout(LayoutPreview(preview.Length(), width, height, zoom));
+	const auto png = GpEncodePng(preview.RenderView(0, top, width, height).get());
+	const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+	wil::unique_hfile hFile(CreateFileW(out.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+	THROW_LAST_ERROR_IF(!hFile);
+	WriteFileCheckSize(hFile.get(), const_cast<uint8_t*>(png.data()), static_cast<DWORD>(png.size()));
+
+	const auto& layout = preview.Layout();
+	Print(L"{}: {}x{} cells of {}x{} ({:.0f}%), {} ms\n", out.wstring(), layout.xChars, layout.yChars, layout.cellWidth, layout.cellHeight, layout.Scale() * 100, elapsed.count());
+	return ExitSuccess;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+// What each BC3 quality tier costs: the atlas is rendered once, then compressed with every
+// tier, and each result timed and compared with the rendered atlas. The memo column is the
+// share of blocks that were copied from an identical block rather than encoded.
+
+// quality --font=<face> --charTable=<char_table.dat> [--tiers=fast,default,high] [--worst=10]
+//         [--symbolFont=<face>] [--fallbackFonts=<face,...>] [--weight=700] [--backend=dwrite|gdip] [--quote=cn|en] [--json=<results.json>|-]
+int CliQuality(const CliArgs& args)
+{
+	if (!args.Get(L"charTable"))
+		return ExitUsage;
+
+	const auto options = ParseGenerateOptions(L"quality", [&](const wchar_t* key) -> std::optional<std::wstring> {
+		if (auto value = args.Get(key))
+			return std::wstring(*value);
+		return std::nullopt;
+	});
+	std::vector<Bc3Quality> tiers;
+	for (const auto& name : SplitList(args.Get(L"tiers", L"fast,default,high")))
+	{
+		const auto quality = ParseBc3Quality(name);
+		THROW_HR_IF_MSG(E_INVALIDARG, !quality, "unknown quality %ls", name.c_str());
+		tiers.push_back(*quality);
+	}
+	const auto worst = std::stoul(std::wstring(args.Get(L"worst", L"10")));
+
+	const auto charTable = LoadCharTable(fs::path(*args.Get(L"charTable")));
+	const auto bitmap = RenderCharsBitmap(options, charTable.Chars());
+	const auto chars = charTable.Chars();
+
+	JsonWriter json;
+	json.BeginObject();
+	json.Member("chars", chars.size());
+	json.Key("tiers").BeginArray();
+	Print(L"{:<8} {:>10} {:>10} {:>10} {:>10} {:>8}\n", L"tier", L"ms", L"PSNR dB", L"MSE", L"max error", L"memo");
+	for (const auto quality : tiers)
+	{
+		Bc3BlockMemo memo;
+		const auto start = std::chrono::steady_clock::now();
+		const auto dxt5Img = CompressCharsImage(bitmap.Image(), quality, nullptr, &memo);
+		const auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		const auto error = MeasureBc3Error(bitmap.Image(), dxt5Img);
+
+		Print(L"{:<8} {:>10.0f} {:>10.2f} {:>10.3f} {:>10} {:>7.1f}%\n", Bc3QualityName(quality), ms, error.atlas.Psnr(), error.atlas.Mse(), error.atlas.maxError, memo.HitRate() * 100);
+		for (const auto cell : error.Worst(worst))
+		{
+			if (error.cells[cell].squaredSum == 0)
+				break;
+			Print(L"    cell {:<5} {:<9} PSNR {:.2f} dB, max error {}\n", cell,
+				cell < chars.size() ? std::format(L"U+{:04X}", static_cast<uint32_t>(chars[cell])) : std::wstring(L"-"),
+				error.cells[cell].Psnr(), error.cells[cell].maxError);
+		}
+
+		json.BeginObject();
+		json.Member("quality", Bc3QualityName(quality));
+		json.Member("ms", ms);
+		json.Member("memoHitRate", memo.HitRate());
+		json.Key("error");
+		WriteAtlasError(json, error, chars, worst);
+		json.EndObject();
+	}
+	json.EndArray();
+	json.EndObject();
+
+	if (auto jsonPath = args.Get(L"json"))
+		WriteJsonOutput(*jsonPath, json);
+	return ExitSuccess;
+}
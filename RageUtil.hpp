@@ -9,9 +9,10 @@
 
 namespace RageUtil
 {
-	static std::span<uint8_t> s_virtual;
-	static std::span<uint8_t> s_physical;
-	static std::vector<void*> s_ptrTable;
+	// Per thread, so dictionaries can be patched concurrently
+	static thread_local std::span<uint8_t> s_virtual;
+	static thread_local std::span<uint8_t> s_physical;
+	static thread_local std::vector<void*> s_ptrTable;
 
 	enum struct pgPtrBlockType : uint32_t
 	{
@@ -79,6 +80,15 @@ namespace RageUtil
 				blockType = pgPtrBlockType::Memory;
 			}
 		}
+
+	private:
+		friend class TextureDictionaryView;
+
+		// No checks at all, only for pointers a TextureDictionaryView validated against segment
+		const T* Unchecked(const uint8_t* segment) const
+		{
+			return reinterpret_cast<const T*>(segment + offset);
+		}
 	};
 	static_assert(sizeof(pgPtrT<int>) == 4);
 
@@ -187,15 +197,19 @@ namespace RageUtil
 
 		constexpr size_t ChunkSize = 65536;
 
-		auto ReadFromFile(HANDLE hFile)
+		// Input is a FileRange or MemoryInput. virtualOnly stops inflating once the virtual segment
+		// is read, which is enough to walk the objects but not to follow physical pointers.
+		template<typename Input>
+		auto ReadFromFile(Input& file, bool virtualOnly = false)
 		{
+			TRACE_SCOPE("inflate");
 			Header header;
-			ReadFileCheckSize(hFile, &header, sizeof(header));
+			file.ReadCheckSize(&header, sizeof(header));
 
 			THROW_HR_IF(E_INVALIDARG, header.magic != Header::MagicValue);
 			THROW_HR_IF(E_INVALIDARG, header.type != ResourceType::Texture);
 
-			uint32_t decodedSize = header.flags.GetVirtualSize() + header.flags.GetPhysicalSize();
+			uint32_t decodedSize = header.flags.GetVirtualSize() + (virtualOnly ? 0 : header.flags.GetPhysicalSize());
 			auto decoded = std::make_unique<uint8_t[]>(decodedSize);
 
 			unique_z_stream_inflate strm;
@@ -208,22 +222,30 @@ namespace RageUtil
 			uint8_t buf[ChunkSize];
 			do
 			{
-				DWORD read = 0;
-				THROW_IF_WIN32_BOOL_FALSE(ReadFile(hFile, buf, ChunkSize, &read, nullptr));
+				const DWORD read = file.Read(buf, ChunkSize);
 				THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_HANDLE_EOF), read == 0);
 
 				strm.avail_in = read;
 				strm.next_in = buf;
 				ret = inflate(&strm, Z_NO_FLUSH);
-			} while (ret != Z_STREAM_END);
+			} while (ret != Z_STREAM_END && !(virtualOnly && strm.avail_out == 0));
+			TraceCounter("inflated bytes", decodedSize);
 
 			return std::make_pair(header, std::move(decoded));
 		}
 
+		auto ReadFromFile(HANDLE hFile, bool virtualOnly = false)
+		{
+			FileRange file(hFile);
+			return ReadFromFile(file, virtualOnly);
+		}
+
 		constexpr uint8_t PadByte = 0xcd;
 
 		RSC5FlagsUint32 SortAndCalculateFlags(BlockList& blockList)
 		{
+			TRACE_SCOPE("block layout");
+			TraceCounter("blocks", static_cast<int64_t>(blockList.virtualBlocks.size() + blockList.physicalBlocks.size()));
 			RSC5FlagsUint32 f;
 			f.uint32 = 0;
 
@@ -299,26 +321,36 @@ namespace RageUtil
 			return f;
 		}
 
-		auto DumpToFile(HANDLE hFile, Header& header, [[maybe_unused]] BlockList& blockList)
+		// Output is a FileRange or MemoryOutput. progress, if given, advances by the uncompressed
+		// bytes consumed and cancels between output chunks.
+		template<typename Output>
+		void DumpTo(Output& file, Header& header, [[maybe_unused]] BlockList& blockList, JobProgress* progress = nullptr)
 		{
+			TRACE_SCOPE("deflate");
 			auto flags = SortAndCalculateFlags(blockList);
 			header.flags.uint32 = (header.flags.uint32 & 0xc0000000) | flags.uint32;
-			WriteFileCheckSize(hFile, &header, sizeof(header));
+			file.Write(&header, sizeof(header));
 
 			unique_z_stream_deflate strm;
 			int ret = deflateInit(&strm, Z_BEST_COMPRESSION);
 			THROW_HR_IF(E_FAIL, ret != Z_OK);
 
-			auto DeflateWrite = [hFile, &strm](void* data, size_t size, bool flush = false) {
+			auto DeflateWrite = [&file, &strm, progress](void* data, size_t size, bool flush = false) {
 				strm.avail_in = static_cast<uInt>(size);
 				strm.next_in = reinterpret_cast<Bytef*>(data);
 				uint8_t buf[ChunkSize];
 				do {
 					strm.avail_out = ChunkSize;
 					strm.next_out = buf;
+					const uInt availIn = strm.avail_in;
 					int ret = deflate(&strm, flush ? Z_FINISH : Z_NO_FLUSH);
 					THROW_HR_IF(E_FAIL, ret == Z_STREAM_ERROR);
-					WriteFileCheckSize(hFile, buf, ChunkSize - strm.avail_out);
+					{
+						TRACE_SCOPE("write");
+						file.Write(buf, ChunkSize - strm.avail_out);
+					}
+					if (progress)
+						progress->Advance(availIn - strm.avail_in);
 				} while (strm.avail_out == 0);
 			};
 			auto WritePadBytes = [&DeflateWrite](size_t size) {
@@ -349,6 +381,13 @@ namespace RageUtil
 			WritePadBytes(flags.GetPhysicalSize() - physicalSize);
 
 			DeflateWrite(nullptr, 0, true);
+			TraceCounter("output bytes", static_cast<int64_t>(strm.total_out));
+		}
+
+		void DumpToFile(HANDLE hFile, Header& header, BlockList& blockList, JobProgress* progress = nullptr)
+		{
+			FileRange file(hFile);
+			DumpTo(file, header, blockList, progress);
 		}
 	}
 
@@ -498,6 +537,50 @@ namespace RageUtil
 	};
 	static_assert(sizeof(pgDictionary<int>) == 32);
 
+	// DXGI_FORMAT_UNKNOWN for formats the textures here are never stored in
+	inline DXGI_FORMAT ToDxgiFormat(D3DFORMAT format)
+	{
+		switch (format)
+		{
+		case D3DFMT_DXT1:
+			return DXGI_FORMAT_BC1_UNORM;
+		case D3DFMT_DXT2:
+		case D3DFMT_DXT3:
+			return DXGI_FORMAT_BC2_UNORM;
+		case D3DFMT_DXT4:
+		case D3DFMT_DXT5:
+			return DXGI_FORMAT_BC3_UNORM;
+		case D3DFMT_A8R8G8B8:
+			return DXGI_FORMAT_B8G8R8A8_UNORM;
+		case D3DFMT_A8:
+			return DXGI_FORMAT_A8_UNORM;
+		case D3DFMT_L8:
+			return DXGI_FORMAT_R8_UNORM;
+		}
+		return DXGI_FORMAT_UNKNOWN;
+	}
+
+	// D3DFMT_UNKNOWN for formats with no D3D9 equivalent here
+	inline D3DFORMAT ToD3dFormat(DXGI_FORMAT format)
+	{
+		switch (format)
+		{
+		case DXGI_FORMAT_BC1_UNORM:
+			return D3DFMT_DXT1;
+		case DXGI_FORMAT_BC2_UNORM:
+			return D3DFMT_DXT3;
+		case DXGI_FORMAT_BC3_UNORM:
+			return D3DFMT_DXT5;
+		case DXGI_FORMAT_B8G8R8A8_UNORM:
+			return D3DFMT_A8R8G8B8;
+		case DXGI_FORMAT_A8_UNORM:
+			return D3DFMT_A8;
+		case DXGI_FORMAT_R8_UNORM:
+			return D3DFMT_L8;
+		}
+		return D3DFMT_UNKNOWN;
+	}
+
 	struct grcTexture : pgBase
 	{
 		uint8_t objectType;
@@ -534,20 +617,7 @@ namespace RageUtil
 		{
 			grcTexture::DumpToMemory(blockList);
 
-			DXGI_FORMAT fmt = DXGI_FORMAT_UNKNOWN;
-			switch (pixelFormat)
-			{
-			case D3DFMT_DXT1:
-				fmt = DXGI_FORMAT_BC1_UNORM; break;
-			case D3DFMT_DXT2:
-			case D3DFMT_DXT3:
-				fmt = DXGI_FORMAT_BC2_UNORM; break;
-			case D3DFMT_DXT4:
-			case D3DFMT_DXT5:
-				fmt = DXGI_FORMAT_BC3_UNORM; break;
-			case D3DFMT_A8R8G8B8:
-				fmt = DXGI_FORMAT_B8G8R8A8_UNORM; break;
-			}
+			const DXGI_FORMAT fmt = ToDxgiFormat(pixelFormat);
 			THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_INVALID_PIXEL_FORMAT), fmt == DXGI_FORMAT_UNKNOWN);
 
 			size_t pixelSize = 0;
@@ -587,4 +657,117 @@ namespace RageUtil
 
 		return hash;
 	}
+
+	// A loaded texture dictionary validated as a whole, once: every pointer has its block type,
+	// alignment and extent in its segment, the arrays agree, the names are terminated and the
+	// levels of every texture fit the physical segment. Malformed dictionaries are rejected here
+	// with what is wrong where, and walking the view afterwards is plain pointer chasing.
+	class TextureDictionaryView
+	{
+	public:
+		struct Texture
+		{
+			uint32_t hash;
+			const grcTexturePC* texture;
+			std::string_view name;
+			DXGI_FORMAT format; // DXGI_FORMAT_UNKNOWN if it can't be extracted
+			uint32_t levels; // At least 1
+			std::span<const uint8_t> pixels; // Every level, empty for unknown formats or without the physical segment
+		};
+
+		// The segments are read only. physical is empty for dictionaries read without it.
+		TextureDictionaryView(std::span<const uint8_t> virtualSegment, std::span<const uint8_t> physicalSegment)
+		{
+			TRACE_SCOPE("validate dictionary");
+			const auto corrupt = HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+			THROW_HR_IF_MSG(corrupt, virtualSegment.size() < sizeof(pgDictionary<grcTexturePC>), "%zu byte virtual segment is smaller than a dictionary", virtualSegment.size());
+			m_dictionary = reinterpret_cast<const pgDictionary<grcTexturePC>*>(virtualSegment.data());
+
+			if (auto error = Check(m_dictionary->blockMap, virtualSegment, 1))
+				THROW_HR_MSG(corrupt, "dictionary block map: %hs", error);
+			const uint32_t count = m_dictionary->hashes.size;
+			THROW_HR_IF_MSG(corrupt, m_dictionary->values.size != count, "%u hashes for %u textures", count, m_dictionary->values.size);
+			if (count == 0)
+				return;
+			if (auto error = Check(m_dictionary->hashes.data, virtualSegment, count))
+				THROW_HR_MSG(corrupt, "dictionary hashes: %hs", error);
+			if (auto error = Check(m_dictionary->values.data, virtualSegment, count))
+				THROW_HR_MSG(corrupt, "dictionary textures: %hs", error);
+
+			const auto hashes = m_dictionary->hashes.data.Unchecked(virtualSegment.data());
+			const auto values = m_dictionary->values.data.Unchecked(virtualSegment.data());
+			m_textures.reserve(count);
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				if (auto error = Check(values[i], virtualSegment, 1))
+					THROW_HR_MSG(corrupt, "texture %u: %hs", i, error);
+				const auto texture = values[i].Unchecked(virtualSegment.data());
+
+				if (auto error = Check(texture->name, virtualSegment, 1))
+					THROW_HR_MSG(corrupt, "texture %u name: %hs", i, error);
+				const auto name = texture->name.Unchecked(virtualSegment.data());
+				const auto nameEnd = static_cast<const char*>(memchr(name, '\0', virtualSegment.size() - texture->name.offset));
+				THROW_HR_IF_MSG(corrupt, !nameEnd, "texture %u name is not terminated", i);
+
+				Texture entry = {
+					.hash = hashes[i],
+					.texture = texture,
+					.name = std::string_view(name, nameEnd),
+					.format = ToDxgiFormat(texture->pixelFormat),
+					.levels = std::max<uint32_t>(texture->levels, 1)
+				};
+
+				if (entry.format != DXGI_FORMAT_UNKNOWN && !physicalSegment.empty())
+				{
+					size_t size = 0;
+					for (uint32_t level = 0; level < entry.levels; ++level)
+					{
+						size_t rowPitch, slicePitch;
+						THROW_IF_FAILED(DirectX::ComputePitch(entry.format, std::max<size_t>(texture->width >> level, 1), std::max<size_t>(texture->height >> level, 1), rowPitch, slicePitch));
+						size += slicePitch;
+					}
+					if (auto error = Check(texture->pixelData, physicalSegment, size))
+						THROW_HR_MSG(corrupt, "texture %u pixels (%zu bytes in %u levels): %hs", i, size, entry.levels, error);
+					entry.pixels = { texture->pixelData.Unchecked(physicalSegment.data()), size };
+				}
+				m_textures.push_back(entry);
+			}
+		}
+
+		// The segments of a resource read by RSC5::ReadFromFile
+		TextureDictionaryView(const uint8_t* data, const RSC5::Header& header, bool virtualOnly = false) :
+			TextureDictionaryView(std::span<const uint8_t>(data, header.flags.GetVirtualSize()),
+				virtualOnly ? std::span<const uint8_t>() : std::span<const uint8_t>(data + header.flags.GetVirtualSize(), header.flags.GetPhysicalSize()))
+		{
+		}
+
+		const pgDictionary<grcTexturePC>& Dictionary() const { return *m_dictionary; }
+
+		// In the dictionary's (hash) order
+		std::span<const Texture> Textures() const { return m_textures; }
+
+		// nullptr if there is no such texture
+		const Texture* Find(uint32_t hash) const
+		{
+			auto it = std::find_if(m_textures.begin(), m_textures.end(), [hash](const Texture& texture) { return texture.hash == hash; });
+			return it != m_textures.end() ? &*it : nullptr;
+		}
+
+	private:
+		// nullptr if ptr resolves to count whole Ts in segment, otherwise what is wrong with it
+		template<typename T, pgPtrBlockType BlockType>
+		static const char* Check(const pgPtrT<T, BlockType>& ptr, std::span<const uint8_t> segment, size_t count)
+		{
+			if (!ptr.CheckType())
+				return BlockType == pgPtrBlockType::Virtual ? "not a virtual pointer" : "not a physical pointer";
+			if (ptr.offset % alignof(T) != 0)
+				return "misaligned";
+			if (ptr.offset + static_cast<uint64_t>(count) * sizeof(T) > segment.size())
+				return "out of its segment";
+			return nullptr;
+		}
+
+		const pgDictionary<grcTexturePC>* m_dictionary;
+		std::vector<Texture> m_textures;
+	};
 }
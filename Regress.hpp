@@ -0,0 +1,249 @@
+#pragma once
+
+// End to end regression gate. Generates a fixed matrix of variants (backend x quote mode
+// x char table, each patched into three synthetic game dictionaries), every variant in a
+// fresh process through the batch command, and compares the outputs with two files:
+//
+// goldens.ini   [<case>] <game>.bytes, <game>.pixels: SHA-256 of the output file and of its font_chs data
+// baseline.ini  [<case>] ms, peakMiB, <game>.size
+//
+// --compare=pixels only requires the texture data to match, so deflate and block layout
+// changes can land without new goldens. Encoder changes need --update-goldens.
+
+struct RegressCase
+{
+	std::wstring name;
+	const wchar_t* backend;
+	const wchar_t* quote;
+	const CharTableFixture* charTable;
+};
+
+std::vector<RegressCase> RegressMatrix()
+{
+	std::vector<RegressCase> cases;
+	for (const auto backend : { L"dwrite", L"gdip" })
+	{
+		for (const auto quote : { L"cn", L"en" })
+		{
+			for (const auto& charTable : CharTableFixtures)
+				cases.push_back({ std::format(L"{}-{}-{}", backend, quote, charTable.name), backend, quote, &charTable });
+		}
+	}
+	return cases;
+}
+
+struct ProcessRun
+{
+	DWORD exitCode;
+	double ms;
+	uint64_t peakWorkingSet;
+};
+
+ProcessRun RunProcess(std::wstring commandLine)
+{
+	SECURITY_ATTRIBUTES sa = { .nLength = sizeof(sa), .bInheritHandle = TRUE };
+	wil::unique_hfile nul(CreateFileW(L"NUL", GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa, OPEN_EXISTING, 0, nullptr));
+	THROW_LAST_ERROR_IF(!nul);
+
+	STARTUPINFOW si = { .cb = sizeof(si), .dwFlags = STARTF_USESTDHANDLES, .hStdOutput = nul.get(), .hStdError = nul.get() };
+	wil::unique_process_information pi;
+	const auto start = std::chrono::steady_clock::now();
+	THROW_IF_WIN32_BOOL_FALSE(CreateProcessW(nullptr, commandLine.data(), nullptr, nullptr, TRUE, CREATE_NO_WINDOW, nullptr, nullptr, &si, &pi));
+	WaitForSingleObject(pi.hProcess, INFINITE);
+	const auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	ProcessRun run = { .ms = ms };
+	THROW_IF_WIN32_BOOL_FALSE(GetExitCodeProcess(pi.hProcess, &run.exitCode));
+	PROCESS_MEMORY_COUNTERS counters = { .cb = sizeof(counters) };
+	THROW_IF_WIN32_BOOL_FALSE(GetProcessMemoryInfo(pi.hProcess, &counters, sizeof(counters)));
+	run.peakWorkingSet = counters.PeakWorkingSetSize;
+	return run;
+}
+
+// Where goldens.ini and baseline.ini live by default: regress\ in the source tree the exe was
+// built in, found by walking up from the exe to CWTDGen.sln, or next to the exe otherwise. The
+// current directory plays no part, so regress finds them wherever it is started from.
+fs::path DefaultRegressDir()
+{
+	for (auto dir = g_exePath.parent_path(); !dir.empty(); dir = dir.parent_path())
+	{
+		if (fs::exists(dir / L"CWTDGen.sln"))
+			return dir / L"regress";
+		if (dir == dir.parent_path())
+			break;
+	}
+	return g_exePath / L"regress";
+}
+
+// regress [--goldens=regress\goldens.ini] [--baseline=regress\baseline.ini] [--compare=bytes|pixels]
+//         [--threshold=10] [--size-threshold=1] [--repeat=3] [--font=<face>] [--dir=<work dir>]
+//         [--update-goldens] [--update-baseline] [--json=<results.json>|-]
+int CliRegress(const CliArgs& args)
+{
+	const auto regressDir = DefaultRegressDir();
+	const fs::path goldensPath = args.Get(L"goldens") ? fs::absolute(fs::path(*args.Get(L"goldens"))) : regressDir / L"goldens.ini";
+	const fs::path baselinePath = args.Get(L"baseline") ? fs::absolute(fs::path(*args.Get(L"baseline"))) : regressDir / L"baseline.ini";
+	const auto compare = args.Get(L"compare", L"bytes");
+	THROW_HR_IF_MSG(E_INVALIDARG, compare != L"bytes" && compare != L"pixels", "unknown compare mode %.*ls", static_cast<int>(compare.size()), compare.data());
+	const double threshold = std::stod(std::wstring(args.Get(L"threshold", L"10"))) / 100.0;
+	const double sizeThreshold = std::stod(std::wstring(args.Get(L"size-threshold", L"1"))) / 100.0;
+	const auto repeat = std::max(std::stoul(std::wstring(args.Get(L"repeat", L"3"))), 1ul);
+	const auto face = std::wstring(args.Get(L"font", L"Microsoft YaHei"));
+	const bool updateGoldens = args.Has(L"update-goldens"), updateBaseline = args.Has(L"update-baseline");
+	THROW_HR_IF_MSG(HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND), !updateGoldens && !fs::exists(goldensPath),
+		"no goldens at %ls, make them on the reference machine with --update-goldens", goldensPath.c_str());
+
+	wchar_t tempPath[MAX_PATH + 1];
+	THROW_LAST_ERROR_IF(GetTempPathW(static_cast<DWORD>(std::size(tempPath)), tempPath) == 0);
+	const fs::path dir = fs::absolute(args.Get(L"dir") ? fs::path(*args.Get(L"dir")) : fs::path(tempPath) / L"CWTDGen-regress");
+	fs::remove_all(dir / L"out");
+	fs::create_directories(dir / L"jobs");
+
+	// The three games get the small, medium and large stand-ins
+	static_assert(std::size(WtdFixtures) == std::size(Games));
+	const auto gamePath = dir / L"game";
+	for (size_t i = 0; i < std::size(Games); ++i)
+	{
+		const auto path = gamePath / Games[i].fontsPath;
+		fs::create_directories(path.parent_path());
+		WriteSyntheticWTD(path, WtdFixtures[i], 100 + static_cast<uint32_t>(i));
+	}
+	for (uint32_t i = 0; i < std::size(CharTableFixtures); ++i)
+		WriteSyntheticCharTable(dir / std::format(L"{}.dat", CharTableFixtures[i].name), CharTableFixtures[i], 200 + i);
+
+	if (updateGoldens || updateBaseline)
+	{
+		fs::create_directories(goldensPath.parent_path());
+		fs::create_directories(baselinePath.parent_path());
+	}
+	if (updateGoldens)
+		WriteIniString(goldensPath, L"info", L"font", face);
+	else if (auto goldenFont = GetIniString(goldensPath, L"info", L"font"); goldenFont && *goldenFont != face)
+		PrintError(L"warning: goldens were made with {}, not {}\n", *goldenFont, face);
+
+	const auto exe = GetModuleFsPath(nullptr);
+	size_t failures = 0;
+	JsonWriter json;
+	json.BeginObject();
+	json.Member("compare", compare);
+	json.Key("cases").BeginArray();
+
+	Print(L"{:<22} {:>10} {:>10} {:>10}  {}\n", L"case", L"ms", L"peak MiB", L"base ms", L"result");
+	for (const auto& c : RegressMatrix())
+	{
+		const auto jobPath = dir / L"jobs" / (c.name + L".ini");
+		const auto outputRoot = dir / L"out" / c.name;
+		WriteIniString(jobPath, c.name, L"gamePath", gamePath.wstring());
+		WriteIniString(jobPath, c.name, L"charTable", (dir / std::format(L"{}.dat", c.charTable->name)).wstring());
+		WriteIniString(jobPath, c.name, L"output", outputRoot.wstring());
+		WriteIniString(jobPath, c.name, L"backend", c.backend);
+		WriteIniString(jobPath, c.name, L"quote", c.quote);
+		WriteIniString(jobPath, c.name, L"font", face);
+
+		std::optional<ProcessRun> best;
+		for (unsigned long i = 0; i < repeat; ++i)
+		{
+			auto run = RunProcess(std::format(LR"("{}" batch "{}")", exe.wstring(), jobPath.wstring()));
+			if (run.exitCode != ExitSuccess)
+			{
+				best = run;
+				break;
+			}
+			if (!best || run.ms < best->ms)
+				best = run;
+		}
+
+		std::vector<std::wstring> problems;
+		if (best->exitCode != ExitSuccess)
+			problems.push_back(std::format(L"generation failed with exit code {}, rerun: CWTDGen batch \"{}\"", best->exitCode, jobPath.wstring()));
+
+		const double peakMiB = best->peakWorkingSet / 1048576.0;
+		const auto baseMs = GetIniString(baselinePath, c.name.c_str(), L"ms");
+		const auto basePeak = GetIniString(baselinePath, c.name.c_str(), L"peakMiB");
+
+		json.BeginObject();
+		json.Member("name", c.name);
+		json.Member("ms", best->ms);
+		json.Member("peakMiB", peakMiB);
+		json.Key("games").BeginArray();
+		for (const auto& game : Games)
+		{
+			if (best->exitCode != ExitSuccess)
+				break;
+
+			const auto out = outputRoot / game.newFontsPath;
+			const auto size = fs::file_size(out);
+			const auto bytesDigest = ToHex(Sha256(MapFileForRead(out).Data()));
+			const auto pixelsDigest = ToHex(Sha256(ReadFontChsPixels(ReadWTD(out))));
+			const auto bytesKey = std::format(L"{}.bytes", game.name), pixelsKey = std::format(L"{}.pixels", game.name), sizeKey = std::format(L"{}.size", game.name);
+
+			if (updateGoldens)
+			{
+				WriteIniString(goldensPath, c.name, bytesKey, bytesDigest);
+				WriteIniString(goldensPath, c.name, pixelsKey, pixelsDigest);
+			}
+			else
+			{
+				const auto golden = GetIniString(goldensPath, c.name.c_str(), compare == L"bytes" ? bytesKey.c_str() : pixelsKey.c_str());
+				if (!golden)
+					problems.push_back(std::format(L"{}: no golden", game.name));
+				else if (*golden != (compare == L"bytes" ? bytesDigest : pixelsDigest))
+					problems.push_back(std::format(L"{}: {} differ from golden", game.name, compare == L"bytes" ? L"bytes" : L"pixels"));
+			}
+
+			if (updateBaseline)
+				WriteIniString(baselinePath, c.name, sizeKey, std::to_wstring(size));
+			else if (auto baseSize = GetIniString(baselinePath, c.name.c_str(), sizeKey.c_str()))
+			{
+				const auto base = std::stoull(*baseSize);
+				if (size > base * (1.0 + sizeThreshold))
+					problems.push_back(std::format(L"{}: output grew from {} to {} bytes", game.name, base, size));
+			}
+
+			json.BeginObject();
+			json.Member("game", game.name);
+			json.Member("size", size);
+			json.Member("bytes", bytesDigest);
+			json.Member("pixels", pixelsDigest);
+			json.EndObject();
+		}
+		json.EndArray();
+
+		if (updateBaseline && best->exitCode == ExitSuccess)
+		{
+			WriteIniString(baselinePath, c.name, L"ms", std::format(L"{:.1f}", best->ms));
+			WriteIniString(baselinePath, c.name, L"peakMiB", std::format(L"{:.1f}", peakMiB));
+		}
+		else if (!updateBaseline)
+		{
+			if (baseMs && best->ms > std::stod(*baseMs) * (1.0 + threshold))
+				problems.push_back(std::format(L"{:.0f} ms, baseline {} ms", best->ms, *baseMs));
+			if (basePeak && peakMiB > std::stod(*basePeak) * (1.0 + threshold))
+				problems.push_back(std::format(L"peak {:.1f} MiB, baseline {} MiB", peakMiB, *basePeak));
+		}
+
+		json.Member("ok", problems.empty());
+		json.Key("problems").BeginArray();
+		for (const auto& problem : problems)
+			json.Value(problem);
+		json.EndArray();
+		json.EndObject();
+
+		Print(L"{:<22} {:>10.0f} {:>10.1f} {:>10}  {}\n", c.name, best->ms, peakMiB, baseMs.value_or(L"-"), problems.empty() ? L"ok" : L"FAILED");
+		for (const auto& problem : problems)
+			Print(L"    {}\n", problem);
+		failures += problems.empty() ? 0 : 1;
+	}
+	json.EndArray();
+	json.Member("failed", failures);
+	json.EndObject();
+
+	if (auto jsonPath = args.Get(L"json"))
+		WriteJsonOutput(*jsonPath, json);
+	if (updateGoldens)
+		Print(L"Updated {}\n", goldensPath.wstring());
+	if (updateBaseline)
+		Print(L"Updated {}\n", baselinePath.wstring());
+
+	return failures == 0 ? ExitSuccess : ExitFailure;
+}
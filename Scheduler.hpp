@@ -0,0 +1,150 @@
+#pragma once
+
+// Work stealing task scheduler. Each worker owns a deque: tasks submitted from a
+// worker go to the back of its own deque and are popped LIFO, idle workers steal
+// from the front of the others. Tasks submitted from outside are spread round-robin.
+// Only the deques have locks; the queued and pending counts are atomics that idle workers and
+// WaitIdle block on with wait and notify.
+class TaskScheduler
+{
+public:
+	using Task = std::function<void()>;
+
+	explicit TaskScheduler(size_t workerCount = std::max(std::thread::hardware_concurrency(), 1u))
+	{
+		// Without a worker nothing would ever run, and Submit would divide by zero
+		FAIL_FAST_IF(workerCount == 0);
+		m_workers.reserve(workerCount);
+		for (size_t i = 0; i < workerCount; ++i)
+			m_workers.emplace_back(std::make_unique<Worker>());
+		m_threads.reserve(workerCount);
+		for (size_t i = 0; i < workerCount; ++i)
+			m_threads.emplace_back([this, i] { WorkerLoop(i); });
+	}
+
+	// Workers finish the tasks still queued, then stop
+	~TaskScheduler()
+	{
+		m_queued.fetch_or(Stopping);
+		m_queued.notify_all();
+	}
+
+	TaskScheduler(const TaskScheduler&) = delete;
+	TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+	size_t WorkerCount() const { return m_workers.size(); }
+
+	void Submit(Task task)
+	{
+		size_t index = (s_owner == this) ? s_workerIndex : (m_nextWorker++ % m_workers.size());
+		// Pending first: a worker looking for another task may take this one as soon as it is in a deque
+		m_pending.fetch_add(1);
+		{
+			std::lock_guard lock(m_workers[index]->lock);
+			m_workers[index]->tasks.emplace_back(std::move(task));
+		}
+		m_queued.fetch_add(1);
+		m_queued.notify_one();
+	}
+
+	// Blocks until every submitted task, including the ones they submit, has finished
+	void WaitIdle()
+	{
+		for (size_t pending; (pending = m_pending.load()) != 0;)
+			m_pending.wait(pending);
+	}
+
+private:
+	struct Worker
+	{
+		std::mutex lock;
+		std::deque<Task> tasks;
+	};
+
+	std::optional<Task> TryTake(size_t index)
+	{
+		{
+			auto& own = *m_workers[index];
+			std::lock_guard lock(own.lock);
+			if (!own.tasks.empty())
+			{
+				auto task = std::move(own.tasks.back());
+				own.tasks.pop_back();
+				return task;
+			}
+		}
+		for (size_t i = 1; i < m_workers.size(); ++i)
+		{
+			auto& victim = *m_workers[(index + i) % m_workers.size()];
+			std::lock_guard lock(victim.lock);
+			if (!victim.tasks.empty())
+			{
+				auto task = std::move(victim.tasks.front());
+				victim.tasks.pop_front();
+				return task;
+			}
+		}
+		return std::nullopt;
+	}
+
+	// Claims one of the queued tasks, waiting for one if there are none. False once the
+	// scheduler is stopping and nothing is left.
+	bool Claim()
+	{
+		size_t queued = m_queued.load();
+		while (true)
+		{
+			if ((queued & ~Stopping) != 0)
+			{
+				if (m_queued.compare_exchange_weak(queued, queued - 1))
+					return true;
+			}
+			else if (queued & Stopping)
+				return false;
+			else
+			{
+				m_queued.wait(queued);
+				queued = m_queued.load();
+			}
+		}
+	}
+
+	void WorkerLoop(size_t index)
+	{
+		s_owner = this;
+		s_workerIndex = index;
+		TraceRecorder::SetThreadName(std::format(L"worker {}", index));
+
+		while (Claim())
+		{
+			// A task is queued somewhere, keep looking until it is found
+			std::optional<Task> task;
+			while (!(task = TryTake(index)))
+				std::this_thread::yield();
+
+			try
+			{
+				(*task)();
+			}
+			CATCH_LOG();
+
+			if (m_pending.fetch_sub(1) == 1)
+				m_pending.notify_all();
+		}
+	}
+
+	std::vector<std::unique_ptr<Worker>> m_workers;
+	std::atomic<size_t> m_nextWorker = 0;
+
+	static constexpr size_t Stopping = size_t(1) << (sizeof(size_t) * 8 - 1);
+	std::atomic<size_t> m_queued = 0; // Tasks in deques not yet claimed by a worker, and Stopping
+	std::atomic<size_t> m_pending = 0; // Tasks submitted and not yet finished
+
+	std::vector<std::jthread> m_threads; // Last, so workers stop before the state they use goes away
+
+	static thread_local TaskScheduler* s_owner;
+	static thread_local size_t s_workerIndex;
+};
+
+thread_local TaskScheduler* TaskScheduler::s_owner = nullptr;
+thread_local size_t TaskScheduler::s_workerIndex = 0;
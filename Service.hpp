@@ -0,0 +1,395 @@
+#pragma once
+
+// Resident generation service. The factories, text formats, char tables, decoded
+// fonts.wtd files and rendered atlases stay loaded between requests, so only the
+// first request of a kind pays for them.
+//
+// Listens on 127.0.0.1. Any local process can connect, so a random token is
+// printed at startup and every request has to carry it. Every message is a frame: a little endian uint32 length,
+// then that many bytes. A request is one frame of UTF-8 text, the command on the
+// first line, then key=value lines, one of them token=<the printed token>:
+//
+// generate  batch job keys (see Batch.hpp), plus name. Paths are relative to --root, outputs outside it are refused.
+// preview   font, symbolFont, fallbackFonts, weight, backend, quote, glyph effects, text, width, height, zoom, top (see Preview.hpp)
+// stats     cache counters
+// shutdown  stops the service after answering
+//
+// Each response is two frames: a JSON object with at least "ok", then a body,
+// a PNG for preview and empty for everything else.
+
+constexpr uint16_t DefaultServicePort = 47810;
+constexpr uint32_t MaxFrameSize = 16 * 1024 * 1024;
+constexpr size_t MaxCachedPreviews = 256;
+
+class WinsockInit
+{
+public:
+	WinsockInit()
+	{
+		WSADATA data;
+		THROW_IF_WIN32_ERROR(WSAStartup(MAKEWORD(2, 2), &data));
+	}
+	~WinsockInit() { WSACleanup(); }
+
+	WinsockInit(const WinsockInit&) = delete;
+	WinsockInit& operator=(const WinsockInit&) = delete;
+};
+
+void SendAll(SOCKET s, const void* data, size_t size)
+{
+	auto p = static_cast<const char*>(data);
+	while (size != 0)
+	{
+		int sent = send(s, p, static_cast<int>(std::min<size_t>(size, INT_MAX)), 0);
+		THROW_HR_IF(HRESULT_FROM_WIN32(WSAGetLastError()), sent == SOCKET_ERROR);
+		p += sent;
+		size -= sent;
+	}
+}
+
+// False if the peer closed the connection before the first byte
+bool RecvAll(SOCKET s, void* data, size_t size)
+{
+	auto p = static_cast<char*>(data);
+	bool first = true;
+	while (size != 0)
+	{
+		int received = recv(s, p, static_cast<int>(std::min<size_t>(size, INT_MAX)), 0);
+		THROW_HR_IF(HRESULT_FROM_WIN32(WSAGetLastError()), received == SOCKET_ERROR);
+		if (received == 0)
+		{
+			THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_HANDLE_EOF), !first);
+			return false;
+		}
+		first = false;
+		p += received;
+		size -= received;
+	}
+	return true;
+}
+
+void SendFrame(SOCKET s, std::span<const uint8_t> payload)
+{
+	THROW_HR_IF(E_INVALIDARG, payload.size() > MaxFrameSize);
+	const uint32_t length = static_cast<uint32_t>(payload.size()); // x86 is little endian
+	SendAll(s, &length, sizeof(length));
+	SendAll(s, payload.data(), payload.size());
+}
+
+std::wstring NewServiceToken()
+{
+	std::array<uint8_t, 16> bytes;
+	THROW_IF_NTSTATUS_FAILED(BCryptGenRandom(nullptr, bytes.data(), static_cast<ULONG>(bytes.size()), BCRYPT_USE_SYSTEM_PREFERRED_RNG));
+	return ToHex(bytes);
+}
+
+// Takes as long for a wrong first character as for a wrong last one
+bool TokenEquals(std::wstring_view l, std::wstring_view r)
+{
+	if (l.size() != r.size())
+		return false;
+	wchar_t diff = 0;
+	for (size_t i = 0; i < l.size(); ++i)
+		diff |= l[i] ^ r[i];
+	return diff == 0;
+}
+
+// Both paths absolute. Resolves .. and links first, so neither can leave root.
+bool IsUnderRoot(const fs::path& path, const fs::path& root)
+{
+	const auto p = fs::weakly_canonical(path);
+	const auto r = fs::weakly_canonical(root);
+	auto pi = p.begin();
+	for (auto ri = r.begin(); ri != r.end(); ++ri, ++pi)
+	{
+		if (ri->empty()) // Trailing separator
+			continue;
+		if (pi == p.end() || !EqualsIgnoreCase(pi->native(), ri->native()))
+			return false;
+	}
+	return true;
+}
+
+std::optional<std::vector<uint8_t>> RecvFrame(SOCKET s)
+{
+	uint32_t length;
+	if (!RecvAll(s, &length, sizeof(length)))
+		return std::nullopt;
+	THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_INVALID_DATA), length > MaxFrameSize);
+	std::vector<uint8_t> payload(length);
+	if (length != 0 && !RecvAll(s, payload.data(), length))
+		THROW_HR(HRESULT_FROM_WIN32(ERROR_HANDLE_EOF));
+	return payload;
+}
+
+struct ServiceRequest
+{
+	std::wstring command;
+	std::unordered_map<std::wstring, std::wstring> values;
+
+	std::optional<std::wstring> Get(const wchar_t* key) const
+	{
+		if (auto it = values.find(key); it != values.end() && !it->second.empty())
+			return it->second;
+		return std::nullopt;
+	}
+};
+
+ServiceRequest ParseServiceRequest(std::span<const uint8_t> payload)
+{
+	const auto text = Utf8ToUtf16(std::string_view(reinterpret_cast<const char*>(payload.data()), payload.size()));
+
+	ServiceRequest request;
+	bool first = true;
+	for (std::wstring_view line : SplitList(text, L'\n'))
+	{
+		if (line.ends_with(L'\r'))
+			line.remove_suffix(1);
+		if (first)
+		{
+			request.command = line;
+			first = false;
+			continue;
+		}
+		auto pos = line.find(L'=');
+		THROW_HR_IF_MSG(E_INVALIDARG, pos == std::wstring_view::npos, "bad request line %.*ls", static_cast<int>(line.size()), line.data());
+		request.values.insert_or_assign(std::wstring(line.substr(0, pos)), std::wstring(line.substr(pos + 1)));
+	}
+	THROW_HR_IF(E_INVALIDARG, request.command.empty());
+	return request;
+}
+
+class GenerationService
+{
+public:
+	// Relative paths in requests resolve against root, and outputs have to stay in it
+	GenerationService(TaskScheduler& scheduler, fs::path root) :
+		m_scheduler(scheduler), m_root(fs::absolute(std::move(root)).lexically_normal()), m_token(NewServiceToken()) {}
+
+	GenerationService(const GenerationService&) = delete;
+	GenerationService& operator=(const GenerationService&) = delete;
+
+	// Returns after a shutdown request has been answered
+	void Run(uint16_t port)
+	{
+		m_listener.reset(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+		THROW_HR_IF(HRESULT_FROM_WIN32(WSAGetLastError()), !m_listener);
+
+		sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		THROW_HR_IF(HRESULT_FROM_WIN32(WSAGetLastError()), bind(m_listener.get(), reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == SOCKET_ERROR);
+		THROW_HR_IF(HRESULT_FROM_WIN32(WSAGetLastError()), listen(m_listener.get(), SOMAXCONN) == SOCKET_ERROR);
+
+		m_port = port;
+		m_started = std::chrono::steady_clock::now();
+		PrintError(L"Listening on 127.0.0.1:{}, root {}\n", port, m_root.wstring());
+		PrintError(L"Token: {}\n", m_token);
+
+		// A closed connection's thread is joined on the next accept
+		struct Connection
+		{
+			std::shared_ptr<std::atomic<bool>> done = std::make_shared<std::atomic<bool>>(false);
+			std::jthread thread;
+		};
+		std::vector<Connection> connections;
+		while (!m_stopping)
+		{
+			wil::unique_socket client(accept(m_listener.get(), nullptr, nullptr));
+			if (m_stopping)
+				break;
+			std::erase_if(connections, [](const Connection& connection) { return connection.done->load(); });
+			if (!client)
+				continue;
+
+			const BOOL noDelay = TRUE; // Responses are small and latency bound
+			setsockopt(client.get(), IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+
+			{
+				std::lock_guard lock(m_clientsLock);
+				m_clients.insert(client.get());
+			}
+			Connection connection;
+			connection.thread = std::jthread([this, done = connection.done, client = std::move(client)] () mutable {
+				auto finished = wil::scope_exit([&] { *done = true; });
+				Serve(std::move(client));
+			});
+			connections.push_back(std::move(connection));
+		}
+
+		// Wake the connections still waiting for a request
+		{
+			std::lock_guard lock(m_clientsLock);
+			for (auto s : m_clients)
+				shutdown(s, SD_BOTH);
+		}
+	}
+
+private:
+	void Serve(wil::unique_socket client)
+	{
+		auto forget = wil::scope_exit([&] {
+			std::lock_guard lock(m_clientsLock);
+			m_clients.erase(client.get());
+		});
+
+		try
+		{
+			while (auto frame = RecvFrame(client.get()))
+			{
+				const auto start = std::chrono::steady_clock::now();
+				JsonWriter json;
+				std::vector<uint8_t> body;
+				std::wstring command;
+				json.BeginObject();
+				try
+				{
+					auto request = ParseServiceRequest(*frame);
+					const auto token = request.Get(L"token");
+					THROW_HR_IF_MSG(E_ACCESSDENIED, !token || !TokenEquals(*token, m_token), "missing or wrong token");
+					command = request.command;
+					Handle(request, json, body);
+					json.Member("ok", true);
+				}
+				catch (...)
+				{
+					const auto hr = wil::ResultFromCaughtException();
+					json.Member("ok", false);
+					json.Member("hresult", static_cast<uint32_t>(hr));
+					json.Member("message", HResultMessage(hr));
+				}
+				const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+				json.Member("elapsedMs", elapsed.count());
+				json.EndObject();
+				++m_requests;
+
+				const auto& str = json.Str();
+				SendFrame(client.get(), { reinterpret_cast<const uint8_t*>(str.data()), str.size() });
+				SendFrame(client.get(), body);
+
+				if (command == L"shutdown")
+					Stop();
+			}
+		}
+		CATCH_LOG(); // A broken connection only ends that connection
+	}
+
+	// Wakes the accept loop with a connection of its own
+	void Stop()
+	{
+		m_stopping = true;
+		wil::unique_socket wake(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+		sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(m_port) };
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (wake)
+			connect(wake.get(), reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
+	}
+
+	void Handle(const ServiceRequest& request, JsonWriter& json, std::vector<uint8_t>& body)
+	{
+		if (request.command == L"generate")
+		{
+			const auto name = request.Get(L"name").value_or(L"service");
+			const auto job = ParseBatchJob(name, [&](const wchar_t* key) { return request.Get(key); }, m_root);
+			THROW_HR_IF_MSG(E_ACCESSDENIED, !IsUnderRoot(job.outputRoot, m_root), "output %ls is outside %ls", job.outputRoot.c_str(), m_root.c_str());
+			auto result = StartGenerate(m_scheduler, m_caches, job);
+			result->Wait();
+			THROW_IF_FAILED(result->Result());
+
+			json.Key("outputs").BeginArray();
+			for (const auto& out : result->Outputs())
+				json.Value(out.wstring());
+			json.EndArray();
+			json.Key("uncovered").BeginArray();
+			for (const auto ch : result->Uncovered())
+				json.Value(static_cast<uint32_t>(ch));
+			json.EndArray();
+		}
+		else if (request.command == L"preview")
+		{
+			body = *Preview(request);
+		}
+		else if (request.command == L"stats")
+		{
+			auto member = [&](std::string_view key, auto stats) {
+				json.Key(key).BeginObject();
+				json.Member("entries", stats.entries);
+				json.Member("bytes", stats.bytes);
+				json.Member("hits", stats.hits);
+				json.Member("misses", stats.misses);
+				json.EndObject();
+			};
+			member("charTables", m_caches.charTables.GetStats());
+			member("sources", m_caches.sources.GetStats());
+			member("images", m_caches.images.GetStats());
+			member("previews", m_previews.GetStats());
+			json.Member("requests", m_requests.load());
+			json.Member("uptimeMs", std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_started).count());
+		}
+		else if (request.command != L"shutdown")
+		{
+			THROW_HR_MSG(E_INVALIDARG, "unknown command %ls", request.command.c_str());
+		}
+	}
+
+	SharedCache<std::vector<uint8_t>>::Ptr Preview(const ServiceRequest& request)
+	{
+		// Only the font keys are used, gamePath is not needed to preview
+		auto get = [&](const wchar_t* key) -> std::optional<std::wstring> {
+			if (std::wstring_view(key) == L"gamePath")
+				return L".";
+			return request.Get(key);
+		};
+		const auto job = ParseBatchJob(L"preview", get, m_root);
+		const auto text = request.Get(L"text").value_or(L"");
+		THROW_HR_IF_MSG(E_INVALIDARG, text.empty(), "text is required");
+		const auto width = std::stoul(request.Get(L"width").value_or(L"800"));
+		const auto height = std::stoul(request.Get(L"height").value_or(L"600"));
+		const auto zoom = std::stof(request.Get(L"zoom").value_or(L"0"));
+		const auto top = std::stoul(request.Get(L"top").value_or(L"0"));
+
+		const auto key = std::format(L"{}|{}|{}|{}|{}x{}|{}|{}|{}", FontSetKey(job.options.fonts),
+			job.options.useGDIP, job.options.replaceChars, GlyphEffectsKey(job.options.effects), width, height, zoom, top, text);
+
+		// Designers send the same few strings over and over, but not forever
+		if (m_previews.GetStats().entries >= MaxCachedPreviews)
+			m_previews.Clear();
+
+		return m_previews.Get(key, [&] {
+			auto hBitmap = RenderPreview(job.options, Utf16ToUtf32(text), width, height, zoom, top);
+			return GpEncodePng(hBitmap.get());
+		});
+	}
+
+	TaskScheduler& m_scheduler;
+	const fs::path m_root;
+	const std::wstring m_token;
+	GeneratorCaches m_caches;
+	SharedCache<std::vector<uint8_t>> m_previews;
+
+	wil::unique_socket m_listener;
+	uint16_t m_port = 0;
+	std::atomic<bool> m_stopping = false;
+	std::mutex m_clientsLock;
+	std::unordered_set<SOCKET> m_clients;
+
+	std::atomic<uint64_t> m_requests = 0;
+	std::chrono::steady_clock::time_point m_started;
+};
+
+// serve --root=<dir> [--port=N] [--threads=N]
+int CliServe(const CliArgs& args)
+{
+	const auto root = args.Get(L"root");
+	if (!root)
+		return ExitUsage;
+
+	WinsockInit winsock;
+
+	const auto port = std::stoul(std::wstring(args.Get(L"port", std::to_wstring(DefaultServicePort))));
+	THROW_HR_IF(E_INVALIDARG, port == 0 || port > UINT16_MAX);
+	TaskScheduler scheduler(args.GetCount(L"threads").value_or(std::max(std::thread::hardware_concurrency(), 1u)));
+
+	GenerationService service(scheduler, fs::path(*root));
+	service.Run(static_cast<uint16_t>(port));
+	return ExitSuccess;
+}
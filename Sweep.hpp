@@ -0,0 +1,431 @@
+#pragma once
+
+// Puts fonts, sizes, weights and backends side by side. Every combination draws the same sample
+// of characters on its own worker, sharing the DirectWrite factory, the text formats and the
+// font coverage with the others. The sample is drawn into a probe grid with an empty cell around
+// each glyph, so ink that leaves its CharWidth x CharHeight cell lands where it can be measured
+// instead of in a neighbour. GDI+ is drawn without clipping for the same reason: in the atlas it
+// cuts that ink off at the cell, where DirectWrite lets it into the next cell. Each glyph's own
+// cell then goes into a labelled panel, and the panels onto contact sheets.
+
+// Wide, tall and dense glyphs of each kind the atlas holds: ASCII, full-width punctuation,
+// simplified and traditional Chinese and full-width Latin
+constexpr std::u32string_view SweepSample =
+	U"AMWQgjy|@%&0123456789"
+	U"\uFF0C\u3002\uFF01\uFF1F\u201C\u201D\uFF08\uFF09\u300A\u300B\u2014\u2026"
+	U"\u7684\u4E00\u662F\u6211\u56FD\u946B\u56CA\u7586\u9748\u9B31\u8D0F\u64CA\u56B4\u9AD4\u5C6C\u97FF\u986F\u9A5A\u7C60\u9F98"
+	U"\uFF37\uFF2D";
+
+constexpr LONG SweepSheetWidth = 2048;
+constexpr int SweepLabelHeight = 20;
+
+struct SweepCombination
+{
+	std::wstring face;
+	LONG size;
+	LONG weight;
+	bool gdip;
+	GenerateOptions options;
+
+	std::wstring Label() const { return std::format(L"{} {}px {} {}", face, size, weight, gdip ? L"gdip" : L"dwrite"); }
+};
+
+// Ink of the sample glyphs past their cells. Extents count pixels from InkThreshold coverage, so
+// antialiasing fringes don't make every glyph overflow; the sums count all of it.
+struct InkOverflow
+{
+	static constexpr uint8_t InkThreshold = 32;
+
+	uint32_t glyphs = 0; // Glyphs with ink past their cell
+	uint32_t left = 0, top = 0, right = 0, bottom = 0; // Furthest any glyph reaches past each edge, in pixels
+	uint64_t ink = 0;
+	uint64_t outside = 0;
+
+	uint32_t Max() const { return std::max({ left, top, right, bottom }); }
+	double OutsideFraction() const { return ink == 0 ? 0 : static_cast<double>(outside) / ink; }
+};
+
+struct SweepResult
+{
+	InkOverflow overflow;
+	wil::unique_hbitmap panel; // Already scaled for the sheet
+	HRESULT hr = S_OK;
+};
+
+// A list of values and start:end[:step] ranges, e.g. 50:60:2,64
+std::vector<LONG> ParseSweepValues(const wchar_t* name, std::wstring_view list)
+{
+	std::vector<LONG> values;
+	for (const auto& item : SplitList(list))
+	{
+		const auto parts = SplitList(item, L':');
+		THROW_HR_IF_MSG(E_INVALIDARG, parts.empty() || parts.size() > 3, "bad %ls %ls", name, item.c_str());
+		const LONG start = std::stol(parts[0]), end = parts.size() > 1 ? std::stol(parts[1]) : start, step = parts.size() > 2 ? std::stol(parts[2]) : 1;
+		THROW_HR_IF_MSG(E_INVALIDARG, step <= 0 || end < start, "bad %ls range %ls", name, item.c_str());
+		for (LONG value = start; value <= end; value += step)
+			values.push_back(value);
+	}
+	THROW_HR_IF_MSG(E_INVALIDARG, values.empty(), "no %ls", name);
+	return values;
+}
+
+// The sample in odd cells of odd rows, columns glyphs to a row, on a grid of 2 * columns + 1 cells across
+std::u32string SweepProbeText(std::u32string_view sample, uint32_t columns)
+{
+	const size_t rows = (sample.size() + columns - 1) / columns, xChars = 2 * columns + 1;
+	std::u32string text(xChars * (2 * rows + 1), U' ');
+	for (size_t i = 0; i < sample.size(); ++i)
+		text[(2 * (i / columns) + 1) * xChars + 2 * (i % columns) + 1] = sample[i];
+	return text;
+}
+
+// As RenderCharsBitmap, without clipping at the cells
+CharsBitmap RenderSweepProbe(const GenerateOptions& options, std::u32string_view text, uint32_t xChars, uint32_t yChars)
+{
+	TRACE_SCOPE("sweep probe");
+	CharsBitmap bitmap = { .width = xChars * CharWidth, .height = yChars * CharHeight };
+	wil::unique_hdc hdc(CreateCompatibleDC(nullptr));
+	THROW_HR_IF(E_FAIL, !hdc);
+	bitmap.hBitmap = CreateDIB(hdc.get(), static_cast<LONG>(bitmap.width), static_cast<LONG>(bitmap.height), 32, reinterpret_cast<void**>(&bitmap.bits));
+	THROW_HR_IF(E_FAIL, !bitmap.hBitmap);
+	auto selectBitmap = wil::SelectObject(hdc.get(), bitmap.hBitmap.get());
+	std::fill_n(bitmap.bits, bitmap.Image().slicePitch, '\0');
+
+	if (options.useGDIP)
+		GpDrawCharacters(hdc.get(), options.fonts, text, xChars, yChars, options.replaceChars, nullptr, nullptr, false);
+	else
+		DWriteDrawCharacters(hdc.get(), static_cast<LONG>(bitmap.width), static_cast<LONG>(bitmap.height), options.fonts, text, xChars, yChars, options.replaceChars, options.fonts.EmSize());
+	GdiFlush();
+	ApplyGlyphEffects(bitmap.Image(), options.effects);
+	return bitmap;
+}
+
+// Each glyph owns half of the empty cells around it. overflowing gets a flag per glyph.
+InkOverflow MeasureInkOverflow(const CharsBitmap& probe, size_t count, uint32_t columns, std::vector<uint8_t>& overflowing)
+{
+	InkOverflow overflow;
+	overflowing.assign(count, 0);
+	const auto img = probe.Image();
+	for (size_t i = 0; i < count; ++i)
+	{
+		const size_t cellLeft = (2 * (i % columns) + 1) * CharWidth, cellTop = (2 * (i / columns) + 1) * CharHeight;
+		const size_t cellRight = cellLeft + CharWidth, cellBottom = cellTop + CharHeight;
+		uint32_t left = 0, top = 0, right = 0, bottom = 0;
+		for (size_t y = cellTop - CharHeight / 2; y < cellBottom + CharHeight / 2; ++y)
+		{
+			const auto row = img.pixels + y * img.rowPitch;
+			const bool insideY = y >= cellTop && y < cellBottom;
+			for (size_t x = cellLeft - CharWidth / 2; x < cellRight + CharWidth / 2; ++x)
+			{
+				const uint8_t alpha = row[x * 4 + 3];
+				overflow.ink += alpha;
+				if (insideY && x >= cellLeft && x < cellRight)
+					continue;
+				overflow.outside += alpha;
+				if (alpha < InkOverflow::InkThreshold)
+					continue;
+
+				if (x < cellLeft)
+					left = std::max(left, static_cast<uint32_t>(cellLeft - x));
+				else if (x >= cellRight)
+					right = std::max(right, static_cast<uint32_t>(x - cellRight + 1));
+				if (y < cellTop)
+					top = std::max(top, static_cast<uint32_t>(cellTop - y));
+				else if (y >= cellBottom)
+					bottom = std::max(bottom, static_cast<uint32_t>(y - cellBottom + 1));
+			}
+		}
+
+		if (left != 0 || top != 0 || right != 0 || bottom != 0)
+		{
+			overflowing[i] = 1;
+			++overflow.glyphs;
+		}
+		overflow.left = std::max(overflow.left, left);
+		overflow.top = std::max(overflow.top, top);
+		overflow.right = std::max(overflow.right, right);
+		overflow.bottom = std::max(overflow.bottom, bottom);
+	}
+	return overflow;
+}
+
+// Each glyph's cell from the probe over a checkered background, on red where it overflows,
+// scaled to panelWidth x panelHeight
+wil::unique_hbitmap RenderSweepPanel(const CharsBitmap& probe, size_t count, uint32_t columns, std::span<const uint8_t> overflowing, LONG panelWidth, LONG panelHeight)
+{
+	const uint32_t rows = static_cast<uint32_t>((count + columns - 1) / columns);
+	const LONG width = static_cast<LONG>(columns * CharWidth), height = static_cast<LONG>(rows * CharHeight);
+	wil::unique_hdc hdc(CreateCompatibleDC(nullptr));
+	THROW_HR_IF(E_FAIL, !hdc);
+	RGBQUAD* bits;
+	auto panel = CreateDIB(hdc.get(), width, height, 32, reinterpret_cast<void**>(&bits));
+	THROW_HR_IF(E_FAIL, !panel);
+	{
+		auto selectPanel = wil::SelectObject(hdc.get(), panel.get());
+		GDIDrawCheckeredBackground(hdc.get(), width, height, columns, rows);
+		wil::unique_hbrush red(CreateSolidBrush(RGB(0x70, 0x20, 0x20)));
+		THROW_HR_IF(E_FAIL, !red);
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (!overflowing[i])
+				continue;
+			const LONG left = static_cast<LONG>(i % columns * CharWidth), top = static_cast<LONG>(i / columns * CharHeight);
+			const RECT rect = { left, top, left + static_cast<LONG>(CharWidth), top + static_cast<LONG>(CharHeight) };
+			FillRect(hdc.get(), &rect, red.get());
+		}
+		GdiFlush();
+	}
+
+	// Premultiplied glyphs over the background
+	const auto src = reinterpret_cast<const RGBQUAD*>(probe.bits);
+	for (size_t i = 0; i < count; ++i)
+	{
+		const size_t srcLeft = (2 * (i % columns) + 1) * CharWidth, srcTop = (2 * (i / columns) + 1) * CharHeight;
+		const size_t dstLeft = i % columns * CharWidth, dstTop = i / columns * CharHeight;
+		for (size_t y = 0; y < CharHeight; ++y)
+		{
+			const auto s = src + (srcTop + y) * probe.width + srcLeft;
+			const auto d = bits + (dstTop + y) * static_cast<size_t>(width) + dstLeft;
+			for (size_t x = 0; x < CharWidth; ++x)
+			{
+				const uint32_t inverse = 255 - s[x].rgbReserved;
+				d[x].rgbBlue = static_cast<BYTE>(s[x].rgbBlue + MulDiv255(d[x].rgbBlue, inverse));
+				d[x].rgbGreen = static_cast<BYTE>(s[x].rgbGreen + MulDiv255(d[x].rgbGreen, inverse));
+				d[x].rgbRed = static_cast<BYTE>(s[x].rgbRed + MulDiv255(d[x].rgbRed, inverse));
+			}
+		}
+	}
+
+	// Kept only at sheet scale, a sweep holds many of them
+	wil::unique_hdc hdcScaled(CreateCompatibleDC(nullptr));
+	THROW_HR_IF(E_FAIL, !hdcScaled);
+	auto scaled = CreateDIB(hdcScaled.get(), panelWidth, panelHeight, 32);
+	THROW_HR_IF(E_FAIL, !scaled);
+	{
+		auto selectPanel = wil::SelectObject(hdc.get(), panel.get());
+		auto selectScaled = wil::SelectObject(hdcScaled.get(), scaled.get());
+		SetStretchBltMode(hdcScaled.get(), HALFTONE);
+		SetBrushOrgEx(hdcScaled.get(), 0, 0, nullptr);
+		StretchBlt(hdcScaled.get(), 0, 0, panelWidth, panelHeight, hdc.get(), 0, 0, width, height, SRCCOPY);
+		GdiFlush();
+	}
+	return scaled;
+}
+
+// The panels of combinations [first, first + count) under their labels
+wil::unique_hbitmap RenderSweepSheet(std::span<const SweepCombination> combinations, std::span<const SweepResult> results, size_t first, size_t count,
+	LONG panelWidth, LONG panelHeight)
+{
+	TRACE_SCOPE("sweep sheet");
+	const LONG across = std::max<LONG>(1, SweepSheetWidth / panelWidth);
+	const LONG down = static_cast<LONG>((count + across - 1) / across);
+	const LONG width = across * panelWidth, height = down * (SweepLabelHeight + panelHeight);
+
+	wil::unique_hdc hdc(CreateCompatibleDC(nullptr));
+	THROW_HR_IF(E_FAIL, !hdc);
+	RGBQUAD* bits;
+	auto sheet = CreateDIB(hdc.get(), width, height, 32, reinterpret_cast<void**>(&bits));
+	THROW_HR_IF(E_FAIL, !sheet);
+	wil::unique_hdc hdcPanel(CreateCompatibleDC(hdc.get()));
+	THROW_HR_IF(E_FAIL, !hdcPanel);
+	{
+		auto selectSheet = wil::SelectObject(hdc.get(), sheet.get());
+		auto selectFont = wil::SelectObject(hdc.get(), GetStockObject(DEFAULT_GUI_FONT));
+		const RECT all = { 0, 0, width, height };
+		FillRect(hdc.get(), &all, static_cast<HBRUSH>(GetStockObject(BLACK_BRUSH)));
+		SetBkMode(hdc.get(), TRANSPARENT);
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			const auto& combination = combinations[first + i];
+			const auto& result = results[first + i];
+			const LONG left = static_cast<LONG>(i % across) * panelWidth, top = static_cast<LONG>(i / across) * (SweepLabelHeight + panelHeight);
+
+			std::wstring label;
+			if (FAILED(result.hr))
+				label = std::format(L"{}: {}", combination.Label(), HResultMessage(result.hr));
+			else
+				label = std::format(L"{}: {} over, {} px, {:.2f}% ink", combination.Label(), result.overflow.glyphs, result.overflow.Max(), result.overflow.OutsideFraction() * 100);
+			SetTextColor(hdc.get(), FAILED(result.hr) || result.overflow.glyphs != 0 ? RGB(0xff, 0x80, 0x80) : RGB(0xff, 0xff, 0xff));
+			RECT labelRect = { left + 4, top, left + panelWidth - 4, top + SweepLabelHeight };
+			DrawTextW(hdc.get(), label.c_str(), static_cast<int>(label.size()), &labelRect, DT_LEFT | DT_VCENTER | DT_SINGLELINE | DT_NOPREFIX | DT_END_ELLIPSIS);
+
+			if (!result.panel)
+				continue;
+			auto selectPanel = wil::SelectObject(hdcPanel.get(), result.panel.get());
+			BitBlt(hdc.get(), left, top + SweepLabelHeight, panelWidth, panelHeight, hdcPanel.get(), 0, 0, SRCCOPY);
+		}
+		GdiFlush();
+	}
+	SetBitmapAlpha(bits, static_cast<uint32_t>(width), static_cast<uint32_t>(height), 255);
+	return sheet;
+}
+
+// sweep --font=<face,...> [--size=52:64:2] [--weight=400,700] [--backend=dwrite,gdip] [--chars=<text>|--charTable=<char_table.dat>] [--sample=N]
+//       [--columns=16] [--scale=0.5] [--perSheet=48] [--out=<dir>] [--symbolFont=<face>] [--fallbackFonts=<face,...>] [--quote=cn|en] [--json=<results.json>|-]
+int CliSweep(const CliArgs& args)
+{
+	const auto fontList = args.Get(L"font");
+	if (!fontList)
+		return ExitUsage;
+
+	const auto faces = SplitList(*fontList);
+	const auto sizes = ParseSweepValues(L"size", args.Get(L"size", L"58"));
+	const auto weights = ParseSweepValues(L"weight", args.Get(L"weight", L"700"));
+	std::vector<bool> backends;
+	for (const auto& backend : SplitList(args.Get(L"backend", L"dwrite")))
+	{
+		THROW_HR_IF_MSG(E_INVALIDARG, !EqualsIgnoreCase(backend, L"dwrite") && !EqualsIgnoreCase(backend, L"gdip"), "unknown backend %ls", backend.c_str());
+		backends.push_back(EqualsIgnoreCase(backend, L"gdip"));
+	}
+	THROW_HR_IF_MSG(E_INVALIDARG, faces.empty() || backends.empty(), "no font or backend");
+
+	// A character table is sampled evenly through, so rare characters are in it too
+	std::u32string sample;
+	size_t sampleSize = std::stoul(std::wstring(args.Get(L"sample", L"0")));
+	if (auto charTablePath = args.Get(L"charTable"))
+	{
+		const auto charTable = LoadCharTable(fs::path(*charTablePath));
+		std::u32string chars;
+		std::ranges::copy_if(charTable.Chars(), std::back_inserter(chars), [](char32_t ch) { return ch != U' ' && !IgnoreSet.contains(ch); });
+		sampleSize = std::min(sampleSize == 0 ? 64 : sampleSize, chars.size());
+		for (size_t i = 0; i < sampleSize; ++i)
+			sample += chars[i * chars.size() / sampleSize];
+	}
+	else
+	{
+		const auto chars = args.Get(L"chars") ? Utf16ToUtf32(*args.Get(L"chars")) : std::u32string(SweepSample);
+		std::ranges::copy_if(chars, std::back_inserter(sample), [](char32_t ch) { return ch != U' ' && !IgnoreSet.contains(ch); });
+		if (sampleSize != 0 && sampleSize < sample.size())
+			sample.resize(sampleSize);
+	}
+	THROW_HR_IF_MSG(E_INVALIDARG, sample.empty(), "nothing to sample");
+
+	const auto columns = static_cast<uint32_t>(std::clamp<size_t>(std::stoul(std::wstring(args.Get(L"columns", L"16"))), 1, sample.size()));
+	const float scale = std::clamp(std::stof(std::wstring(args.Get(L"scale", L"0.5"))), MinPreviewScale, 1.0f);
+	const size_t perSheet = std::max<size_t>(1, std::stoul(std::wstring(args.Get(L"perSheet", L"48"))));
+	const fs::path out(args.Get(L"out", L"sweep"));
+
+	// Every combination is parsed before any is drawn, so bad values fail at once
+	std::vector<SweepCombination> combinations;
+	for (const auto& face : faces)
+	{
+		for (const auto size : sizes)
+		{
+			for (const auto weight : weights)
+			{
+				for (const bool gdip : backends)
+				{
+					SweepCombination combination = { face, size, weight, gdip };
+					combination.options = ParseGenerateOptions(combination.Label(), [&](const wchar_t* key) -> std::optional<std::wstring> {
+						const std::wstring_view name(key);
+						if (name == L"font")
+							return face;
+						if (name == L"size")
+							return std::to_wstring(size);
+						if (name == L"weight")
+							return std::to_wstring(weight);
+						if (name == L"backend")
+							return gdip ? L"gdip" : L"dwrite";
+						if (auto value = args.Get(name))
+							return std::wstring(*value);
+						return std::nullopt;
+					});
+					combinations.push_back(std::move(combination));
+				}
+			}
+		}
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	const auto probeText = SweepProbeText(sample, columns);
+	const uint32_t rows = static_cast<uint32_t>((sample.size() + columns - 1) / columns);
+	const LONG panelWidth = std::max(1L, std::lround(columns * CharWidth * scale)), panelHeight = std::max(1L, std::lround(rows * CharHeight * scale));
+	std::vector<SweepResult> results(combinations.size());
+	ParallelFor(combinations.size(), [&](size_t i, size_t) {
+		TRACE_SCOPE("sweep combination");
+		auto& result = results[i];
+		try
+		{
+			const auto probe = RenderSweepProbe(combinations[i].options, probeText, 2 * columns + 1, 2 * rows + 1);
+			std::vector<uint8_t> overflowing;
+			result.overflow = MeasureInkOverflow(probe, sample.size(), columns, overflowing);
+			result.panel = RenderSweepPanel(probe, sample.size(), columns, overflowing, panelWidth, panelHeight);
+		}
+		catch (...)
+		{
+			result.hr = wil::ResultFromCaughtException();
+		}
+	});
+
+	fs::create_directories(out);
+	std::vector<fs::path> sheets;
+	for (size_t first = 0; first < combinations.size(); first += perSheet)
+	{
+		const auto sheet = RenderSweepSheet(combinations, results, first, std::min(perSheet, combinations.size() - first), panelWidth, panelHeight);
+		const auto png = GpEncodePng(sheet.get());
+		sheets.push_back(out / std::format(L"sweep-{:03}.png", sheets.size() + 1));
+		wil::unique_hfile hFile(CreateFileW(sheets.back().c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+		THROW_LAST_ERROR_IF(!hFile);
+		WriteFileCheckSize(hFile.get(), const_cast<uint8_t*>(png.data()), static_cast<DWORD>(png.size()));
+	}
+	const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+	size_t failed = 0;
+	JsonWriter json;
+	json.BeginObject();
+	json.Member("elapsedMs", elapsed.count());
+	json.Member("sample", ToWString(sample));
+	json.Key("sheets").BeginArray();
+	for (const auto& sheet : sheets)
+		json.Value(sheet.wstring());
+	json.EndArray();
+	json.Key("combinations").BeginArray();
+	for (size_t i = 0; i < combinations.size(); ++i)
+	{
+		const auto& combination = combinations[i];
+		const auto& result = results[i];
+		if (FAILED(result.hr))
+		{
+			++failed;
+			Print(L"{:<48} failed: {}\n", combination.Label(), HResultMessage(result.hr));
+		}
+		else
+		{
+			const auto& overflow = result.overflow;
+			Print(L"{:<48} {:>3} of {} overflow, left {} top {} right {} bottom {} px, {:.2f}% of the ink outside\n", combination.Label(), overflow.glyphs, sample.size(),
+				overflow.left, overflow.top, overflow.right, overflow.bottom, overflow.OutsideFraction() * 100);
+		}
+
+		json.BeginObject();
+		json.Member("font", combination.face);
+		json.Member("size", combination.size);
+		json.Member("weight", combination.weight);
+		json.Member("backend", combination.gdip ? "gdip" : "dwrite");
+		json.Member("sheet", sheets[i / perSheet].wstring());
+		json.Member("ok", SUCCEEDED(result.hr));
+		if (FAILED(result.hr))
+			json.Member("message", HResultMessage(result.hr));
+		else
+		{
+			json.Key("overflow").BeginObject();
+			json.Member("glyphs", result.overflow.glyphs);
+			json.Member("left", result.overflow.left);
+			json.Member("top", result.overflow.top);
+			json.Member("right", result.overflow.right);
+			json.Member("bottom", result.overflow.bottom);
+			json.Member("outsideFraction", result.overflow.OutsideFraction());
+			json.EndObject();
+		}
+		json.EndObject();
+	}
+	json.EndArray();
+	json.Member("failed", failed);
+	json.EndObject();
+
+	if (auto jsonPath = args.Get(L"json"))
+		WriteJsonOutput(*jsonPath, json);
+	PrintError(L"{} combinations of {} characters in {} ms, {} sheets in {}\n", combinations.size(), sample.size(), elapsed.count(), sheets.size(), out.wstring());
+
+	return failed == 0 ? ExitSuccess : ExitFailure;
+}
@@ -0,0 +1,217 @@
+#pragma once
+
+// Phase level tracing in the Chrome trace event format, viewable in ui.perfetto.dev
+// or chrome://tracing with one track per thread. Recording is off until Start,
+// and a TRACE_SCOPE that is not recording costs one relaxed load.
+
+// Counts allocations made through operator new while an AllocationCounting is alive, e.g.
+// while a trace records or bench runs; otherwise operator new costs one relaxed load more
+// than malloc. malloc calls from zlib, GDI and DirectWrite are not seen. Only the exe
+// replaces operator new, CWTDGenLib.dll leaves its host's allocator alone and counts nothing.
+struct AllocationCounters
+{
+	std::atomic<uint32_t> users = 0;
+	std::atomic<uint64_t> count = 0;
+	std::atomic<uint64_t> bytes = 0;
+};
+AllocationCounters g_allocations;
+
+class AllocationCounting
+{
+public:
+	AllocationCounting() { g_allocations.users.fetch_add(1, std::memory_order_relaxed); }
+	~AllocationCounting() { g_allocations.users.fetch_sub(1, std::memory_order_relaxed); }
+
+	AllocationCounting(const AllocationCounting&) = delete;
+	AllocationCounting& operator=(const AllocationCounting&) = delete;
+};
+
+#ifndef CWTDGEN_EXPORTS
+void* operator new(size_t size)
+{
+	if (g_allocations.users.load(std::memory_order_relaxed) != 0)
+	{
+		g_allocations.count.fetch_add(1, std::memory_order_relaxed);
+		g_allocations.bytes.fetch_add(size, std::memory_order_relaxed);
+	}
+	if (void* p = malloc(size != 0 ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+#endif
+
+std::atomic<bool> g_traceEnabled = false;
+
+class TraceRecorder
+{
+public:
+	struct Event
+	{
+		const char* name; // String literal
+		char phase; // 'X' complete, 'C' counter
+		uint64_t start; // Microseconds since Start
+		uint64_t duration;
+		int64_t value;
+	};
+
+	static TraceRecorder& Instance()
+	{
+		static TraceRecorder s_recorder;
+		return s_recorder;
+	}
+
+	void Start()
+	{
+		std::lock_guard lock(m_lock);
+		m_threads.clear();
+		m_origin = std::chrono::steady_clock::now();
+		++m_generation;
+		m_counting.emplace();
+		g_traceEnabled = true;
+	}
+
+	// Call once the traced work has finished, buffers are read without their threads' cooperation
+	JsonWriter Stop()
+	{
+		g_traceEnabled = false;
+		std::lock_guard lock(m_lock);
+		m_counting.reset();
+
+		JsonWriter json;
+		json.BeginObject();
+		json.Key("traceEvents").BeginArray();
+		for (const auto& thread : m_threads)
+		{
+			json.BeginObject();
+			json.Member("name", "thread_name");
+			json.Member("ph", "M");
+			json.Member("pid", 1);
+			json.Member("tid", thread->id);
+			json.Key("args").BeginObject().Member("name", thread->name).EndObject();
+			json.EndObject();
+
+			for (const auto& event : thread->events)
+			{
+				json.BeginObject();
+				json.Member("name", event.name);
+				json.Member("ph", std::string_view(&event.phase, 1));
+				json.Member("ts", event.start);
+				if (event.phase == 'X')
+					json.Member("dur", event.duration);
+				json.Member("pid", 1);
+				json.Member("tid", thread->id);
+				if (event.phase == 'C')
+					json.Key("args").BeginObject().Member("value", event.value).EndObject();
+				json.EndObject();
+			}
+		}
+		json.EndArray();
+		json.Member("displayTimeUnit", "ms");
+		json.EndObject();
+
+		m_threads.clear();
+		return json;
+	}
+
+	uint64_t Now() const
+	{
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_origin).count());
+	}
+
+	void Record(const Event& event) { Local().events.push_back(event); }
+
+	// Shown as the thread's track name, may be called before tracing starts
+	static void SetThreadName(std::wstring name) { s_threadName = std::move(name); }
+
+private:
+	struct ThreadBuffer
+	{
+		uint32_t id;
+		std::wstring name;
+		std::vector<Event> events;
+	};
+
+	ThreadBuffer& Local()
+	{
+		if (s_buffer && s_bufferGeneration == m_generation)
+			return *s_buffer;
+
+		std::lock_guard lock(m_lock);
+		auto& buffer = m_threads.emplace_back(std::make_unique<ThreadBuffer>());
+		buffer->id = static_cast<uint32_t>(m_threads.size());
+		buffer->name = s_threadName.empty() ? std::format(L"thread {}", GetCurrentThreadId()) : s_threadName;
+		buffer->events.reserve(1024);
+		s_buffer = buffer.get();
+		s_bufferGeneration = m_generation;
+		return *buffer;
+	}
+
+	std::mutex m_lock;
+	std::vector<std::unique_ptr<ThreadBuffer>> m_threads;
+	std::chrono::steady_clock::time_point m_origin;
+	std::atomic<uint64_t> m_generation = 0; // Buffers of an earlier trace are not reused
+	std::optional<AllocationCounting> m_counting; // While recording
+
+	static thread_local ThreadBuffer* s_buffer;
+	static thread_local uint64_t s_bufferGeneration;
+	static thread_local std::wstring s_threadName;
+};
+
+thread_local TraceRecorder::ThreadBuffer* TraceRecorder::s_buffer = nullptr;
+thread_local uint64_t TraceRecorder::s_bufferGeneration = 0;
+thread_local std::wstring TraceRecorder::s_threadName;
+
+class TraceScope
+{
+public:
+	explicit TraceScope(const char* name)
+	{
+		if (g_traceEnabled.load(std::memory_order_relaxed))
+		{
+			m_name = name;
+			m_start = TraceRecorder::Instance().Now();
+		}
+	}
+
+	~TraceScope()
+	{
+		if (m_name)
+		{
+			auto& recorder = TraceRecorder::Instance();
+			recorder.Record({ m_name, 'X', m_start, recorder.Now() - m_start, 0 });
+		}
+	}
+
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+	const char* m_name = nullptr;
+	uint64_t m_start = 0;
+};
+
+inline void TraceCounter(const char* name, int64_t value)
+{
+	if (g_traceEnabled.load(std::memory_order_relaxed))
+	{
+		auto& recorder = TraceRecorder::Instance();
+		recorder.Record({ name, 'C', recorder.Now(), 0, value });
+	}
+}
+
+// Allocation totals so far, emitted at the end of each phase
+inline void TraceAllocations()
+{
+	if (g_traceEnabled.load(std::memory_order_relaxed))
+	{
+		TraceCounter("allocations", static_cast<int64_t>(g_allocations.count.load(std::memory_order_relaxed)));
+		TraceCounter("allocated KiB", static_cast<int64_t>(g_allocations.bytes.load(std::memory_order_relaxed) / 1024));
+	}
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
@@ -46,6 +46,108 @@ inline void WriteFileCheckSize(HANDLE hFile, void* data, DWORD size)
 	THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_HANDLE_DISK_FULL), size != written);
 }
 
+// Sequential reads and writes within [offset, offset + size) of a file. Every access passes
+// its offset, so several ranges can share a handle without sharing the file pointer.
+class FileRange
+{
+public:
+	explicit FileRange(HANDLE hFile, uint64_t offset = 0, uint64_t size = UINT64_MAX) : m_file(hFile), m_offset(offset), m_size(size) {}
+
+	// Returns the number of bytes read, 0 at the end of the range or the file
+	DWORD Read(void* buffer, DWORD size)
+	{
+		size = static_cast<DWORD>(std::min<uint64_t>(size, m_size - m_position));
+		if (size == 0)
+			return 0;
+
+		auto overlapped = Overlapped();
+		DWORD read = 0;
+		if (!ReadFile(m_file, buffer, size, &read, &overlapped))
+		{
+			const auto error = GetLastError();
+			THROW_WIN32_IF(error, error != ERROR_HANDLE_EOF);
+		}
+		m_position += read;
+		return read;
+	}
+
+	void ReadCheckSize(void* buffer, DWORD size)
+	{
+		THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_HANDLE_EOF), Read(buffer, size) != size);
+	}
+
+	void Write(const void* data, size_t size)
+	{
+		THROW_HR_IF(E_BOUNDS, size > m_size - m_position);
+		auto bytes = static_cast<const uint8_t*>(data);
+		while (size != 0)
+		{
+			const auto chunk = static_cast<DWORD>(std::min<size_t>(size, 0x40000000));
+			auto overlapped = Overlapped();
+			DWORD written;
+			THROW_IF_WIN32_BOOL_FALSE(WriteFile(m_file, bytes, chunk, &written, &overlapped));
+			THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_HANDLE_DISK_FULL), chunk != written);
+			m_position += chunk;
+			bytes += chunk;
+			size -= chunk;
+		}
+	}
+
+	uint64_t Position() const { return m_position; }
+
+private:
+	OVERLAPPED Overlapped() const
+	{
+		const uint64_t offset = m_offset + m_position;
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = static_cast<DWORD>(offset);
+		overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+		return overlapped;
+	}
+
+	HANDLE m_file;
+	uint64_t m_offset;
+	uint64_t m_size;
+	uint64_t m_position = 0;
+};
+
+// Reads bytes already in memory in place of a FileRange
+class MemoryInput
+{
+public:
+	explicit MemoryInput(std::span<const uint8_t> data) : m_data(data) {}
+
+	DWORD Read(void* buffer, DWORD size)
+	{
+		size = static_cast<DWORD>(std::min<size_t>(size, m_data.size() - m_position));
+		std::copy_n(m_data.data() + m_position, size, static_cast<uint8_t*>(buffer));
+		m_position += size;
+		return size;
+	}
+
+	void ReadCheckSize(void* buffer, DWORD size)
+	{
+		THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_HANDLE_EOF), Read(buffer, size) != size);
+	}
+
+	uint64_t Position() const { return m_position; }
+
+private:
+	std::span<const uint8_t> m_data;
+	size_t m_position = 0;
+};
+
+// Collects writes meant for a FileRange
+struct MemoryOutput
+{
+	std::vector<uint8_t> data;
+
+	void Write(const void* bytes, size_t size)
+	{
+		data.insert(data.end(), static_cast<const uint8_t*>(bytes), static_cast<const uint8_t*>(bytes) + size);
+	}
+};
+
 template <uint32_t multiple>
 inline uint32_t RoundUp(uint32_t i)
 {
@@ -87,6 +189,122 @@ std::wstring Utf8ToUtf16(std::string_view utf8)
 	return utf16;
 }
 
+std::string Utf16ToUtf8(std::wstring_view utf16)
+{
+	if (utf16.empty())
+	{
+		return {};
+	}
+
+	const int utf16Length = static_cast<int>(utf16.length());
+	const int utf8Length = WideCharToMultiByte(CP_UTF8, WC_ERR_INVALID_CHARS, utf16.data(), utf16Length, nullptr, 0, nullptr, nullptr);
+	THROW_LAST_ERROR_IF(utf8Length == 0);
+
+	std::string utf8(utf8Length, '\0');
+	const int result = WideCharToMultiByte(CP_UTF8, WC_ERR_INVALID_CHARS, utf16.data(), utf16Length, utf8.data(), utf8Length, nullptr, nullptr);
+	THROW_LAST_ERROR_IF(result == 0);
+
+	return utf8;
+}
+
+// Appends the decoded text to out. Runs of ASCII are widened 16 bytes at a time,
+// everything else is decoded and validated like MB_ERR_INVALID_CHARS does.
+void Utf8ToUtf32(std::string_view utf8, std::u32string& out)
+{
+	const auto src = reinterpret_cast<const uint8_t*>(utf8.data());
+	const size_t size = utf8.size();
+	const size_t base = out.size();
+	out.resize(base + size); // Never more code points than bytes
+	char32_t* dst = out.data() + base;
+
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	while (i < size)
+	{
+		if (i + 16 <= size)
+		{
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+			const uint32_t nonAscii = static_cast<uint32_t>(_mm_movemask_epi8(v));
+			if (nonAscii == 0)
+			{
+				const __m128i lo = _mm_unpacklo_epi8(v, zero);
+				const __m128i hi = _mm_unpackhi_epi8(v, zero);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi16(lo, zero));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4), _mm_unpackhi_epi16(lo, zero));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 8), _mm_unpacklo_epi16(hi, zero));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 12), _mm_unpackhi_epi16(hi, zero));
+				dst += 16;
+				i += 16;
+				continue;
+			}
+
+			// Copy the ASCII prefix, then fall through to decode one multi-byte sequence
+			for (const auto end = i + std::countr_zero(nonAscii); i < end; ++i)
+				*dst++ = src[i];
+		}
+
+		const uint8_t lead = src[i];
+		if (lead < 0x80)
+		{
+			*dst++ = lead;
+			++i;
+			continue;
+		}
+
+		uint32_t length = 0, ch = 0, minValue = 0;
+		if ((lead & 0xE0) == 0xC0)
+		{
+			length = 2;
+			ch = lead & 0x1F;
+			minValue = 0x80;
+		}
+		else if ((lead & 0xF0) == 0xE0)
+		{
+			length = 3;
+			ch = lead & 0x0F;
+			minValue = 0x800;
+		}
+		else if ((lead & 0xF8) == 0xF0)
+		{
+			length = 4;
+			ch = lead & 0x07;
+			minValue = 0x10000;
+		}
+		else
+			THROW_HR(HRESULT_FROM_WIN32(ERROR_NO_UNICODE_TRANSLATION));
+
+		THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_NO_UNICODE_TRANSLATION), i + length > size);
+		for (uint32_t k = 1; k < length; ++k)
+		{
+			const uint8_t trail = src[i + k];
+			THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_NO_UNICODE_TRANSLATION), (trail & 0xC0) != 0x80);
+			ch = (ch << 6) | (trail & 0x3F);
+		}
+		THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_NO_UNICODE_TRANSLATION), ch < minValue || ch > 0x10FFFF || (ch >= 0xD800 && ch <= 0xDFFF));
+
+		*dst++ = ch;
+		i += length;
+	}
+
+	out.resize(static_cast<size_t>(dst - out.data()));
+}
+
+enum struct TextEncoding
+{
+	Utf8, // No BOM, treated as UTF-8
+	Utf8Bom,
+	Utf16LE
+};
+
+TextEncoding DetectTextEncoding(std::span<const uint8_t> data)
+{
+	if (data.size() >= 3 && data[0] == 0xef && data[1] == 0xbb && data[2] == 0xbf) // UTF-8 BOM
+		return TextEncoding::Utf8Bom;
+	else if (data.size() >= 2 && data[0] == 0xff && data[1] == 0xFE) // UTF-16LE BOM
+		return TextEncoding::Utf16LE;
+	return TextEncoding::Utf8;
+}
+
 std::wstring ReadTextToUtf16String(HANDLE hFile)
 {
 	constexpr size_t ChunkSize = 16384;
@@ -102,38 +320,253 @@ std::wstring ReadTextToUtf16String(HANDLE hFile)
 		data.resize(offset + static_cast<size_t>(read));
 	} while (read != 0);
 	THROW_HR_IF(E_INVALIDARG, data.size() < 4);
-	if (data[0] == 0xef && data[1] == 0xbb && data[2] == 0xbf) // UTF-8 BOM
+	switch (DetectTextEncoding(data))
+	{
+	case TextEncoding::Utf8Bom:
 		return Utf8ToUtf16(std::string_view(reinterpret_cast<const char*>(data.data() + 3), data.size() - 3));
-	else if (data[0] == 0xff && data[1] == 0xFE) // UTF-16LE BOM
+	case TextEncoding::Utf16LE:
 		return std::wstring(reinterpret_cast<const wchar_t*>(data.data() + 2), data.size() / 2 - 1);
+	}
 	return Utf8ToUtf16(std::string_view(reinterpret_cast<const char*>(data.data()), data.size())); // Treat data as UTF-8
 }
 
-std::wstring ReadCharTableDatToUtf16String(HANDLE hFile)
+std::u32string Utf16ToUtf32(std::wstring_view utf16)
 {
-	DWORD size = GetFileSize(hFile, nullptr);
-	THROW_LAST_ERROR_IF(size == INVALID_FILE_SIZE);
+	std::u32string utf32;
+	utf32.reserve(utf16.size());
+	for (size_t i = 0; i < utf16.size(); ++i)
+	{
+		char32_t ch = utf16[i];
+		if (ch >= 0xD800 && ch <= 0xDBFF && i + 1 < utf16.size() && utf16[i + 1] >= 0xDC00 && utf16[i + 1] <= 0xDFFF)
+			ch = 0x10000 + ((ch - 0xD800) << 10) + (utf16[++i] - 0xDC00);
+		utf32.push_back(ch);
+	}
+	return utf32;
+}
 
-	uint32_t count = 0;
-	ReadFileCheckSize(hFile, &count, sizeof(count));
+// Same BOM detection as ReadTextToUtf16String, appends the decoded text to out
+void DecodeTextToUtf32(std::span<const uint8_t> data, std::u32string& out)
+{
+	switch (DetectTextEncoding(data))
+	{
+	case TextEncoding::Utf8Bom:
+		Utf8ToUtf32(std::string_view(reinterpret_cast<const char*>(data.data() + 3), data.size() - 3), out);
+		return;
+	case TextEncoding::Utf16LE:
+		out += Utf16ToUtf32(std::wstring_view(reinterpret_cast<const wchar_t*>(data.data() + 2), data.size() / 2 - 1));
+		return;
+	}
+	Utf8ToUtf32(std::string_view(reinterpret_cast<const char*>(data.data()), data.size()), out);
+}
 
-	const DWORD strSize = count * sizeof(uint32_t);
-	THROW_HR_IF(E_INVALIDARG, sizeof(count) + strSize != size);
+// Writes ch as UTF-16 into buf and returns the number of code units used
+inline uint32_t EncodeUtf16(char32_t ch, wchar_t (&buf)[2])
+{
+	if (ch < 0x10000)
+	{
+		buf[0] = static_cast<wchar_t>(ch);
+		return 1;
+	}
+	ch -= 0x10000;
+	buf[0] = static_cast<wchar_t>(0xD800 + (ch >> 10));
+	buf[1] = static_cast<wchar_t>(0xDC00 + (ch & 0x3FF));
+	return 2;
+}
+
+struct MappedFile
+{
+	wil::unique_hfile file;
+	wil::unique_handle mapping;
+	wil::unique_mapview_ptr<uint8_t> view;
+	size_t size = 0;
+
+	std::span<const uint8_t> Data() const { return { view.get(), size }; }
+};
+
+MappedFile MapFileForRead(const fs::path& path)
+{
+	MappedFile mapped;
+	mapped.file.reset(CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+	THROW_LAST_ERROR_IF(!mapped.file);
+
+	LARGE_INTEGER size;
+	THROW_IF_WIN32_BOOL_FALSE(GetFileSizeEx(mapped.file.get(), &size));
+	mapped.size = static_cast<size_t>(size.QuadPart);
+	if (mapped.size == 0) // Empty files can not be mapped
+		return mapped;
 
-	auto u32str = std::make_unique<uint32_t[]>(count);
-	ReadFileCheckSize(hFile, u32str.get(), strSize);
+	mapped.mapping.reset(CreateFileMappingW(mapped.file.get(), nullptr, PAGE_READONLY, 0, 0, nullptr));
+	THROW_LAST_ERROR_IF(!mapped.mapping);
+	mapped.view.reset(static_cast<uint8_t*>(MapViewOfFile(mapped.mapping.get(), FILE_MAP_READ, 0, 0, 0)));
+	THROW_LAST_ERROR_IF(!mapped.view);
+	return mapped;
+}
 
-	std::wstring result;
-	result.reserve(count);
+// A name next to path to write it under before renaming it over path. Process and thread make
+// it unique, so two writers of the same path never share a temporary file.
+fs::path TempPathFor(const fs::path& path)
+{
+	auto temp = path;
+	temp += std::format(L".{}-{}.tmp", GetCurrentProcessId(), GetCurrentThreadId());
+	return temp;
+}
 
-	for (size_t i = 0; i < count; ++i)
+// Runs fn(index, worker) for every index in [0, count) on all hardware threads.
+// The first exception thrown by fn is rethrown after all workers have stopped.
+template<typename F>
+void ParallelFor(size_t count, F&& fn)
+{
+	const size_t workerCount = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), count);
+	std::atomic<size_t> next = 0;
+	std::exception_ptr error;
+	std::mutex errorLock;
 	{
-		const auto u32char = u32str[i];
-		THROW_HR_IF(E_NOTIMPL, u32char > UINT16_MAX);
-		result.push_back(static_cast<wchar_t>(u32char));
+		std::vector<std::jthread> workers;
+		workers.reserve(workerCount);
+		for (size_t worker = 0; worker < workerCount; ++worker)
+		{
+			workers.emplace_back([&, worker] {
+				try
+				{
+					for (size_t i = next++; i < count; i = next++)
+						fn(i, worker);
+				}
+				catch (...)
+				{
+					next = count;
+					std::lock_guard lock(errorLock);
+					if (!error)
+						error = std::current_exception();
+				}
+			});
+		}
 	}
+	if (error)
+		std::rethrow_exception(error);
+}
+
+// Progress of one phase of long running work, counted in units the phase picks, with
+// cooperative cancellation. Advance and Check throw ERROR_CANCELLED once a stop is requested.
+class JobProgress
+{
+public:
+	explicit JobProgress(std::stop_token stop = {}) : m_stop(std::move(stop)) {}
+
+	void Begin(uint64_t total)
+	{
+		Check();
+		m_done.store(0, std::memory_order_relaxed);
+		m_total.store(total, std::memory_order_relaxed);
+	}
+
+	void Advance(uint64_t count = 1)
+	{
+		m_done.fetch_add(count, std::memory_order_relaxed);
+		Check();
+	}
+
+	void Check() const { THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_CANCELLED), m_stop.stop_requested()); }
+
+	uint64_t Done() const { return m_done.load(std::memory_order_relaxed); }
+	uint64_t Total() const { return m_total.load(std::memory_order_relaxed); }
+
+private:
+	std::stop_token m_stop;
+	std::atomic<uint64_t> m_done = 0;
+	std::atomic<uint64_t> m_total = 0;
+};
+
+using Sha256Digest = std::array<uint8_t, 32>;
+
+Sha256Digest Sha256(std::span<const uint8_t> data)
+{
+	wil::unique_bcrypt_hash hash;
+	THROW_IF_NTSTATUS_FAILED(BCryptCreateHash(BCRYPT_SHA256_ALG_HANDLE, &hash, nullptr, 0, nullptr, 0, 0));
+	while (!data.empty())
+	{
+		const auto chunk = data.first(std::min<size_t>(data.size(), ULONG_MAX));
+		THROW_IF_NTSTATUS_FAILED(BCryptHashData(hash.get(), const_cast<PUCHAR>(chunk.data()), static_cast<ULONG>(chunk.size()), 0));
+		data = data.subspan(chunk.size());
+	}
+	Sha256Digest digest;
+	THROW_IF_NTSTATUS_FAILED(BCryptFinishHash(hash.get(), digest.data(), static_cast<ULONG>(digest.size()), 0));
+	return digest;
+}
+
+// CRC-32C (Castagnoli), with the SSE4.2 crc32 instruction when the CPU has it
+uint32_t Crc32c(std::span<const uint8_t> data, uint32_t crc = 0)
+{
+	static const bool hasSse42 = [] {
+		int info[4];
+		__cpuid(info, 1);
+		return (info[2] & (1 << 20)) != 0;
+	}();
+
+	crc = ~crc;
+	auto p = data.data();
+	size_t n = data.size();
+	if (hasSse42)
+	{
+#if defined(_M_X64)
+		uint64_t crc64 = crc;
+		for (; n >= 8; p += 8, n -= 8)
+		{
+			uint64_t v;
+			memcpy(&v, p, sizeof(v));
+			crc64 = _mm_crc32_u64(crc64, v);
+		}
+		crc = static_cast<uint32_t>(crc64);
+#else
+		for (; n >= 4; p += 4, n -= 4)
+		{
+			uint32_t v;
+			memcpy(&v, p, sizeof(v));
+			crc = _mm_crc32_u32(crc, v);
+		}
+#endif
+		for (; n != 0; ++p, --n)
+			crc = _mm_crc32_u8(crc, *p);
+	}
+	else
+	{
+		static const auto table = [] {
+			std::array<uint32_t, 256> t;
+			for (uint32_t i = 0; i < 256; ++i)
+			{
+				uint32_t c = i;
+				for (int k = 0; k < 8; ++k)
+					c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+				t[i] = c;
+			}
+			return t;
+		}();
+		for (; n != 0; ++p, --n)
+			crc = table[(crc ^ *p) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+std::wstring ToHex(std::span<const uint8_t> data)
+{
+	std::wstring hex;
+	hex.reserve(data.size() * 2);
+	for (auto b : data)
+		hex += std::format(L"{:02x}", b);
+	return hex;
+}
+
+std::wstring HResultMessage(HRESULT hr)
+{
+	wil::unique_hlocal_string message;
+	const DWORD length = FormatMessageW(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+		nullptr, static_cast<DWORD>(hr), 0, reinterpret_cast<LPWSTR>(message.put()), 0, nullptr);
+	if (length == 0)
+		return std::format(L"0x{:08X}", static_cast<uint32_t>(hr));
 
-	return result;
+	std::wstring_view text(message.get(), length);
+	while (!text.empty() && (text.back() == L'\n' || text.back() == L'\r' || text.back() == L' '))
+		text.remove_suffix(1);
+	return std::wstring(text);
 }
 
 uint32_t Log2(uint32_t x)
@@ -149,7 +582,7 @@ uint32_t Log2Ceil(uint32_t x)
 }
 
 template<size_t N>
-constexpr bool IsWCharInRanges(const std::pair<wchar_t, wchar_t> (&ranges)[N], wchar_t ch)
+constexpr bool IsCharInRanges(const std::pair<char32_t, char32_t> (&ranges)[N], char32_t ch)
 {
 	for (const auto& range : ranges)
 	{
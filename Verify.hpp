@@ -0,0 +1,166 @@
+#pragma once
+
+// Checks installs against the manifest written at generation time (see ManifestFileName)
+// without regenerating anything: each fonts.wtd is inflated, its dictionary walked, and
+// font_chs compared by format, size and the CRC-32C of its top level. Files are read with
+// deep overlapped queues (see Io.hpp) and inflated and checked on all hardware threads as
+// their reads complete.
+
+struct ManifestEntry
+{
+	const GameInfo* game;
+	fs::path path; // Relative to the install
+	AtlasFormat format; // DXT5 for manifests from before the key
+	uint32_t width;
+	uint32_t height;
+	uint32_t crc;
+};
+
+std::vector<ManifestEntry> ReadManifest(const fs::path& path)
+{
+	THROW_HR_IF_MSG(HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND), !fs::exists(path), "no manifest %ls", path.c_str());
+
+	std::vector<ManifestEntry> entries;
+	for (const auto& game : Games)
+	{
+		auto relative = GetIniString(path, game.name, L"path");
+		if (!relative)
+			continue;
+
+		auto get = [&](const wchar_t* key, int radix) {
+			auto value = GetIniString(path, game.name, key);
+			THROW_HR_IF_MSG(HRESULT_FROM_WIN32(ERROR_INVALID_DATA), !value, "%ls: [%ls] has no %ls", path.c_str(), game.name, key);
+			return static_cast<uint32_t>(std::stoul(*value, nullptr, radix));
+		};
+		const auto formatName = GetIniString(path, game.name, L"format").value_or(AtlasFormatName(AtlasFormat::Dxt5));
+		const auto format = ParseAtlasFormat(formatName);
+		THROW_HR_IF_MSG(HRESULT_FROM_WIN32(ERROR_INVALID_DATA), !format, "%ls: [%ls] has unknown format %ls", path.c_str(), game.name, formatName.c_str());
+		entries.push_back({ &game, fs::path(*relative), *format, get(L"width", 10), get(L"height", 10), get(L"crc32c", 16) });
+	}
+	THROW_HR_IF_MSG(HRESULT_FROM_WIN32(ERROR_INVALID_DATA), entries.empty(), "%ls lists no games", path.c_str());
+	return entries;
+}
+
+// Empty if the file matches expected. Throws if it isn't a valid dictionary.
+std::wstring VerifyFontChs(std::span<const uint8_t> file, const ManifestEntry& expected, uint32_t& crc)
+{
+	TRACE_SCOPE("verify fonts.wtd");
+	const auto source = ReadWTD(file);
+
+	// Checks the dictionary arrays and that every texture's data is inside the physical segment
+	const auto textures = ListTextures(source);
+	const auto fontChs = std::find_if(textures.begin(), textures.end(), [hash = RageUtil::HashString("font_chs")](const TextureEntry& t) { return t.hash == hash; });
+	if (fontChs == textures.end())
+		return L"no font_chs";
+	const auto format = ToAtlasFormat(fontChs->d3dFormat);
+	if (format != expected.format)
+	{
+		const auto actual = format ? std::wstring(AtlasFormatName(*format)) : std::format(L"D3DFORMAT {}", static_cast<uint32_t>(fontChs->d3dFormat));
+		return std::format(L"font_chs format {}, expected {}", actual, AtlasFormatName(expected.format));
+	}
+	if (fontChs->width != expected.width || fontChs->height != expected.height)
+		return std::format(L"font_chs is {}x{}, expected {}x{}", fontChs->width, fontChs->height, expected.width, expected.height);
+
+	size_t rowPitch, slicePitch;
+	THROW_IF_FAILED(DirectX::ComputePitch(fontChs->format, fontChs->width, fontChs->height, rowPitch, slicePitch));
+	crc = Crc32c(fontChs->pixels.first(slicePitch));
+	if (crc != expected.crc)
+		return std::format(L"font_chs crc32c {:08x}, expected {:08x}", crc, expected.crc);
+	return {};
+}
+
+struct VerifyResult
+{
+	fs::path file;
+	const ManifestEntry* expected;
+	HRESULT hr = S_OK;
+	std::wstring problem;
+	uint32_t crc = 0;
+
+	const wchar_t* Status() const
+	{
+		if (hr == HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND) || hr == HRESULT_FROM_WIN32(ERROR_PATH_NOT_FOUND))
+			return L"missing";
+		if (FAILED(hr))
+			return L"corrupt";
+		return problem.empty() ? L"ok" : L"mismatch";
+	}
+};
+
+// verify <install dir>... [--manifest=<manifest.ini>] [--json=<results.json>|-]
+int CliVerify(const CliArgs& args)
+{
+	if (args.positional.empty())
+		return ExitUsage;
+
+	// One manifest for every install, or each install's own
+	const auto manifestPath = args.Get(L"manifest");
+	std::vector<std::vector<ManifestEntry>> manifests;
+	if (manifestPath)
+		manifests.push_back(ReadManifest(fs::path(*manifestPath)));
+	else
+	{
+		for (const auto& install : args.positional)
+			manifests.push_back(ReadManifest(fs::path(install) / ManifestFileName));
+	}
+
+	std::vector<VerifyResult> results;
+	for (size_t i = 0; i < args.positional.size(); ++i)
+	{
+		for (const auto& entry : manifests[manifestPath ? 0 : i])
+			results.push_back({ .file = fs::path(args.positional[i]) / entry.path, .expected = &entry });
+	}
+
+	std::vector<fs::path> files;
+	for (const auto& result : results)
+		files.push_back(result.file);
+
+	const auto start = std::chrono::steady_clock::now();
+	ForEachFileRead(files, [&](size_t i, std::span<const uint8_t> data) {
+		auto& result = results[i];
+		try
+		{
+			result.problem = VerifyFontChs(data, *result.expected, result.crc);
+		}
+		catch (...)
+		{
+			result.hr = wil::ResultFromCaughtException();
+		}
+	}, [&](size_t i, HRESULT hr) { results[i].hr = hr; });
+	const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+	size_t failed = 0;
+	JsonWriter json;
+	json.BeginObject();
+	json.Member("elapsedMs", elapsed.count());
+	json.Key("files").BeginArray();
+	for (const auto& result : results)
+	{
+		const auto status = result.Status();
+		const bool ok = SUCCEEDED(result.hr) && result.problem.empty();
+		failed += ok ? 0 : 1;
+
+		const auto detail = FAILED(result.hr) ? HResultMessage(result.hr) : result.problem;
+		Print(L"{:<8} {:<6} {}{}\n", status, result.expected->game->name, result.file.wstring(), detail.empty() ? L"" : L": " + detail);
+
+		json.BeginObject();
+		json.Member("path", result.file.wstring());
+		json.Member("game", result.expected->game->name);
+		json.Member("status", status);
+		if (!detail.empty())
+			json.Member("message", detail);
+		if (SUCCEEDED(result.hr) && result.crc != 0)
+			json.Member("crc32c", std::format(L"{:08x}", result.crc));
+		json.EndObject();
+	}
+	json.EndArray();
+	json.Member("checked", results.size());
+	json.Member("failed", failed);
+	json.EndObject();
+
+	if (auto jsonPath = args.Get(L"json"))
+		WriteJsonOutput(*jsonPath, json);
+	PrintError(L"{} of {} files verified in {} ms\n", results.size() - failed, results.size(), elapsed.count());
+
+	return failed == 0 ? ExitSuccess : ExitFailure;
+}
@@ -0,0 +1,379 @@
+#pragma once
+
+// Live regeneration. Watches the fonts, char table and source fonts.wtd files of a
+// job and, once a burst of changes has settled, redraws only the cells whose
+// character changed, recompresses only the BC3 blocks under them and rewrites
+// only the outputs that depend on what changed.
+
+// Watches single files through ReadDirectoryChangesW on their directories
+class FileWatcher
+{
+public:
+	FileWatcher() = default;
+	FileWatcher(const FileWatcher&) = delete;
+	FileWatcher& operator=(const FileWatcher&) = delete;
+
+	void Add(const fs::path& file, uint32_t tag)
+	{
+		const auto path = fs::absolute(file);
+		const auto dirPath = path.parent_path();
+		auto dir = std::find_if(m_dirs.begin(), m_dirs.end(), [&](const auto& d) { return EqualsIgnoreCase(d->path.native(), dirPath.native()); });
+		if (dir == m_dirs.end())
+		{
+			auto newDir = std::make_unique<Directory>();
+			newDir->path = dirPath;
+			newDir->handle.reset(CreateFileW(dirPath.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+				nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr));
+			THROW_LAST_ERROR_IF(!newDir->handle);
+			newDir->event.create(wil::EventOptions::ManualReset);
+			newDir->overlapped.hEvent = newDir->event.get();
+			Issue(*newDir);
+			m_dirs.emplace_back(std::move(newDir));
+			dir = m_dirs.end() - 1;
+		}
+		(*dir)->files.emplace_back(path.filename().wstring(), tag);
+	}
+
+	// Waits up to timeout for changes and appends the tags of changed files.
+	// Returns false once stopEvent is signaled.
+	bool Wait(DWORD timeout, HANDLE stopEvent, std::vector<uint32_t>& changed)
+	{
+		std::vector<HANDLE> handles = { stopEvent };
+		for (const auto& dir : m_dirs)
+			handles.push_back(dir->event.get());
+
+		const DWORD ret = WaitForMultipleObjects(static_cast<DWORD>(handles.size()), handles.data(), FALSE, timeout);
+		if (ret == WAIT_TIMEOUT)
+			return true;
+		THROW_LAST_ERROR_IF(ret == WAIT_FAILED);
+		if (ret == WAIT_OBJECT_0)
+			return false;
+
+		auto& dir = *m_dirs[ret - WAIT_OBJECT_0 - 1];
+		DWORD bytes = 0;
+		const bool ok = GetOverlappedResult(dir.handle.get(), &dir.overlapped, &bytes, FALSE);
+		if (!ok || bytes == 0)
+		{
+			// The buffer overflowed, anything may have changed
+			for (const auto& [name, tag] : dir.files)
+				changed.push_back(tag);
+		}
+		else
+		{
+			auto p = reinterpret_cast<const uint8_t*>(dir.buffer.data());
+			while (true)
+			{
+				auto info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(p);
+				std::wstring_view name(info->FileName, info->FileNameLength / sizeof(wchar_t));
+				for (const auto& [file, tag] : dir.files)
+				{
+					if (EqualsIgnoreCase(file, name))
+						changed.push_back(tag);
+				}
+				if (info->NextEntryOffset == 0)
+					break;
+				p += info->NextEntryOffset;
+			}
+		}
+		Issue(dir);
+		return true;
+	}
+
+private:
+	struct Directory
+	{
+		fs::path path;
+		wil::unique_hfile handle;
+		wil::unique_event event;
+		OVERLAPPED overlapped = {};
+		std::vector<DWORD> buffer = std::vector<DWORD>(16 * 1024); // DWORD aligned, as ReadDirectoryChangesW requires
+		std::vector<std::pair<std::wstring, uint32_t>> files;
+
+		~Directory()
+		{
+			// The pending read writes into buffer until it is cancelled
+			DWORD bytes;
+			if (handle && CancelIoEx(handle.get(), &overlapped))
+				GetOverlappedResult(handle.get(), &overlapped, &bytes, TRUE);
+		}
+	};
+
+	static void Issue(Directory& dir)
+	{
+		dir.event.ResetEvent();
+		THROW_IF_WIN32_BOOL_FALSE(ReadDirectoryChangesW(dir.handle.get(), dir.buffer.data(), static_cast<DWORD>(dir.buffer.size() * sizeof(DWORD)), FALSE,
+			FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE, nullptr, &dir.overlapped, nullptr));
+	}
+
+	std::vector<std::unique_ptr<Directory>> m_dirs;
+};
+
+// The current state of one job's outputs, updated in place as its inputs change
+class LiveJob
+{
+public:
+	struct Timings
+	{
+		std::chrono::milliseconds render{}, compress{}, write{};
+		size_t cells = 0;
+		size_t outputs = 0;
+	};
+
+	explicit LiveJob(const BatchJob& job) : m_job(job)
+	{
+		m_cells = LoadCharTable(m_job.charTablePath).Cells();
+		m_bitmap = RenderCharsBitmap(m_job.options, m_cells);
+		m_image = EncodeCharsImage(m_bitmap.Image(), m_job.options.format, m_job.options.quality, nullptr, m_memo.get());
+		for (const auto game : m_job.games)
+			m_sources.emplace_back(ReadWTD(m_job.gamePath / game->fontsPath));
+		for (size_t i = 0; i < m_job.games.size(); ++i)
+			WriteGame(i);
+	}
+
+	const BatchJob& Job() const { return m_job; }
+
+	struct Change
+	{
+		bool font = false; // Every cell may look different
+		bool charTable = false; // Only cells whose character changed are drawn again
+		std::vector<size_t> sources; // Games whose fonts.wtd changed
+	};
+
+	Timings Update(const Change& change)
+	{
+		Timings timings;
+		bool atlasChanged = false;
+		auto start = std::chrono::steady_clock::now();
+		for (auto i : change.sources)
+			m_sources[i] = ReadWTD(m_job.gamePath / m_job.games[i]->fontsPath);
+
+		if (change.font)
+		{
+			RefreshFonts();
+			m_cells = LoadCharTable(m_job.charTablePath).Cells();
+			m_bitmap = RenderCharsBitmap(m_job.options, m_cells);
+			auto rendered = std::chrono::steady_clock::now();
+			m_image = EncodeCharsImage(m_bitmap.Image(), m_job.options.format, m_job.options.quality, nullptr, m_memo.get());
+			timings.render = std::chrono::duration_cast<std::chrono::milliseconds>(rendered - start);
+			timings.compress = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - rendered);
+			timings.cells = m_cells.size();
+			atlasChanged = true;
+		}
+		else if (change.charTable)
+		{
+			auto cells = LoadCharTable(m_job.charTablePath).Cells();
+			constexpr size_t Capacity = TextureXChars * TextureYChars;
+			std::vector<uint32_t> dirty;
+			for (size_t i = 0; i < std::min(std::max(cells.size(), m_cells.size()), Capacity); ++i)
+			{
+				const char32_t before = i < m_cells.size() ? m_cells[i] : 0, after = i < cells.size() ? cells[i] : 0;
+				if (before != after)
+					dirty.push_back(static_cast<uint32_t>(i));
+			}
+			m_cells = std::move(cells);
+
+			if (!dirty.empty())
+			{
+				RenderCells(dirty);
+				auto rendered = std::chrono::steady_clock::now();
+				CompressCells(dirty);
+				timings.render = std::chrono::duration_cast<std::chrono::milliseconds>(rendered - start);
+				timings.compress = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - rendered);
+				timings.cells = dirty.size();
+				atlasChanged = true;
+			}
+		}
+
+		// A new atlas goes to every game, otherwise only changed sources are patched again
+		std::vector<size_t> games = change.sources;
+		if (atlasChanged)
+		{
+			games.resize(m_job.games.size());
+			std::iota(games.begin(), games.end(), size_t(0));
+		}
+		auto writeStart = std::chrono::steady_clock::now();
+		ParallelFor(games.size(), [&](size_t i, size_t) { WriteGame(games[i]); });
+		timings.write = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - writeStart);
+		timings.outputs = games.size();
+		return timings;
+	}
+
+private:
+	static RECT CellRect(uint32_t cell)
+	{
+		const LONG left = static_cast<LONG>(cell % TextureXChars * CharWidth), top = static_cast<LONG>(cell / TextureXChars * CharHeight);
+		return { left, top, left + static_cast<LONG>(CharWidth), top + static_cast<LONG>(CharHeight) };
+	}
+
+	// Draws the new characters side by side in a strip, then copies each into its cell.
+	// Ink that spills out of a cell is clipped, the game never samples outside the cell anyway.
+	void RenderCells(std::span<const uint32_t> dirty)
+	{
+		std::u32string text;
+		std::vector<uint32_t> drawn;
+		for (auto cell : dirty)
+		{
+			if (cell < m_cells.size())
+			{
+				text.push_back(m_cells[cell]);
+				drawn.push_back(cell);
+			}
+		}
+
+		const size_t rowPitch = m_bitmap.width * 4;
+		for (auto cell : dirty) // Removed cells stay empty
+		{
+			const auto rect = CellRect(cell);
+			for (LONG y = rect.top; y < rect.bottom; ++y)
+				std::fill_n(m_bitmap.bits + y * rowPitch + rect.left * 4, CharWidth * 4, '\0');
+		}
+		if (drawn.empty())
+			return;
+
+		const uint32_t stripRows = (static_cast<uint32_t>(drawn.size()) + TextureXChars - 1) / TextureXChars;
+		auto strip = RenderCharsBitmap(m_job.options, text, TextureWidth, stripRows * CharHeight);
+		for (size_t i = 0; i < drawn.size(); ++i)
+		{
+			const auto from = CellRect(static_cast<uint32_t>(i)), to = CellRect(drawn[i]);
+			for (LONG y = 0; y < static_cast<LONG>(CharHeight); ++y)
+				std::copy_n(strip.bits + (from.top + y) * rowPitch + from.left * 4, CharWidth * 4, m_bitmap.bits + (to.top + y) * rowPitch + to.left * 4);
+		}
+	}
+
+	// Adjacent dirty cells of a row are recompressed as one region
+	void CompressCells(std::span<const uint32_t> dirty)
+	{
+		const auto img = m_bitmap.Image();
+		for (size_t i = 0; i < dirty.size();)
+		{
+			size_t j = i + 1;
+			while (j < dirty.size() && dirty[j] == dirty[j - 1] + 1 && dirty[j] % TextureXChars != 0)
+				++j;
+			auto rect = CellRect(dirty[i]);
+			rect.right = CellRect(dirty[j - 1]).right;
+			EncodeCharsRegion(img, rect, m_image, m_job.options.quality, m_memo.get());
+			i = j;
+		}
+	}
+
+	void WriteGame(size_t gameIndex)
+	{
+		auto out = m_job.outputRoot / m_job.games[gameIndex]->newFontsPath;
+		fs::create_directories(out.parent_path());
+		PatchWTD(m_sources[gameIndex], out, m_image);
+	}
+
+	BatchJob m_job;
+	std::u32string m_cells;
+	CharsBitmap m_bitmap;
+	DirectX::ScratchImage m_image;
+	std::unique_ptr<Bc3BlockMemo> m_memo = std::make_unique<Bc3BlockMemo>(); // The job's quality never changes, so edits reuse it
+	std::vector<SourceResource> m_sources;
+};
+
+// watch <job file> [--job=<variant>] [--debounce=ms]
+int CliWatch(const CliArgs& args)
+{
+	if (args.positional.empty())
+		return ExitUsage;
+
+	const auto jobs = ReadJobFile(fs::path(args.positional[0]));
+	THROW_HR_IF_MSG(E_INVALIDARG, jobs.empty(), "no variants in job file");
+	auto job = jobs.begin();
+	if (auto name = args.Get(L"job"))
+	{
+		job = std::find_if(jobs.begin(), jobs.end(), [&](const BatchJob& j) { return EqualsIgnoreCase(j.name, *name); });
+		THROW_HR_IF_MSG(E_INVALIDARG, job == jobs.end(), "no variant named %.*ls", static_cast<int>(name->size()), name->data());
+	}
+	const auto debounce = std::chrono::milliseconds(std::stoul(std::wstring(args.Get(L"debounce", L"200"))));
+
+	auto start = std::chrono::steady_clock::now();
+	LiveJob live(*job);
+	Print(L"{}: generated in {} ms\n", live.Job().name, std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+
+	// Tags: 0 font files, 1 char table, 2 + i source of game i
+	constexpr uint32_t FontTag = 0, CharTableTag = 1, SourceTag = 2;
+	FileWatcher watcher;
+	std::vector<fs::path> fontFiles;
+	for (size_t i = 0; i < job->options.fonts.Count(); ++i)
+	{
+		for (auto& path : GetFontFilePaths(job->options.fonts[i]))
+		{
+			if (std::find(fontFiles.begin(), fontFiles.end(), path) == fontFiles.end())
+				fontFiles.emplace_back(std::move(path));
+		}
+	}
+	for (const auto& path : fontFiles)
+		watcher.Add(path, FontTag);
+	watcher.Add(job->charTablePath, CharTableTag);
+	for (size_t i = 0; i < job->games.size(); ++i)
+		watcher.Add(job->gamePath / job->games[i]->fontsPath, SourceTag + static_cast<uint32_t>(i));
+
+	static wil::unique_event s_stop(wil::EventOptions::ManualReset);
+	SetConsoleCtrlHandler([](DWORD) -> BOOL { s_stop.SetEvent(); return TRUE; }, TRUE);
+	Print(L"Watching {} files, Ctrl+C to stop\n", fontFiles.size() + 1 + job->games.size());
+
+	std::set<uint32_t> pending;
+	std::chrono::steady_clock::time_point firstChange, lastChange;
+	std::vector<uint32_t> changed;
+	while (true)
+	{
+		DWORD timeout = INFINITE;
+		if (!pending.empty())
+		{
+			auto quiet = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - lastChange);
+			timeout = static_cast<DWORD>(std::max<int64_t>((debounce - quiet).count(), 0));
+		}
+
+		changed.clear();
+		if (!watcher.Wait(timeout, s_stop.get(), changed))
+			break;
+		if (!changed.empty())
+		{
+			lastChange = std::chrono::steady_clock::now();
+			if (pending.empty())
+				firstChange = lastChange;
+			pending.insert(changed.begin(), changed.end());
+			continue;
+		}
+		if (pending.empty() || std::chrono::steady_clock::now() - lastChange < debounce)
+			continue;
+
+		try
+		{
+			LiveJob::Change change;
+			std::wstring what;
+			for (auto tag : pending)
+			{
+				if (tag == FontTag)
+					change.font = true;
+				else if (tag == CharTableTag)
+					change.charTable = true;
+				else
+					change.sources.push_back(tag - SourceTag);
+
+				const auto name = tag == FontTag ? std::wstring(L"font") : tag == CharTableTag ? std::wstring(L"char table") : std::format(L"{} fonts.wtd", job->games[tag - SourceTag]->name);
+				what += (what.empty() ? L"" : L", ") + name;
+			}
+			auto timings = live.Update(change);
+			pending.clear();
+
+			const auto latency = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - firstChange);
+			Print(L"{}: {} cells, {} outputs, {} ms after the change (render {} ms, compress {} ms, write {} ms)\n",
+				what, timings.cells, timings.outputs, latency.count(), timings.render.count(), timings.compress.count(), timings.write.count());
+		}
+		catch (...)
+		{
+			const auto hr = wil::ResultFromCaughtException();
+			if (hr == HRESULT_FROM_WIN32(ERROR_SHARING_VIOLATION))
+			{
+				lastChange = std::chrono::steady_clock::now(); // Still being written, try again once it settles
+				continue;
+			}
+			PrintError(L"error 0x{:08X}: {}\n", static_cast<uint32_t>(hr), HResultMessage(hr));
+			pending.clear();
+		}
+	}
+
+	return ExitSuccess;
+}
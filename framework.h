@@ -5,6 +5,8 @@
 #define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers
 #define NOMINMAX
 // Windows Header Files
+#include <winsock2.h>
+#include <ws2tcpip.h>
 #include <windows.h>
 #include <windowsx.h>
 #include <commdlg.h>
@@ -13,6 +15,9 @@
 #include <dwrite.h>
 #include <d3d9types.h> // for D3DFORMAT
 #include <shellapi.h>
+#include <bcrypt.h>
+#include <psapi.h>
+#include <winioctl.h> // for FSCTL_DUPLICATE_EXTENTS_TO_FILE
 
 // Fix gdiplustypes.h requires min/max
 #include <algorithm>
@@ -29,3 +34,27 @@ using std::max;
 #include <optional>
 #include <unordered_set>
 #include <span>
+#include <unordered_map>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <format>
+#include <functional>
+#include <future>
+#include <latch>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <set>
+#include <stop_token>
+#include <thread>
+#include <tuple>
+
+// SIMD intrinsics
+#include <emmintrin.h>
+#include <nmmintrin.h>
+#include <intrin.h>
@@ -23,6 +23,8 @@
 #define IDC_GENERATE                    1017
 #define IDM_SELECT_DIR                  1018
 #define IDM_OPEN_DIR                    1019
+#define IDC_STATUS                      1020
+#define IDC_PROGRESS                    1021
 #define IDC_STATIC                      -1
 
 // Next default values for new objects